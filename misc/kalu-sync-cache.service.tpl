@@ -0,0 +1,8 @@
+[Unit]
+Description=Synchronize kalu's shared cache of databases
+After=network-online.target
+Wants=network-online.target
+
+[Service]
+Type=oneshot
+ExecStart=@BINDIR@/kalu --sync-cache
@@ -27,13 +27,25 @@
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h> /* PATH_MAX */
+#include <unistd.h>
 #include <sys/types.h> /* off_t */
+#include <sys/stat.h>
+#include <sys/time.h> /* utimes */
+#include <sys/select.h>
+#include <sys/socket.h> /* socketpair */
+
+/* curl */
+#include <curl/curl.h>
 
 /* PolicyKit */
 #include <polkit/polkit.h>
 
 /* gio - for dbus */
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
 
 /* alpm */
 #include <alpm.h>
@@ -49,29 +61,42 @@
 #define PREFIX                  "kalu"  /* caller prefix for log */
 
 static GDBusConnection *connection = NULL;
+static GDBusConnection *peer = NULL;
 
 static GMainLoop *loop;
 
 static gboolean       is_init = FALSE;
+static gboolean       is_prefetch = FALSE;
 static gchar         *client  = NULL;
 static alpm_handle_t *handle  = NULL;
 
-static gchar buffer[1024];
+/* set by the client (SetDebug): 0 = none, 1 = debug, 2 = also each method
+ * call. Nothing is formatted, let alone sent, unless enabled */
+static guint debug_level = 0;
+
+/* signals go over the client's peer-to-peer connection once it has one (see
+ * OpenPeer), else over the system bus */
+#define signal_connection       ((peer) ? peer : connection)
+#define signal_destination      ((peer) ? NULL : client)
 
 #define debug(...)     do {                                             \
-    snprintf (buffer, 1024, __VA_ARGS__);                               \
-    g_dbus_connection_emit_signal (connection,                          \
-                                   client,                              \
-                                   OBJECT_PATH,                         \
-                                   INTERFACE_NAME,                      \
-                                   "Debug",                             \
-                                   g_variant_new ("(s)", buffer),       \
-                                   NULL);                               \
+    if (debug_level > 0)                                                \
+    {                                                                   \
+        gchar *_msg = g_strdup_printf (__VA_ARGS__);                    \
+        g_dbus_connection_emit_signal (signal_connection,               \
+                                       signal_destination,              \
+                                       OBJECT_PATH,                     \
+                                       INTERFACE_NAME,                  \
+                                       "Debug",                         \
+                                       g_variant_new ("(s)", _msg),     \
+                                       NULL);                           \
+        g_free (_msg);                                                  \
+    }                                                                   \
     } while (0)
 
 #define emit_signal(name, fmt, ...)                                            \
-    g_dbus_connection_emit_signal (connection,                                 \
-                                   client,                                     \
+    g_dbus_connection_emit_signal (signal_connection,                          \
+                                   signal_destination,                         \
                                    OBJECT_PATH,                                \
                                    INTERFACE_NAME,                             \
                                    name,                                       \
@@ -79,8 +104,8 @@ static gchar buffer[1024];
                                    NULL);
 
 #define emit_signal_no_params(name)                                            \
-    g_dbus_connection_emit_signal (connection,                                 \
-                                   client,                                     \
+    g_dbus_connection_emit_signal (signal_connection,                          \
+                                   signal_destination,                         \
                                    OBJECT_PATH,                                \
                                    INTERFACE_NAME,                             \
                                    name,                                       \
@@ -219,31 +244,202 @@ make_optstring (alpm_depend_t *optdep)
     return optstring;
 }
 
+/* Downloading & Progress signals are coalesced: we only keep the latest values
+ * for the current file/event, and emit them at most every PROGRESS_INTERVAL.
+ * Start & final (complete) values are always sent, and pending values are
+ * flushed when the file/event changes, or on any other event. */
+#define PROGRESS_INTERVAL       (G_USEC_PER_SEC / 15)
+
+static struct {
+    gchar    *filename;
+    guint     xfered;
+    guint     total;
+    gboolean  pending;
+    gint64    last;
+} dl_state = { NULL, 0, 0, FALSE, 0 };
+
+static struct {
+    event_t   event;
+    gchar    *pkgname;
+    int       percent;
+    guint     howmany;
+    guint     current;
+    gboolean  pending;
+    gint64    last;
+} progress_state = { 0, NULL, 0, 0, 0, FALSE, 0 };
+
+/* number of Downloading/Progress signals that were never emitted */
+static guint nb_suppressed = 0;
+
+/* package events (installed, upgraded, etc) are sent in batches via signal
+ * EventBatch if the client asked for it (method EnableEventBatch). A batch is
+ * sent once it is BATCH_INTERVAL old or holds BATCH_MAX events, and whenever
+ * any other signal is emitted, i.e. on transaction phase boundaries. */
+#define BATCH_INTERVAL          (G_USEC_PER_SEC / 4)
+#define BATCH_MAX               64
+
+static gboolean         batch_enabled = FALSE;
+static GVariantBuilder *batch         = NULL;
+static guint            batch_nb      = 0;
+static gint64           batch_start   = 0;
+
+static void
+flush_events (void)
+{
+    if (!batch)
+    {
+        return;
+    }
+    emit_signal ("EventBatch", "a(isssas)", batch);
+    g_variant_builder_unref (batch);
+    batch = NULL;
+    batch_nb = 0;
+}
+
+static void
+flush_download (void)
+{
+    if (!dl_state.pending)
+    {
+        return;
+    }
+    emit_signal ("Downloading", "suu",
+            dl_state.filename, dl_state.xfered, dl_state.total);
+    dl_state.pending = FALSE;
+    dl_state.last = g_get_monotonic_time ();
+}
+
+static void
+flush_progress (void)
+{
+    if (!progress_state.pending)
+    {
+        return;
+    }
+    emit_signal ("Progress", "isiuu",
+            progress_state.event,
+            progress_state.pkgname,
+            progress_state.percent,
+            progress_state.howmany,
+            progress_state.current);
+    progress_state.pending = FALSE;
+    progress_state.last = g_get_monotonic_time ();
+}
+
+static void
+flush_pending (void)
+{
+    flush_events ();
+    flush_download ();
+    flush_progress ();
+}
+
+static void
+reset_coalescing (void)
+{
+    flush_pending ();
+    if (nb_suppressed > 0)
+    {
+        debug ("%u progress signal(s) coalesced", nb_suppressed);
+    }
+    nb_suppressed = 0;
+    free (dl_state.filename);
+    dl_state.filename = NULL;
+    free (progress_state.pkgname);
+    progress_state.pkgname = NULL;
+}
+
+static void
+queue_event (batch_event_t  type,
+             const char    *pkg,
+             const char    *old_version,
+             const char    *new_version,
+             alpm_list_t   *optdeps)
+{
+    GVariantBuilder *builder;
+    alpm_list_t *i;
+
+    builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
+    FOR_LIST (i, optdeps)
+    {
+        gchar *optstring = make_optstring (i->data);
+        g_variant_builder_add (builder, "s", optstring);
+        free (optstring);
+    }
+
+    if (batch_enabled)
+    {
+        if (!batch)
+        {
+            batch = g_variant_builder_new (G_VARIANT_TYPE ("a(isssas)"));
+            batch_start = g_get_monotonic_time ();
+        }
+        g_variant_builder_add (batch, "(isssas)",
+                type, pkg, old_version, new_version, builder);
+        g_variant_builder_unref (builder);
+
+        if (++batch_nb >= BATCH_MAX
+                || g_get_monotonic_time () - batch_start >= BATCH_INTERVAL)
+        {
+            flush_events ();
+        }
+        return;
+    }
+
+    switch (type)
+    {
+        case BATCH_INSTALLED:
+            emit_signal ("EventInstalled", "ssas", pkg, new_version, builder);
+            break;
+        case BATCH_REINSTALLED:
+            emit_signal ("EventReinstalled", "ss", pkg, new_version);
+            break;
+        case BATCH_REMOVED:
+            emit_signal ("EventRemoved", "ss", pkg, old_version);
+            break;
+        case BATCH_UPGRADED:
+            emit_signal ("EventUpgraded", "sssas",
+                    pkg, old_version, new_version, builder);
+            break;
+        case BATCH_DOWNGRADED:
+            emit_signal ("EventDowngraded", "sssas",
+                    pkg, old_version, new_version, builder);
+            break;
+    }
+    g_variant_builder_unref (builder);
+}
+
 /* callback to handle messages/notifications from libalpm transactions */
 static void
 event_cb (alpm_event_t event, void *data1, void *data2)
 {
+    if (   event == ALPM_EVENT_ADD_DONE
+        || event == ALPM_EVENT_REINSTALL_DONE
+        || event == ALPM_EVENT_REMOVE_DONE
+        || event == ALPM_EVENT_UPGRADE_DONE
+        || event == ALPM_EVENT_DOWNGRADE_DONE)
+    {
+        /* make sure last progress values are sent, but keep the batch */
+        flush_download ();
+        flush_progress ();
+    }
+    else
+    {
+        /* make sure last progress values & events are sent before moving on */
+        flush_pending ();
+    }
+
     if (event == ALPM_EVENT_ADD_DONE)
     {
         alpm_logaction (handle, PREFIX, "installed %s (%s)\n",
                 alpm_pkg_get_name (data1),
                 alpm_pkg_get_version (data1));
 
-        /* computing optional dependencies */
-        GVariantBuilder *builder;
-        alpm_list_t *i, *optdeps = alpm_pkg_get_optdepends (data1);
-
-        builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
-        FOR_LIST (i, optdeps)
-        {
-            g_variant_builder_add (builder, "s", make_optstring (i->data));
-        }
-
-        emit_signal ("EventInstalled", "ssas",
+        queue_event (BATCH_INSTALLED,
                 alpm_pkg_get_name (data1),
+                "",
                 alpm_pkg_get_version (data1),
-                builder);
-        g_variant_builder_unref (builder);
+                alpm_pkg_get_optdepends (data1));
     }
     else if (event == ALPM_EVENT_REINSTALL_DONE)
     {
@@ -251,73 +447,46 @@ event_cb (alpm_event_t event, void *data1, void *data2)
                 alpm_pkg_get_name (data1),
                 alpm_pkg_get_version (data1));
 
-        emit_signal ("EventReinstalled", "ss",
+        queue_event (BATCH_REINSTALLED,
                 alpm_pkg_get_name (data1),
-                alpm_pkg_get_version (data1));
+                "",
+                alpm_pkg_get_version (data1),
+                NULL);
     }
     else if (event == ALPM_EVENT_REMOVE_DONE)
     {
         alpm_logaction (handle, PREFIX, "removed %s (%s)\n",
                 alpm_pkg_get_name (data1),
                 alpm_pkg_get_version (data1));
-        emit_signal ("EventRemoved", "ss",
-                alpm_pkg_get_name (data1),
-                alpm_pkg_get_version (data1));
-    }
-    else if (event == ALPM_EVENT_UPGRADE_DONE)
-    {
-        alpm_logaction (handle, PREFIX, "upgraded %s (%s -> %s)\n",
-                alpm_pkg_get_name (data1),
-                alpm_pkg_get_version (data2),
-                alpm_pkg_get_version (data1));
-
-        /* computing new optional dependencies */
-        GVariantBuilder *builder;
-        alpm_list_t *old = alpm_pkg_get_optdepends (data2);
-        alpm_list_t *new = alpm_pkg_get_optdepends (data1);
-        alpm_list_t *i, *optdeps;
-        optdeps = alpm_list_diff (new, old, (alpm_list_fn_cmp) depend_cmp);
-
-        builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
-        FOR_LIST (i, optdeps)
-        {
-            g_variant_builder_add (builder, "s", make_optstring (i->data));
-        }
 
-        emit_signal ("EventUpgraded", "sssas",
+        queue_event (BATCH_REMOVED,
                 alpm_pkg_get_name (data1),
-                alpm_pkg_get_version (data2),
                 alpm_pkg_get_version (data1),
-                builder);
-        g_variant_builder_unref (builder);
-        alpm_list_free (optdeps);
+                "",
+                NULL);
     }
-    else if (event == ALPM_EVENT_DOWNGRADE_DONE)
+    else if (event == ALPM_EVENT_UPGRADE_DONE
+            || event == ALPM_EVENT_DOWNGRADE_DONE)
     {
-        alpm_logaction (handle, PREFIX, "downgraded %s (%s -> %s)\n",
+        gboolean is_upgrade = (event == ALPM_EVENT_UPGRADE_DONE);
+
+        alpm_logaction (handle, PREFIX, "%s %s (%s -> %s)\n",
+                (is_upgrade) ? "upgraded" : "downgraded",
                 alpm_pkg_get_name (data1),
                 alpm_pkg_get_version (data2),
                 alpm_pkg_get_version (data1));
 
         /* computing new optional dependencies */
-        GVariantBuilder *builder;
         alpm_list_t *old = alpm_pkg_get_optdepends (data2);
         alpm_list_t *new = alpm_pkg_get_optdepends (data1);
-        alpm_list_t *i, *optdeps;
+        alpm_list_t *optdeps;
         optdeps = alpm_list_diff (new, old, (alpm_list_fn_cmp) depend_cmp);
 
-        builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
-        FOR_LIST (i, optdeps)
-        {
-            g_variant_builder_add (builder, "s", make_optstring (i->data));
-        }
-
-        emit_signal ("EventDowngraded", "sssas",
+        queue_event ((is_upgrade) ? BATCH_UPGRADED : BATCH_DOWNGRADED,
                 alpm_pkg_get_name (data1),
                 alpm_pkg_get_version (data2),
                 alpm_pkg_get_version (data1),
-                builder);
-        g_variant_builder_unref (builder);
+                optdeps);
         alpm_list_free (optdeps);
     }
     else if (event == ALPM_EVENT_OPTDEP_REQUIRED)
@@ -424,7 +593,39 @@ progress_cb (alpm_progress_t _event, const char *_pkgname, int percent,
             return;
     }
     const gchar *pkgname = (_pkgname) ? _pkgname : "";
-    emit_signal ("Progress", "isiuu", event, pkgname, percent, howmany, current);
+    gint64 now = g_get_monotonic_time ();
+
+    if (!progress_state.pkgname || event != progress_state.event
+            || strcmp (pkgname, progress_state.pkgname) != 0)
+    {
+        /* new event/package: send whatever was left from the previous one */
+        flush_progress ();
+        free (progress_state.pkgname);
+        progress_state.pkgname = strdup (pkgname);
+        progress_state.event = event;
+        /* always send the first value */
+        progress_state.last = 0;
+    }
+    else if (progress_state.pending)
+    {
+        ++nb_suppressed;
+    }
+
+    progress_state.percent = percent;
+    progress_state.howmany = howmany;
+    progress_state.current = current;
+    progress_state.pending = TRUE;
+
+    /* package events shouldn't wait on a slow install for too long */
+    if (batch && now - batch_start >= BATCH_INTERVAL)
+    {
+        flush_events ();
+    }
+
+    if (percent >= 100 || now - progress_state.last >= PROGRESS_INTERVAL)
+    {
+        flush_progress ();
+    }
 }
 
 /* callback to handle receipt of total download value */
@@ -432,6 +633,7 @@ static void
 dl_total_cb (off_t _total)
 {
     guint total = (guint) _total;
+    flush_pending ();
     emit_signal ("TotalDownload", "u", total);
 }
 
@@ -441,7 +643,30 @@ dl_progress_cb (const char *filename, off_t _xfered, off_t _total)
 {
     guint xfered = (guint) _xfered;
     guint total  = (guint) _total;
-    emit_signal ("Downloading", "suu", filename, xfered, total);
+    gint64 now = g_get_monotonic_time ();
+
+    if (!dl_state.filename || strcmp (filename, dl_state.filename) != 0)
+    {
+        /* new file: send whatever was left from the previous one */
+        flush_download ();
+        free (dl_state.filename);
+        dl_state.filename = strdup (filename);
+        /* always send the first value */
+        dl_state.last = 0;
+    }
+    else if (dl_state.pending)
+    {
+        ++nb_suppressed;
+    }
+
+    dl_state.xfered  = xfered;
+    dl_state.total   = total;
+    dl_state.pending = TRUE;
+
+    if (xfered == total || now - dl_state.last >= PROGRESS_INTERVAL)
+    {
+        flush_download ();
+    }
 }
 
 /* callback to handle notifications from the library */
@@ -458,6 +683,7 @@ log_cb (alpm_loglevel_t level, const char *fmt, va_list args)
         return;
     }
 
+    flush_pending ();
     gchar *s = g_strdup_vprintf (fmt, args);
     emit_signal ("Log", "is", (gint) level, s);
     g_free (s);
@@ -472,8 +698,16 @@ question_cb (alpm_question_t event, void *data1, void *data2, void *data3, int *
     GVariantBuilder *builder;
     alpm_list_t *i;
 
+    flush_pending ();
     debug ("question %d (%p -- %p -- %p)\n", event, data1, data2, data3);
 
+    /* nobody to ask in the background: go with "no" */
+    if (is_prefetch)
+    {
+        *response = 0;
+        return;
+    }
+
     if (choice != CHOICE_FREE)
     {
         debug ("Received question (%d) while already busy", event);
@@ -586,411 +820,1893 @@ question_cb (alpm_question_t event, void *data1, void *data2, void *data3, int *
     choice = CHOICE_FREE;
 }
 
-/***********
- * METHODS *
- ***********/
+/**********************
+ * PARALLEL DOWNLOADS *
+ **********************/
+
+/* files are downloaded by our own fetch callback, using a curl multi handle.
+ * Before committing a transaction, its packages are queued (see dl_prepare)
+ * and when libalpm asks for one, the next ones in the queue are started as
+ * well, so that up to parallel_downloads transfers run at once, and packages
+ * are usually already there once libalpm gets to them.
+ * Only the file libalpm is waiting on reports its progress, others only report
+ * once complete, so a client still sees one download at a time. */
+
+typedef enum {
+    DL_QUEUED = 0,
+    DL_RUNNING,
+    DL_DONE
+} dl_status_t;
+
+typedef struct _dl_job_t {
+    gchar       *filename;
+    gchar       *url;
+    gchar       *dest;
+    gchar       *tmpfile;
+    FILE        *fp;
+    CURL        *curl;
+    dl_status_t  status;
+    gboolean     resumable; /* keep/resume partial file, as libalpm does */
+    curl_off_t   resume_from;
+    int          ret;       /* return value for fetch_cb, once DL_DONE */
+    gboolean     reported;  /* completion was sent (Downloading) */
+    guint        xfered;
+    guint        total;
+    char         errmsg[CURL_ERROR_SIZE];
+} dl_job_t;
+
+static guint        parallel_downloads = 1;
+static curl_off_t   max_recv_speed     = 0; /* bytes/s, 0 for no limit */
+static CURLM       *multi              = NULL;
+static alpm_list_t *dl_jobs            = NULL;
+static guint        dl_running         = 0;
+
+static dl_job_t *
+dl_job_new (const char *filename, const char *url, const char *dest)
+{
+    dl_job_t *job;
+
+    job = new0 (dl_job_t, 1);
+    job->filename = strdup (filename);
+    job->url      = strdup (url);
+    job->dest     = strdup (dest);
+    job->tmpfile  = g_strdup_printf ("%s/%s.part", dest, filename);
+    /* like libalpm, only packages (& their sig) are resumed, not dbs */
+    job->resumable = !(g_str_has_suffix (filename, ".db")
+            || g_str_has_suffix (filename, ".db.sig")
+            || g_str_has_suffix (filename, ".files")
+            || g_str_has_suffix (filename, ".files.sig"));
+    return job;
+}
 
 static void
-method_failed (const gchar *name, const gchar *fmt, ...)
+dl_job_free (dl_job_t *job)
 {
-    va_list args;
-    gchar *b = buffer;
-    int len;
-
-    va_start (args, fmt);
-    len = vsnprintf (b, 1024, fmt, args);
-    va_end (args);
-    if (len >= 1024)
+    if (job->curl)
     {
-        /* this is one long error message... */
-        b = new (gchar, ++len);
-        va_start (args, fmt);
-        vsprintf (b, fmt, args);
-        va_end (args);
+        curl_multi_remove_handle (multi, job->curl);
+        curl_easy_cleanup (job->curl);
+        --dl_running;
     }
-    emit_signal ("MethodFailed", "ss", name, b);
-    if (b != buffer)
+    if (job->fp)
     {
-        free (b);
+        fclose (job->fp);
+        if (!job->resumable)
+        {
+            unlink (job->tmpfile);
+        }
     }
+    free (job->filename);
+    free (job->url);
+    free (job->dest);
+    g_free (job->tmpfile);
+    free (job);
 }
 
-#define method_finished(name)   emit_signal ("MethodFinished", "s", name)
-
-/* methods must ALWAYS do the following :
- * - g_variant_unref (parameters) to free them
- * - either call method_failed() or emit_signal w/ their XxxxFinished signal
- * - return FALSE to remove the timeout
- */
+#if LIBCURL_VERSION_NUM >= 0x072000
+static int
+dl_xferinfo (dl_job_t *job,
+             curl_off_t dltotal, curl_off_t dlnow,
+             curl_off_t ultotal _UNUSED_, curl_off_t ulnow _UNUSED_)
+#else
+static int
+dl_xferinfo (dl_job_t *job,
+             double dltotal, double dlnow,
+             double ultotal _UNUSED_, double ulnow _UNUSED_)
+#endif
+{
+    /* curl only counts what's left, after resume_from */
+    job->xfered = (guint) (dlnow + job->resume_from);
+    job->total  = (dltotal > 0) ? (guint) (dltotal + job->resume_from) : 0;
+    return 0;
+}
 
 static gboolean
-init (GVariant *parameters)
+dl_job_start (dl_job_t *job, int force)
 {
-    gchar *sender;
-    g_variant_get (parameters, "(s)", &sender);
-    g_variant_unref (parameters);
+    gchar *file;
+    struct stat st;
+    const char *ua = getenv ("HTTP_USER_AGENT");
 
-    /* already init */
-    if (is_init)
+    job->resume_from = 0;
+    if (job->resumable && stat (job->tmpfile, &st) == 0 && st.st_size > 0)
     {
-        free (sender);
-        method_failed ("Init", _("Session already initialized\n"));
-        return FALSE;
+        job->resume_from = (curl_off_t) st.st_size;
     }
-    /* checking auth */
-    GError *error = NULL;
-    PolkitAuthority *authority;
-    PolkitSubject *subject;
-    PolkitAuthorizationResult *result;
-
-    authority = polkit_authority_get_sync (NULL, NULL);
-    subject = polkit_system_bus_name_new (sender);
-    result = polkit_authority_check_authorization_sync (
-            authority,
-            subject, 
-            "org.jjk.kalu.sysupgrade",
-            NULL,
-            POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION,
-            NULL,
-            &error);
-    if (result == NULL)
+    job->fp = fopen (job->tmpfile, (job->resume_from > 0) ? "ab" : "wb");
+    if (!job->fp)
     {
-        free (sender);
-        method_failed ("Init", error->message);
-        g_clear_error (&error);
-        /* we have no reason to keep running */
-        g_main_loop_quit (loop);
+        debug ("Unable to open %s: %s", job->tmpfile, strerror (errno));
+        job->status = DL_DONE;
+        job->ret = -1;
         return FALSE;
     }
-    if (!polkit_authorization_result_get_is_authorized (result))
+
+    job->curl = curl_easy_init ();
+    if (!job->curl)
     {
-        free (sender);
-        g_object_unref (result);
-        method_failed ("Init", _("Authorization from PolicyKit failed\n"));
-        /* we have no reason to keep running */
-        g_main_loop_quit (loop);
+        fclose (job->fp);
+        job->fp = NULL;
+        unlink (job->tmpfile);
+        job->status = DL_DONE;
+        job->ret = -1;
         return FALSE;
     }
-    g_object_unref (result);
 
-    /* ok, we're good */
-    is_init = TRUE;
-    client = sender; /* therefore, we shoudln't free sender */
-    debug ("client is %s", client);
-    method_finished ("Init");
-    return FALSE;
-}
+    job->xfered = job->total = 0;
+    job->errmsg[0] = '\0';
+    curl_easy_setopt (job->curl, CURLOPT_URL, job->url);
+    curl_easy_setopt (job->curl, CURLOPT_WRITEDATA, job->fp);
+    curl_easy_setopt (job->curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt (job->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt (job->curl, CURLOPT_FILETIME, 1L);
+    curl_easy_setopt (job->curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt (job->curl, CURLOPT_ERRORBUFFER, job->errmsg);
+    curl_easy_setopt (job->curl, CURLOPT_PRIVATE, job);
+    /* same as libalpm: abort if below 1 byte/s for 10s */
+    curl_easy_setopt (job->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt (job->curl, CURLOPT_LOW_SPEED_TIME, 10L);
+    curl_easy_setopt (job->curl, CURLOPT_NOPROGRESS, 0L);
+#if LIBCURL_VERSION_NUM >= 0x072000
+    curl_easy_setopt (job->curl, CURLOPT_XFERINFOFUNCTION, dl_xferinfo);
+    curl_easy_setopt (job->curl, CURLOPT_XFERINFODATA, job);
+#else
+    curl_easy_setopt (job->curl, CURLOPT_PROGRESSFUNCTION, dl_xferinfo);
+    curl_easy_setopt (job->curl, CURLOPT_PROGRESSDATA, job);
+#endif
+    if (ua)
+    {
+        curl_easy_setopt (job->curl, CURLOPT_USERAGENT, ua);
+    }
+    /* the cap is for all transfers together */
+    if (max_recv_speed > 0)
+    {
+        curl_easy_setopt (job->curl, CURLOPT_MAX_RECV_SPEED_LARGE,
+                max_recv_speed / MAX (parallel_downloads, 1));
+    }
 
-static gboolean
-init_alpm (GVariant *parameters)
-{
-    const gchar  *rootdir;
-    const gchar  *dbpath;
-    const gchar  *logfile;
-    const gchar  *gpgdir;
-    GVariantIter *cachedirs_iter;
-    alpm_list_t  *cachedirs = NULL;
-    int           siglevel;
-    const gchar  *arch;
-    gboolean      checkspace;
-    gboolean      usesyslog;
-    gdouble       usedelta;
-    GVariantIter *ignorepkgs_iter;
-    alpm_list_t  *ignorepkgs = NULL;
-    GVariantIter *ignoregroups_iter;
-    alpm_list_t  *ignoregroups = NULL;
-    GVariantIter *noupgrades_iter;
-    alpm_list_t  *noupgrades = NULL;
-    GVariantIter *noextracts_iter;
-    alpm_list_t  *noextracts = NULL;
+    if (job->resume_from > 0)
+    {
+        debug ("Resuming %s from %" CURL_FORMAT_CURL_OFF_T,
+                job->filename, job->resume_from);
+        curl_easy_setopt (job->curl, CURLOPT_RESUME_FROM_LARGE,
+                job->resume_from);
+    }
 
-    /* to extract arrays into alpm_list_t */
-    const gchar *s;
+    /* only download if remote file is newer than what we have */
+    file = g_strdup_printf ("%s/%s", job->dest, job->filename);
+    if (!force && job->resume_from == 0 && stat (file, &st) == 0)
+    {
+        curl_easy_setopt (job->curl, CURLOPT_TIMECONDITION,
+                CURL_TIMECOND_IFMODSINCE);
+        curl_easy_setopt (job->curl, CURLOPT_TIMEVALUE, (long) st.st_mtime);
+    }
+    g_free (file);
 
-    debug ("getting alpm params");
-    g_variant_get (parameters, "(ssssasisbbdasasasas)",
-        &rootdir,
-        &dbpath,
-        &logfile,
-        &gpgdir,
-        &cachedirs_iter,
-        &siglevel,
-        &arch,
-        &checkspace,
-        &usesyslog,
-        &usedelta,
-        &ignorepkgs_iter,
-        &ignoregroups_iter,
-        &noupgrades_iter,
-        &noextracts_iter);
-    g_variant_unref (parameters);
+    curl_multi_add_handle (multi, job->curl);
+    job->status = DL_RUNNING;
+    ++dl_running;
+    return TRUE;
+}
 
-    debug ("init alpm");
-    enum _alpm_errno_t err;
-    int ret;
+static void
+dl_job_done (dl_job_t *job, CURLcode code)
+{
+    long unmet = 0;
+    long filetime = -1;
+    double size = 0;
+
+    curl_easy_getinfo (job->curl, CURLINFO_CONDITION_UNMET, &unmet);
+    curl_easy_getinfo (job->curl, CURLINFO_FILETIME, &filetime);
+    curl_easy_getinfo (job->curl, CURLINFO_SIZE_DOWNLOAD, &size);
+    curl_multi_remove_handle (multi, job->curl);
+    curl_easy_cleanup (job->curl);
+    job->curl = NULL;
+    --dl_running;
+    fclose (job->fp);
+    job->fp = NULL;
+    job->status = DL_DONE;
+
+    if (code != CURLE_OK)
+    {
+        debug ("Failed to download %s: %s", job->url,
+                (*job->errmsg) ? job->errmsg : curl_easy_strerror (code));
+        /* keep what we got to resume from, unless resuming is what failed
+         * (e.g. server not supporting it) so the next try starts over */
+        if (!job->resumable || job->resume_from > 0)
+        {
+            unlink (job->tmpfile);
+        }
+        job->ret = -1;
+        return;
+    }
 
-    /* init alpm */
-    handle = alpm_initialize (rootdir, dbpath, &err);
-    if (!handle)
+    if (unmet)
     {
-        method_failed ("InitAlpm", _("Failed to initialize alpm library: %s\n"),
-                alpm_strerror (err));
-        return FALSE;
+        /* file is up to date */
+        unlink (job->tmpfile);
+        job->ret = 1;
+        return;
     }
 
-    if (!(alpm_capabilities () & ALPM_CAPABILITY_DOWNLOADER))
+    gchar *file = g_strdup_printf ("%s/%s", job->dest, job->filename);
+    if (rename (job->tmpfile, file) != 0)
     {
-        method_failed ("InitAlpm", _("ALPM has no downloader capability\n"));
-        return FALSE;
+        debug ("Unable to rename %s: %s", job->tmpfile, strerror (errno));
+        unlink (job->tmpfile);
+        g_free (file);
+        job->ret = -1;
+        return;
     }
+    if (filetime > 0)
+    {
+        struct timeval tv[2];
 
-    /* set callbacks, that we'll turn into signals */
-    alpm_option_set_logcb (handle, log_cb);
-    alpm_option_set_dlcb (handle, dl_progress_cb);
-    alpm_option_set_eventcb (handle, event_cb);
-    alpm_option_set_questioncb (handle, question_cb);
+        tv[0].tv_sec = tv[1].tv_sec = filetime;
+        tv[0].tv_usec = tv[1].tv_usec = 0;
+        utimes (file, tv);
+    }
+    g_free (file);
+
+    job->ret = 0;
+    /* size only counts what was downloaded, after resume_from */
+    job->xfered = job->total = (guint) (size + (double) job->resume_from);
+}
+
+static int
+ptr_cmp (const void *p1, const void *p2)
+{
+    return (p1 == p2) ? 0 : 1;
+}
+
+static void
+dl_start_queued (void)
+{
+    alpm_list_t *i;
+
+    FOR_LIST (i, dl_jobs)
+    {
+        dl_job_t *job = i->data;
+
+        if (dl_running >= parallel_downloads)
+        {
+            break;
+        }
+        if (job->status == DL_QUEUED)
+        {
+            dl_job_start (job, 1);
+        }
+    }
+}
+
+/* runs all transfers until job is done */
+static void
+dl_perform (dl_job_t *job)
+{
+    while (job->status != DL_DONE)
+    {
+        CURLMsg *msg;
+        int nb;
+
+        curl_multi_perform (multi, &nb);
+        while ((msg = curl_multi_info_read (multi, &nb)))
+        {
+            dl_job_t *done;
+
+            if (msg->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+            curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE,
+                    (char **) &done);
+            dl_job_done (done, msg->data.result);
+            if (done != job && done->ret == 0 && done->total > 0)
+            {
+                /* let the client know it's there already */
+                dl_progress_cb (done->filename, done->total, done->total);
+                done->reported = TRUE;
+            }
+        }
+        dl_start_queued ();
+
+        if (job->status == DL_DONE)
+        {
+            break;
+        }
+        if (job->total > 0)
+        {
+            dl_progress_cb (job->filename, job->xfered, job->total);
+        }
+#if LIBCURL_VERSION_NUM >= 0x071C00
+        curl_multi_wait (multi, NULL, 0, 100, NULL);
+#else
+        {
+            fd_set fdr, fdw, fde;
+            struct timeval tv = { 0, 100000 };
+            int maxfd = -1;
+
+            FD_ZERO (&fdr);
+            FD_ZERO (&fdw);
+            FD_ZERO (&fde);
+            curl_multi_fdset (multi, &fdr, &fdw, &fde, &maxfd);
+            /* with maxfd == -1 this only sleeps, like curl_multi_wait would */
+            select (maxfd + 1, &fdr, &fdw, &fde, &tv);
+        }
+#endif
+    }
+
+    if (job->ret == 0 && !job->reported && job->total > 0)
+    {
+        dl_progress_cb (job->filename, job->total, job->total);
+    }
+}
+
+/* callback for libalpm to download url into folder localpath. Returns 0 on
+ * success, 1 if the file was already up to date, -1 on error */
+static int
+fetch_cb (const char *url, const char *localpath, int force)
+{
+    const char *filename;
+    dl_job_t *job = NULL;
+    alpm_list_t *i;
+    int ret;
+
+    filename = strrchr (url, '/');
+    filename = (filename) ? filename + 1 : url;
+
+    FOR_LIST (i, dl_jobs)
+    {
+        dl_job_t *j = i->data;
+        if (streq (j->filename, filename) && streq (j->dest, localpath))
+        {
+            job = j;
+            break;
+        }
+    }
+
+    /* failed in the background: retry with the URL libalpm gave us, since it
+     * will try other servers on failure */
+    if (job && job->status == DL_DONE && job->ret == -1)
+    {
+        dl_jobs = alpm_list_remove (dl_jobs, job, ptr_cmp, NULL);
+        dl_job_free (job);
+        job = NULL;
+    }
+
+    if (!job)
+    {
+        job = dl_job_new (filename, url, localpath);
+        dl_jobs = alpm_list_add (dl_jobs, job);
+    }
+    else if (job->status == DL_QUEUED)
+    {
+        free (job->url);
+        job->url = strdup (url);
+    }
+
+    if (job->status == DL_QUEUED)
+    {
+        dl_job_start (job, force);
+    }
+    dl_start_queued ();
+    dl_perform (job);
+
+    ret = job->ret;
+    dl_jobs = alpm_list_remove (dl_jobs, job, ptr_cmp, NULL);
+    dl_job_free (job);
+    return ret;
+}
+
+/* queue all packages of the transaction that need to be downloaded, so they
+ * can be downloaded in parallel */
+static void
+dl_prepare (void)
+{
+    alpm_list_t *i, *j;
+    const char *cachedir = NULL;
+
+    if (parallel_downloads <= 1)
+    {
+        return;
+    }
+    /* deltas would be downloaded instead of the packages */
+    if (alpm_option_get_deltaratio (handle) > 0.0)
+    {
+        debug ("Delta usage enabled, no parallel downloads");
+        return;
+    }
+
+    /* same as libalpm: packages go in the first writable cache dir */
+    FOR_LIST (i, alpm_option_get_cachedirs (handle))
+    {
+        if (access (i->data, W_OK) == 0)
+        {
+            cachedir = i->data;
+            break;
+        }
+    }
+    if (!cachedir)
+    {
+        return;
+    }
+
+    FOR_LIST (i, alpm_trans_get_add (handle))
+    {
+        alpm_pkg_t *pkg = i->data;
+        const char *filename = alpm_pkg_get_filename (pkg);
+        alpm_list_t *servers;
+        gboolean in_cache = FALSE;
+        gchar *url;
+
+        if (alpm_pkg_get_origin (pkg) != ALPM_PKG_FROM_SYNCDB)
+        {
+            continue;
+        }
+        FOR_LIST (j, alpm_option_get_cachedirs (handle))
+        {
+            gchar *file = g_strdup_printf ("%s/%s", (char *) j->data, filename);
+            in_cache = (access (file, F_OK) == 0);
+            g_free (file);
+            if (in_cache)
+            {
+                break;
+            }
+        }
+        servers = alpm_db_get_servers (alpm_pkg_get_db (pkg));
+        if (in_cache || !servers)
+        {
+            continue;
+        }
+
+        url = g_strdup_printf ("%s/%s", (char *) servers->data, filename);
+        dl_jobs = alpm_list_add (dl_jobs, dl_job_new (filename, url, cachedir));
+        g_free (url);
+    }
+    debug ("%u package(s) queued for download", alpm_list_count (dl_jobs));
+}
+
+static void
+dl_cleanup (void)
+{
+    alpm_list_t *i;
+
+    FOR_LIST (i, dl_jobs)
+    {
+        dl_job_free (i->data);
+    }
+    alpm_list_free (dl_jobs);
+    dl_jobs = NULL;
+}
+
+/***********
+ * METHODS *
+ ***********/
+
+static void
+method_failed (const gchar *name, const gchar *fmt, ...)
+{
+    va_list args;
+    gchar *msg;
+
+    va_start (args, fmt);
+    msg = g_strdup_vprintf (fmt, args);
+    va_end (args);
+    emit_signal ("MethodFailed", "ss", name, msg);
+    g_free (msg);
+}
+
+#define method_finished(name)   emit_signal ("MethodFinished", "s", name)
+
+/* a prefetch session doesn't use the system's sync dbs but its own copy of
+ * them, in a temp folder used as dbpath (with the local db linked in). That way
+ * dbs can be imported/synced without the system ones ever being updated
+ * without a sysupgrade (which could lead to partial upgrades) */
+static gchar *prefetch_dbpath = NULL;
+
+static gboolean copy_file (const gchar *from, const gchar *to, time_t mtime);
+
+static void
+prefetch_dbpath_free (void)
+{
+    GDir *dir;
+    const gchar *name;
+    gchar buf[PATH_MAX];
+
+    if (!prefetch_dbpath)
+    {
+        return;
+    }
+
+    snprintf (buf, PATH_MAX, "%s/sync", prefetch_dbpath);
+    dir = g_dir_open (buf, 0, NULL);
+    if (dir)
+    {
+        while ((name = g_dir_read_name (dir)))
+        {
+            snprintf (buf, PATH_MAX, "%s/sync/%s", prefetch_dbpath, name);
+            unlink (buf);
+        }
+        g_dir_close (dir);
+    }
+    snprintf (buf, PATH_MAX, "%s/sync", prefetch_dbpath);
+    rmdir (buf);
+    snprintf (buf, PATH_MAX, "%s/local", prefetch_dbpath);
+    unlink (buf);
+    snprintf (buf, PATH_MAX, "%s/db.lck", prefetch_dbpath);
+    unlink (buf);
+    rmdir (prefetch_dbpath);
+
+    g_free (prefetch_dbpath);
+    prefetch_dbpath = NULL;
+}
+
+static gboolean
+prefetch_dbpath_new (const gchar *dbpath)
+{
+    GDir *dir;
+    const gchar *name;
+    gchar from[PATH_MAX], to[PATH_MAX];
+    struct stat st;
+
+    prefetch_dbpath = g_dir_make_tmp ("kalu-dbus-XXXXXX", NULL);
+    if (!prefetch_dbpath)
+    {
+        return FALSE;
+    }
+
+    snprintf (from, PATH_MAX, "%s/local", dbpath);
+    snprintf (to, PATH_MAX, "%s/local", prefetch_dbpath);
+    if (symlink (from, to) != 0)
+    {
+        prefetch_dbpath_free ();
+        return FALSE;
+    }
+    snprintf (to, PATH_MAX, "%s/sync", prefetch_dbpath);
+    if (mkdir (to, 0700) != 0)
+    {
+        prefetch_dbpath_free ();
+        return FALSE;
+    }
+
+    /* start from the system's dbs, ImportDbs/SyncDbs will update them */
+    snprintf (from, PATH_MAX, "%s/sync", dbpath);
+    dir = g_dir_open (from, 0, NULL);
+    if (dir)
+    {
+        while ((name = g_dir_read_name (dir)))
+        {
+            if (!g_str_has_suffix (name, ".db")
+                    && !g_str_has_suffix (name, ".db.sig"))
+            {
+                continue;
+            }
+            snprintf (from, PATH_MAX, "%s/sync/%s", dbpath, name);
+            snprintf (to, PATH_MAX, "%s/sync/%s", prefetch_dbpath, name);
+            if (stat (from, &st) == 0 && S_ISREG (st.st_mode))
+            {
+                copy_file (from, to, st.st_mtime);
+            }
+        }
+        g_dir_close (dir);
+    }
+
+    debug ("prefetch dbpath: %s", prefetch_dbpath);
+    return TRUE;
+}
+
+/* once a session is over (FreeAlpm), the handle and its dbs are kept around for
+ * a little while (the client tells us how long), so the next session can re-use
+ * them, provided it's given the same config and the dbs weren't touched by
+ * anyone else in the mean time. Else we exit once that timeout is reached. */
+#define IDLE_TIMEOUT_MAX        3600
+
+static GVariant        *alpm_params    = NULL; /* InitAlpm params of handle */
+static gboolean         alpm_ok        = FALSE; /* InitAlpm went fine */
+static gboolean         alpm_prefetch  = FALSE; /* handle is for a prefetch */
+static alpm_list_t     *dbs_params     = NULL; /* AddDb params, for each db */
+static guint            nb_dbs         = 0;    /* dbs added this session */
+static struct timespec  local_mtime;
+static struct timespec  sync_mtime;
+static struct timespec  dbpath_mtime;
+static guint            idle_id        = 0;
+static guint            idle_secs      = 0;
+
+static void
+get_mtime (const gchar *path, struct timespec *mtime)
+{
+    struct stat st;
+
+    if (stat (path, &st) == 0)
+    {
+        *mtime = st.st_mtim;
+    }
+    else
+    {
+        mtime->tv_sec = mtime->tv_nsec = 0;
+    }
+}
+
+/* files edited in place (e.g. local/<pkg>/desc on pacman -D) don't change the
+ * mtime of local/ or sync/, but anything writing to the dbs takes db.lck, and
+ * creating/removing it changes the mtime of the (system's) dbpath */
+static void
+get_dbs_mtimes (struct timespec *local, struct timespec *sync,
+                struct timespec *root)
+{
+    gchar buf[PATH_MAX];
+    const gchar *dbpath;
+
+    snprintf (buf, PATH_MAX, "%slocal", alpm_option_get_dbpath (handle));
+    get_mtime (buf, local);
+    snprintf (buf, PATH_MAX, "%ssync", alpm_option_get_dbpath (handle));
+    get_mtime (buf, sync);
+    /* for prefetch, handle's dbpath is our own copy */
+    g_variant_get_child (alpm_params, 1, "&s", &dbpath);
+    get_mtime (dbpath, root);
+}
+
+static gboolean
+timespec_equal (const struct timespec *t1, const struct timespec *t2)
+{
+    return t1->tv_sec == t2->tv_sec && t1->tv_nsec == t2->tv_nsec;
+}
+
+/* whether nothing was done to the dbs since the handle was last used, since
+ * libalpm wouldn't know to reload them */
+static gboolean
+is_cache_fresh (void)
+{
+    struct timespec local, sync, root;
+
+    get_dbs_mtimes (&local, &sync, &root);
+    return timespec_equal (&local, &local_mtime)
+        && timespec_equal (&sync, &sync_mtime)
+        && timespec_equal (&root, &dbpath_mtime);
+}
+
+static void
+release_alpm (void)
+{
+    alpm_list_t *i;
+
+    if (handle)
+    {
+        debug ("releasing alpm handle");
+        if (alpm_release (handle) == -1)
+        {
+            debug ("Failed to release alpm library");
+        }
+    }
+    handle = NULL;
+    alpm_ok = FALSE;
+    prefetch_dbpath_free ();
+    if (multi)
+    {
+        curl_multi_cleanup (multi);
+        multi = NULL;
+    }
+
+    if (alpm_params)
+    {
+        g_variant_unref (alpm_params);
+        alpm_params = NULL;
+    }
+    FOR_LIST (i, dbs_params)
+    {
+        g_variant_unref (i->data);
+    }
+    alpm_list_free (dbs_params);
+    dbs_params = NULL;
+    nb_dbs = 0;
+}
+
+static gboolean
+idle_timeout_cb (gpointer data _UNUSED_)
+{
+    debug ("idle timeout reached");
+    idle_id = 0;
+    release_alpm ();
+    g_main_loop_quit (loop);
+    return FALSE;
+}
+
+static void
+idle_start (void)
+{
+    idle_id = g_timeout_add_seconds (idle_secs, idle_timeout_cb, NULL);
+}
+
+/* unregisters cached dbs from position from onwards, i.e. those that didn't
+ * match what the client added this session */
+static void
+drop_cached_dbs (guint from)
+{
+    alpm_list_t *dbs, *keep = NULL, *i;
+    guint n;
+
+    if (alpm_list_count (dbs_params) <= from
+            && alpm_list_count (alpm_get_syncdbs (handle)) <= from)
+    {
+        return;
+    }
+
+    dbs = alpm_list_copy (alpm_get_syncdbs (handle));
+    for (i = dbs, n = 0; i; i = alpm_list_next (i), ++n)
+    {
+        if (n >= from)
+        {
+            debug ("dropping cached db %s", alpm_db_get_name (i->data));
+            alpm_db_unregister (i->data);
+        }
+    }
+    alpm_list_free (dbs);
+
+    for (i = dbs_params, n = 0; i; i = alpm_list_next (i), ++n)
+    {
+        if (n < from)
+        {
+            keep = alpm_list_add (keep, i->data);
+        }
+        else
+        {
+            g_variant_unref (i->data);
+        }
+    }
+    alpm_list_free (dbs_params);
+    dbs_params = keep;
+}
+
+/* OpenPeer: once init, a client can get a peer-to-peer connection to us (over
+ * a socketpair, one end of which is sent back as reply), over which all signals
+ * will then be sent, so the system bus only carries method calls. It isn't
+ * usable until MethodFinished for OpenPeer is received -- over said peer.
+ * ClosePeer drops it (e.g. the client failed to set up its end), signals then
+ * go back over the system bus. */
+
+static void
+peer_closed_cb (GDBusConnection *conn,
+                gboolean         remote_peer_vanished _UNUSED_,
+                GError          *error _UNUSED_,
+                gpointer         data _UNUSED_)
+{
+    if (conn == peer)
+    {
+        g_object_unref (peer);
+        peer = NULL;
+    }
+}
+
+static void
+close_peer (void)
+{
+    if (!peer)
+    {
+        return;
+    }
+    g_signal_handlers_disconnect_by_func (peer, peer_closed_cb, NULL);
+    /* make sure e.g. FreeAlpm's MethodFinished makes it to the client */
+    g_dbus_connection_flush_sync (peer, NULL, NULL);
+    g_dbus_connection_close_sync (peer, NULL, NULL);
+    g_object_unref (peer);
+    peer = NULL;
+}
+
+static void
+peer_new_cb (GObject *source _UNUSED_, GAsyncResult *res, gpointer data _UNUSED_)
+{
+    GError *error = NULL;
+    GDBusConnection *conn;
+
+    conn = g_dbus_connection_new_finish (res, &error);
+    if (!conn)
+    {
+        method_failed ("OpenPeer", _("Unable to open peer connection: %s\n"),
+                error->message);
+        g_clear_error (&error);
+        return;
+    }
+    /* session ended meanwhile */
+    if (!is_init)
+    {
+        g_dbus_connection_close_sync (conn, NULL, NULL);
+        g_object_unref (conn);
+        return;
+    }
+
+    peer = conn;
+    g_signal_connect (peer, "closed", G_CALLBACK (peer_closed_cb), NULL);
+    method_finished ("OpenPeer");
+}
+
+static void
+open_peer (GDBusMethodInvocation *invocation)
+{
+    GError *error = NULL;
+    int fds[2];
+    GSocket *sock;
+    GSocketConnection *stream;
+    GUnixFDList *fd_list;
+    gchar *guid;
+
+    if (peer)
+    {
+        g_dbus_method_invocation_return_dbus_error (invocation,
+                "org.jjk.kalu.PeerAlreadyOpenError",
+                _("Peer connection already opened\n"));
+        return;
+    }
+
+    if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+    {
+        g_dbus_method_invocation_return_dbus_error (invocation,
+                "org.jjk.kalu.PeerError",
+                strerror (errno));
+        return;
+    }
+
+    sock = g_socket_new_from_fd (fds[0], &error);
+    if (!sock)
+    {
+        close (fds[0]);
+        close (fds[1]);
+        g_dbus_method_invocation_return_gerror (invocation, error);
+        g_clear_error (&error);
+        return;
+    }
+    stream = g_socket_connection_factory_create_connection (sock);
+    g_object_unref (sock);
+
+    /* the other end only goes to the client, who's been authorized by
+     * PolicyKit, so there's no need to authorize it any further */
+    guid = g_dbus_generate_guid ();
+    g_dbus_connection_new (G_IO_STREAM (stream),
+            guid,
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_SERVER,
+            NULL,
+            NULL,
+            peer_new_cb,
+            NULL);
+    g_free (guid);
+    g_object_unref (stream);
+
+    /* takes ownership of fds[1] */
+    fd_list = g_unix_fd_list_new_from_array (&fds[1], 1);
+    g_dbus_method_invocation_return_value_with_unix_fd_list (invocation,
+            g_variant_new ("(h)", 0),
+            fd_list);
+    g_object_unref (fd_list);
+}
+
+/* methods must ALWAYS do the following :
+ * - g_variant_unref (parameters) to free them
+ * - either call method_failed() or emit_signal w/ their XxxxFinished signal
+ * - return FALSE to remove the timeout
+ */
+
+/* InitPrefetch is the same as Init, only PolicyKit won't ask the user to
+ * authenticate (it's meant for background jobs, so it only works when the rules
+ * allow it, e.g. via 30-kalu.rules), and only a prefetch can then be done */
+static gboolean
+init (GVariant *parameters)
+{
+    gchar *sender;
+    gboolean interactive;
+    const gchar *name;
+    g_variant_get (parameters, "(sb)", &sender, &interactive);
+    g_variant_unref (parameters);
+    name = (interactive) ? "Init" : "InitPrefetch";
+
+    /* already init */
+    if (is_init)
+    {
+        free (sender);
+        method_failed (name, _("Session already initialized\n"));
+        return FALSE;
+    }
+    /* checking auth */
+    GError *error = NULL;
+    PolkitAuthority *authority;
+    PolkitSubject *subject;
+    PolkitAuthorizationResult *result;
+
+    authority = polkit_authority_get_sync (NULL, NULL);
+    subject = polkit_system_bus_name_new (sender);
+    result = polkit_authority_check_authorization_sync (
+            authority,
+            subject, 
+            "org.jjk.kalu.sysupgrade",
+            NULL,
+            (interactive) ? POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION
+                          : POLKIT_CHECK_AUTHORIZATION_FLAGS_NONE,
+            NULL,
+            &error);
+    if (result == NULL)
+    {
+        free (sender);
+        method_failed (name, error->message);
+        g_clear_error (&error);
+        /* we have no reason to keep running, unless alpm is kept around */
+        if (handle)
+        {
+            idle_start ();
+        }
+        else
+        {
+            g_main_loop_quit (loop);
+        }
+        return FALSE;
+    }
+    if (!polkit_authorization_result_get_is_authorized (result))
+    {
+        free (sender);
+        g_object_unref (result);
+        method_failed (name, _("Authorization from PolicyKit failed\n"));
+        /* we have no reason to keep running, unless alpm is kept around */
+        if (handle)
+        {
+            idle_start ();
+        }
+        else
+        {
+            g_main_loop_quit (loop);
+        }
+        return FALSE;
+    }
+    g_object_unref (result);
+
+    /* ok, we're good */
+    is_init = TRUE;
+    is_prefetch = !interactive;
+    client = sender; /* therefore, we shoudln't free sender */
+    debug ("client is %s%s", client, (is_prefetch) ? " (prefetch)" : "");
+    method_finished (name);
+    return FALSE;
+}
+
+static gboolean
+init_alpm (GVariant *parameters)
+{
+    const gchar  *rootdir;
+    const gchar  *dbpath;
+    const gchar  *logfile;
+    const gchar  *gpgdir;
+    GVariantIter *cachedirs_iter;
+    alpm_list_t  *cachedirs = NULL;
+    int           siglevel;
+    const gchar  *arch;
+    gboolean      checkspace;
+    gboolean      usesyslog;
+    gdouble       usedelta;
+    GVariantIter *ignorepkgs_iter;
+    alpm_list_t  *ignorepkgs = NULL;
+    GVariantIter *ignoregroups_iter;
+    alpm_list_t  *ignoregroups = NULL;
+    GVariantIter *noupgrades_iter;
+    alpm_list_t  *noupgrades = NULL;
+    GVariantIter *noextracts_iter;
+    alpm_list_t  *noextracts = NULL;
+    gint          paralleldownloads;
+
+    /* to extract arrays into alpm_list_t */
+    const gchar *s;
+
+    /* do we have a handle for this very config? */
+    if (handle && alpm_ok && alpm_prefetch == is_prefetch
+            && g_variant_equal (alpm_params, parameters)
+            && is_cache_fresh ())
+    {
+        debug ("re-using alpm handle");
+        g_variant_unref (parameters);
+        nb_dbs = 0;
+        method_finished ("InitAlpm");
+        return FALSE;
+    }
+    release_alpm ();
+
+    debug ("getting alpm params");
+    g_variant_get (parameters, "(ssssasisbbdasasasasi)",
+        &rootdir,
+        &dbpath,
+        &logfile,
+        &gpgdir,
+        &cachedirs_iter,
+        &siglevel,
+        &arch,
+        &checkspace,
+        &usesyslog,
+        &usedelta,
+        &ignorepkgs_iter,
+        &ignoregroups_iter,
+        &noupgrades_iter,
+        &noextracts_iter,
+        &paralleldownloads);
+    /* kept as the config of handle, see release_alpm() */
+    alpm_params = parameters;
+
+    debug ("init alpm");
+    enum _alpm_errno_t err;
+    int ret;
+
+    /* prefetch sessions work on their own copy of the sync dbs */
+    if (is_prefetch)
+    {
+        if (!prefetch_dbpath_new (dbpath))
+        {
+            method_failed ("InitAlpm", _("Unable to create temp folder\n"));
+            return FALSE;
+        }
+        dbpath = prefetch_dbpath;
+    }
+
+    /* init alpm */
+    handle = alpm_initialize (rootdir, dbpath, &err);
+    if (!handle)
+    {
+        method_failed ("InitAlpm", _("Failed to initialize alpm library: %s\n"),
+                alpm_strerror (err));
+        return FALSE;
+    }
+
+    /* downloads are done by us, see fetch_cb */
+    multi = curl_multi_init ();
+    if (!multi)
+    {
+        method_failed ("InitAlpm", _("Unable to init cURL\n"));
+        return FALSE;
+    }
+    parallel_downloads = (paralleldownloads > 1) ? (guint) paralleldownloads : 1;
+
+    /* set callbacks, that we'll turn into signals */
+    alpm_option_set_logcb (handle, log_cb);
+    alpm_option_set_dlcb (handle, dl_progress_cb);
+    alpm_option_set_eventcb (handle, event_cb);
+    alpm_option_set_questioncb (handle, question_cb);
     alpm_option_set_progresscb (handle, progress_cb);
     alpm_option_set_totaldlcb (handle, dl_total_cb);
+    alpm_option_set_fetchcb (handle, fetch_cb);
+
+    ret = alpm_option_set_logfile (handle, logfile);
+    if (ret != 0)
+    {
+        method_failed ("InitAlpm", _("Unable to set log file: %s\n"),
+                alpm_strerror (alpm_errno (handle)));
+        return FALSE;
+    }
+
+    /* Set GnuPG's home directory.  This is not relative to rootdir, even if
+     * rootdir is defined. Reasoning: gpgdir contains configuration data. */
+    ret = alpm_option_set_gpgdir (handle, gpgdir);
+    if (ret != 0)
+    {
+        method_failed ("InitAlpm", _("Unable to set gpgdir: %s\n"),
+                alpm_strerror (alpm_errno (handle)));
+        return FALSE;
+    }
+
+    /* cachedirs */
+    while (g_variant_iter_loop (cachedirs_iter, "s", &s))
+    {
+        cachedirs = alpm_list_add (cachedirs, strdup (s));
+    }
+    g_variant_iter_free (cachedirs_iter);
+
+    if (0 != alpm_option_set_cachedirs (handle, cachedirs))
+    {
+        FREELIST (cachedirs);
+        method_failed ("InitAlpm", _("Unable to set cache dirs: %s\n"),
+                alpm_strerror (alpm_errno (handle)));
+        return FALSE;
+    }
+    FREELIST (cachedirs);
+
+    if (0 != alpm_option_set_default_siglevel (handle, siglevel))
+    {
+        method_failed (_("Unable to set default siglevel: %s\n"),
+                alpm_strerror (alpm_errno (handle)));
+        return FALSE;
+    }
+
+    /* following options can't really fail, unless handle is wrong but
+     * that would have caused lots of failures before reacing here */
+    alpm_option_set_arch (handle, arch);
+    alpm_option_set_checkspace (handle, checkspace);
+    alpm_option_set_usesyslog (handle, usesyslog);
+    alpm_option_set_deltaratio (handle, usedelta);
+
+    while (g_variant_iter_loop (ignorepkgs_iter, "s", &s))
+    {
+        ignorepkgs = alpm_list_add (ignorepkgs, strdup (s));
+    }
+    g_variant_iter_free (ignorepkgs_iter);
+
+    while (g_variant_iter_loop (ignoregroups_iter, "s", &s))
+    {
+        ignoregroups = alpm_list_add (ignoregroups, strdup (s));
+    }
+    g_variant_iter_free (ignoregroups_iter);
+
+    while (g_variant_iter_loop (noupgrades_iter, "s", &s))
+    {
+        noupgrades = alpm_list_add (noupgrades, strdup (s));
+    }
+    g_variant_iter_free (noupgrades_iter);
+
+    while (g_variant_iter_loop (noextracts_iter, "s", &s))
+    {
+        noextracts = alpm_list_add (noextracts, strdup (s));
+    }
+    g_variant_iter_free (noextracts_iter);
+
+    alpm_option_set_ignorepkgs (handle, ignorepkgs);
+    alpm_option_set_ignoregroups (handle, ignoregroups);
+    alpm_option_set_noupgrades (handle, noupgrades);
+    alpm_option_set_noextracts (handle, noextracts);
+
+    FREELIST (ignorepkgs);
+    FREELIST (ignoregroups);
+    FREELIST (noupgrades);
+    FREELIST (noextracts);
+
+    /* done */
+    alpm_prefetch = is_prefetch;
+    alpm_ok = TRUE;
+    nb_dbs = 0;
+    method_finished ("InitAlpm");
+    return FALSE;
+}
+
+static gboolean
+free_alpm (GVariant *parameters)
+{
+    guint32 keep;
+
+    g_variant_get (parameters, "(u)", &keep);
+    g_variant_unref (parameters);
+
+    /* end of the session */
+    free (client);
+    client = NULL;
+    is_init = FALSE;
+    is_prefetch = FALSE;
+    batch_enabled = FALSE;
+    debug_level = 0;
+    if (handle && alpm_trans_get_flags (handle) != -1)
+    {
+        alpm_trans_release (handle);
+    }
+
+    /* keep alpm around for the next session */
+    if (keep > 0 && handle && alpm_ok)
+    {
+        drop_cached_dbs (nb_dbs);
+        get_dbs_mtimes (&local_mtime, &sync_mtime, &dbpath_mtime);
+        idle_secs = MIN (keep, IDLE_TIMEOUT_MAX);
+        idle_start ();
+        debug ("keeping alpm handle for %us", idle_secs);
+        method_finished ("FreeAlpm");
+        close_peer ();
+        return FALSE;
+    }
+
+    /* free alpm */
+    if (handle && alpm_release (handle) == -1)
+    {
+        method_failed ("FreeAlpm", _("Failed to release alpm library\n"));
+    }
+    else
+    {
+        method_finished ("FreeAlpm");
+    }
+    close_peer ();
+    handle = NULL;
+    release_alpm ();
+
+    /* we have no reason to keep running at this point */
+    g_main_loop_quit (loop);
+    return FALSE;
+}
+
+/* registers a db from AddDb's parameters. On error, returns NULL and sets
+ * errmsg (to be free-d) */
+static alpm_db_t *
+register_db (GVariant *parameters, gchar **errmsg)
+{
+    const gchar  *name;
+    int           siglevel;
+    GVariantIter *servers_iter;
+    alpm_list_t  *servers = NULL;
+
+    /* to extract arrays into alpm_list_t */
+    const gchar *s;
+
+    g_variant_get (parameters, "(&sias)",
+            &name,
+            &siglevel,
+            &servers_iter);
 
-    ret = alpm_option_set_logfile (handle, logfile);
-    if (ret != 0)
+    alpm_db_t *db;
+    db = alpm_register_syncdb (handle, name, (alpm_siglevel_t) siglevel);
+    if (db == NULL)
     {
-        method_failed ("InitAlpm", _("Unable to set log file: %s\n"),
+        g_variant_iter_free (servers_iter);
+        *errmsg = g_strdup_printf (_("Could not register database %s: %s\n"),
+                name, alpm_strerror (alpm_errno (handle)));
+        return NULL;
+    }
+
+    while (g_variant_iter_loop (servers_iter, "s", &s))
+    {
+        servers = alpm_list_add (servers, strdup (s));
+    }
+    g_variant_iter_free (servers_iter);
+
+    alpm_list_t *i;
+    const char *arch = alpm_option_get_arch (handle);
+    FOR_LIST (i, servers)
+    {
+        char *value = i->data;
+        char *temp = strreplace (value, "$repo", name);
+        char *server;
+
+        if (arch)
+        {
+            server = strreplace (temp, "$arch", arch);
+            free (temp);
+        }
+        else
+        {
+            if (strstr (temp, "$arch"))
+            {
+                free (temp);
+                *errmsg = g_strdup_printf (
+                        _("Server %s contains the $arch variable, but no Architecture was defined.\n"),
+                        value);
+                FREELIST (servers);
+                return NULL;
+            }
+            server = temp;
+        }
+
+        debug ("add server %s into %s", server, name);
+        if (alpm_db_add_server (db, server) != 0)
+        {
+            /* pm_errno is set by alpm_db_setserver */
+            *errmsg = g_strdup_printf (
+                    _("Could not add server %s to database %s: %s\n"),
+                    server,
+                    name,
+                    alpm_strerror (alpm_errno (handle)));
+            FREELIST (servers);
+            free (server);
+            return NULL;
+        }
+        free (server);
+    }
+    FREELIST (servers);
+
+    /* ensure db is valid */
+    if (alpm_db_get_valid (db))
+    {
+        *errmsg = g_strdup_printf (_("Database %s is not valid: %s\n"),
+                name,
                 alpm_strerror (alpm_errno (handle)));
+        return NULL;
+    }
+
+    return db;
+}
+
+/* (re-)registers all dbs, so libalpm reads their files again */
+static gboolean
+reload_dbs (gchar **errmsg)
+{
+    alpm_list_t *i;
+
+    alpm_unregister_all_syncdbs (handle);
+    FOR_LIST (i, dbs_params)
+    {
+        if (!register_db (i->data, errmsg))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static gboolean
+add_db (GVariant *parameters)
+{
+    gchar *errmsg = NULL;
+
+    /* re-using a cached handle, is this the same db as before? */
+    if (nb_dbs < alpm_list_count (dbs_params))
+    {
+        if (g_variant_equal (alpm_list_nth (dbs_params, nb_dbs)->data,
+                    parameters))
+        {
+            g_variant_unref (parameters);
+            ++nb_dbs;
+            method_finished ("AddDb");
+            return FALSE;
+        }
+        /* config changed, drop what's left */
+        drop_cached_dbs (nb_dbs);
+    }
+
+    if (!register_db (parameters, &errmsg))
+    {
+        g_variant_unref (parameters);
+        /* the db might have been registered, only not fully */
+        drop_cached_dbs (nb_dbs);
+        method_failed ("AddDb", "%s", errmsg);
+        g_free (errmsg);
         return FALSE;
     }
 
-    /* Set GnuPG's home directory.  This is not relative to rootdir, even if
-     * rootdir is defined. Reasoning: gpgdir contains configuration data. */
-    ret = alpm_option_set_gpgdir (handle, gpgdir);
-    if (ret != 0)
+    /* done */
+    dbs_params = alpm_list_add (dbs_params, parameters);
+    ++nb_dbs;
+    method_finished ("AddDb");
+    return FALSE;
+}
+
+static gboolean
+sync_dbs (GVariant *parameters)
+{
+    alpm_list_t        *syncdbs   = NULL;
+    alpm_list_t        *i;
+    int                 ret;
+    sync_db_results_t   result;
+
+    g_variant_unref (parameters);
+    drop_cached_dbs (nb_dbs);
+
+    syncdbs = alpm_get_syncdbs (handle);
+    emit_signal ("SyncDbs", "i", alpm_list_count (syncdbs));
+    FOR_LIST (i, syncdbs)
+    {
+        alpm_db_t *db = i->data;
+        emit_signal ("SyncDbStart", "s", alpm_db_get_name (db));
+        ret = alpm_db_update (0, db);
+        if (ret < 0)
+        {
+            result = SYNC_FAILURE;
+            alpm_logaction (handle, PREFIX,
+                    "Failed to synchronize database %s: %s\n",
+                    alpm_db_get_name (db),
+                    alpm_strerror (alpm_errno (handle)));
+        }
+        else if (ret == 1)
+        {
+            result = SYNC_NOT_NEEDED;
+        }
+        else
+        {
+            result = SYNC_SUCCESS;
+            alpm_logaction (handle, PREFIX, "synchronized database %s\n",
+                    alpm_db_get_name (db));
+        }
+        flush_pending ();
+        emit_signal ("SyncDbEnd", "i", result);
+    }
+
+    reset_coalescing ();
+    method_finished ("SyncDbs");
+    return FALSE;
+}
+
+/* importing dbs: the checker (running as user) keeps its own copy of the dbs,
+ * usually synced only moments ago. Instead of downloading them all again, the
+ * client can have us import them, as long as they are owned by the client's
+ * user, signed, pass validation by libalpm, and are newer than ours.
+ * Since the user controls the files' mtime, "newer" is decided from the
+ * creation time of the signature, which is covered by it. Likewise, the mtime
+ * given to imported files (used by SyncDbs for If-Modified-Since) can't be more
+ * than IMPORT_MTIME_SLACK after that time, so a db can't be made to look fresh
+ * for long enough to hold back updates. */
+
+#define IMPORT_MTIME_SLACK      3600
+#define SIG_MAX_SIZE            65536
+
+static inline guint32
+get_be32 (const guchar *p)
+{
+    return ((guint32) p[0] << 24) | ((guint32) p[1] << 16)
+        | ((guint32) p[2] << 8) | (guint32) p[3];
+}
+
+/* returns the creation time of the signature in a (binary) OpenPGP signature
+ * packet, or 0 if it can't be found */
+static time_t
+get_sig_time (const guchar *data, gsize len)
+{
+    gsize pos, end, sublen;
+
+    if (len < 2 || !(data[0] & 0x80))
+    {
+        return 0;
+    }
+    if (data[0] & 0x40)
+    {
+        /* new format */
+        if ((data[0] & 0x3f) != 2)
+        {
+            return 0;
+        }
+        if (data[1] < 192)
+        {
+            pos = 2;
+        }
+        else if (data[1] < 224)
+        {
+            pos = 3;
+        }
+        else if (data[1] == 255)
+        {
+            pos = 6;
+        }
+        else
+        {
+            /* partial body length, not for signatures */
+            return 0;
+        }
+    }
+    else
+    {
+        /* old format */
+        if (((data[0] >> 2) & 0x0f) != 2)
+        {
+            return 0;
+        }
+        switch (data[0] & 0x03)
+        {
+            case 0:
+                pos = 2;
+                break;
+            case 1:
+                pos = 3;
+                break;
+            case 2:
+                pos = 5;
+                break;
+            default:
+                pos = 1;
+                break;
+        }
+    }
+
+    if (pos + 8 > len)
+    {
+        return 0;
+    }
+    switch (data[pos])
+    {
+        case 3:
+            /* version, length of hashed material (5), type, creation time */
+            return (time_t) get_be32 (data + pos + 3);
+        case 4:
+        case 5:
+            /* version, type, pubkey algo, hash algo, hashed subpackets */
+            end = pos + 6 + ((gsize) data[pos + 4] << 8) + data[pos + 5];
+            pos += 6;
+            break;
+        case 6:
+            end = pos + 8 + get_be32 (data + pos + 4);
+            pos += 8;
+            break;
+        default:
+            return 0;
+    }
+    if (end > len)
+    {
+        return 0;
+    }
+
+    while (pos < end)
+    {
+        if (data[pos] < 192)
+        {
+            sublen = data[pos];
+            pos += 1;
+        }
+        else if (data[pos] < 255)
+        {
+            if (pos + 2 > end)
+            {
+                return 0;
+            }
+            sublen = ((gsize) (data[pos] - 192) << 8) + data[pos + 1] + 192;
+            pos += 2;
+        }
+        else
+        {
+            if (pos + 5 > end)
+            {
+                return 0;
+            }
+            sublen = get_be32 (data + pos + 1);
+            pos += 5;
+        }
+        if (sublen == 0 || pos + sublen > end)
+        {
+            return 0;
+        }
+        /* subpacket type 2: signature creation time */
+        if ((data[pos] & 0x7f) == 2 && sublen == 5)
+        {
+            return (time_t) get_be32 (data + pos + 1);
+        }
+        pos += sublen;
+    }
+    return 0;
+}
+
+/* returns the creation time of the signature in file fd, or 0 */
+static time_t
+read_sig_time (int fd)
+{
+    guchar *data;
+    gsize len = 0;
+    ssize_t r;
+    time_t t;
+
+    data = new (guchar, SIG_MAX_SIZE);
+    lseek (fd, 0, SEEK_SET);
+    while (len < SIG_MAX_SIZE
+            && (r = read (fd, data + len, SIG_MAX_SIZE - len)) > 0)
+    {
+        len += (gsize) r;
+    }
+    t = get_sig_time (data, len);
+    free (data);
+    return t;
+}
+
+static gboolean
+get_client_uid (uid_t *uid)
+{
+    GVariant *ret;
+    guint32 u;
+
+    ret = g_dbus_connection_call_sync (connection,
+            "org.freedesktop.DBus",
+            "/org/freedesktop/DBus",
+            "org.freedesktop.DBus",
+            "GetConnectionUnixUser",
+            g_variant_new ("(s)", client),
+            G_VARIANT_TYPE ("(u)"),
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            NULL,
+            NULL);
+    if (!ret)
     {
-        method_failed ("InitAlpm", _("Unable to set gpgdir: %s\n"),
-                alpm_strerror (alpm_errno (handle)));
         return FALSE;
     }
+    g_variant_get (ret, "(u)", &u);
+    g_variant_unref (ret);
+    *uid = (uid_t) u;
+    return TRUE;
+}
 
-    /* cachedirs */
-    while (g_variant_iter_loop (cachedirs_iter, "s", &s))
+/* opens file (not following symlinks) if it's a regular file owned by uid */
+static int
+open_owned_file (const gchar *file, uid_t uid, struct stat *st)
+{
+    int fd;
+
+    fd = open (file, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0)
     {
-        cachedirs = alpm_list_add (cachedirs, strdup (s));
+        return -1;
     }
-    g_variant_iter_free (cachedirs_iter);
+    if (fstat (fd, st) != 0 || !S_ISREG (st->st_mode) || st->st_uid != uid)
+    {
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
 
-    if (0 != alpm_option_set_cachedirs (handle, cachedirs))
+/* copies content of fd into to (through a temp file renamed over it), and sets
+ * its mtime */
+static gboolean
+copy_fd (int fd, const gchar *to, time_t mtime)
+{
+    gchar *tmp;
+    FILE *fp;
+    char buf[8192];
+    ssize_t r;
+    struct timeval tv[2];
+
+    tmp = g_strdup_printf ("%s.kalu", to);
+    fp = fopen (tmp, "wb");
+    if (!fp)
     {
-        FREELIST (cachedirs);
-        method_failed ("InitAlpm", _("Unable to set cache dirs: %s\n"),
-                alpm_strerror (alpm_errno (handle)));
+        g_free (tmp);
+        return FALSE;
+    }
+    lseek (fd, 0, SEEK_SET);
+    while ((r = read (fd, buf, sizeof (buf))) > 0)
+    {
+        if (fwrite (buf, 1, (size_t) r, fp) != (size_t) r)
+        {
+            r = -1;
+            break;
+        }
+    }
+    if (fclose (fp) != 0 || r < 0)
+    {
+        unlink (tmp);
+        g_free (tmp);
         return FALSE;
     }
-    FREELIST (cachedirs);
 
-    if (0 != alpm_option_set_default_siglevel (handle, siglevel))
+    tv[0].tv_sec = tv[1].tv_sec = mtime;
+    tv[0].tv_usec = tv[1].tv_usec = 0;
+    utimes (tmp, tv);
+    if (rename (tmp, to) != 0)
     {
-        method_failed (_("Unable to set default siglevel: %s\n"),
-                alpm_strerror (alpm_errno (handle)));
+        unlink (tmp);
+        g_free (tmp);
+        return FALSE;
+    }
+    g_free (tmp);
+    return TRUE;
+}
+
+static gboolean
+copy_file (const gchar *from, const gchar *to, time_t mtime)
+{
+    gboolean ret;
+    int fd;
+
+    fd = open (from, O_RDONLY);
+    if (fd < 0)
+    {
+        return FALSE;
+    }
+    ret = copy_fd (fd, to, mtime);
+    close (fd);
+    return ret;
+}
+
+/* staging is a folder of ours with a sync folder, tmp a handle on it */
+static gboolean
+import_db (alpm_db_t      *db,
+           const gchar    *folder,
+           uid_t           uid,
+           const gchar    *staging,
+           alpm_handle_t  *tmp)
+{
+    const char *name = alpm_db_get_name (db);
+    const char *dbpath = alpm_option_get_dbpath (handle);
+    alpm_siglevel_t siglevel;
+    gchar src[PATH_MAX], dst[PATH_MAX], stg[PATH_MAX], stg_sig[PATH_MAX];
+    struct stat st_src, st_sig, st_dst;
+    int fd, fd_sig, fd_dst;
+    time_t sig_time, dst_time, mtime;
+    gboolean ret = FALSE;
+    alpm_db_t *tdb;
+
+    snprintf (src, PATH_MAX, "%s/sync/%s.db", folder, name);
+    snprintf (stg, PATH_MAX, "%s/sync/%s.db", staging, name);
+    snprintf (stg_sig, PATH_MAX, "%s/sync/%s.db.sig", staging, name);
+
+    fd = open_owned_file (src, uid, &st_src);
+    if (fd < 0)
+    {
+        debug ("ImportDbs: no valid file for %s", name);
         return FALSE;
     }
 
-    /* following options can't really fail, unless handle is wrong but
-     * that would have caused lots of failures before reacing here */
-    alpm_option_set_arch (handle, arch);
-    alpm_option_set_checkspace (handle, checkspace);
-    alpm_option_set_usesyslog (handle, usesyslog);
-    alpm_option_set_deltaratio (handle, usedelta);
-
-    while (g_variant_iter_loop (ignorepkgs_iter, "s", &s))
+    /* without a signature, there's no telling whether it's newer */
+    snprintf (src, PATH_MAX, "%s/sync/%s.db.sig", folder, name);
+    fd_sig = open_owned_file (src, uid, &st_sig);
+    if (fd_sig < 0)
     {
-        ignorepkgs = alpm_list_add (ignorepkgs, strdup (s));
+        debug ("ImportDbs: %s isn't signed", name);
+        close (fd);
+        return FALSE;
     }
-    g_variant_iter_free (ignorepkgs_iter);
 
-    while (g_variant_iter_loop (ignoregroups_iter, "s", &s))
+    sig_time = read_sig_time (fd_sig);
+    if (sig_time == 0)
     {
-        ignoregroups = alpm_list_add (ignoregroups, strdup (s));
+        debug ("ImportDbs: no creation time in signature of %s", name);
+        goto done;
     }
-    g_variant_iter_free (ignoregroups_iter);
-
-    while (g_variant_iter_loop (noupgrades_iter, "s", &s))
+    if (sig_time > time (NULL) + 60)
     {
-        noupgrades = alpm_list_add (noupgrades, strdup (s));
+        debug ("ImportDbs: signature of %s is from the future", name);
+        goto done;
     }
-    g_variant_iter_free (noupgrades_iter);
 
-    while (g_variant_iter_loop (noextracts_iter, "s", &s))
+    /* ours: creation time of its signature, else its mtime (it's our file,
+     * set by libalpm from the server) */
+    dst_time = 0;
+    snprintf (dst, PATH_MAX, "%ssync/%s.db.sig", dbpath, name);
+    fd_dst = open (dst, O_RDONLY);
+    if (fd_dst >= 0)
     {
-        noextracts = alpm_list_add (noextracts, strdup (s));
+        dst_time = read_sig_time (fd_dst);
+        close (fd_dst);
+    }
+    snprintf (dst, PATH_MAX, "%ssync/%s.db", dbpath, name);
+    if (dst_time == 0 && stat (dst, &st_dst) == 0)
+    {
+        dst_time = st_dst.st_mtime;
+    }
+    if (sig_time <= dst_time)
+    {
+        debug ("ImportDbs: %s isn't newer", name);
+        goto done;
     }
-    g_variant_iter_free (noextracts_iter);
 
-    alpm_option_set_ignorepkgs (handle, ignorepkgs);
-    alpm_option_set_ignoregroups (handle, ignoregroups);
-    alpm_option_set_noupgrades (handle, noupgrades);
-    alpm_option_set_noextracts (handle, noextracts);
+    mtime = MIN (st_src.st_mtime, sig_time + IMPORT_MTIME_SLACK);
+    mtime = MIN (mtime, time (NULL));
 
-    FREELIST (ignorepkgs);
-    FREELIST (ignoregroups);
-    FREELIST (noupgrades);
-    FREELIST (noextracts);
+    siglevel = alpm_db_get_siglevel (db);
+    if (siglevel & ALPM_SIG_USE_DEFAULT)
+    {
+        siglevel = alpm_option_get_default_siglevel (handle);
+    }
+    siglevel |= ALPM_SIG_DATABASE;
+    siglevel &= ~ALPM_SIG_DATABASE_OPTIONAL;
 
-    /* done */
-    method_finished ("InitAlpm");
-    return FALSE;
-}
+    /* copy into staging, and have libalpm validate it from there */
+    if (!copy_fd (fd, stg, mtime))
+    {
+        debug ("ImportDbs: failed to copy %s", name);
+        goto done;
+    }
+    if (!copy_fd (fd_sig, stg_sig, mtime))
+    {
+        debug ("ImportDbs: failed to copy signature of %s", name);
+        goto done;
+    }
 
-static gboolean
-free_alpm (GVariant *parameters)
-{
-    g_variant_unref (parameters);
-    free (client);
-    client = NULL;
+    tdb = alpm_register_syncdb (tmp, name, siglevel);
+    if (!tdb || alpm_db_get_valid (tdb) != 0 || !alpm_db_get_pkgcache (tdb))
+    {
+        debug ("ImportDbs: %s isn't valid: %s", name,
+                alpm_strerror (alpm_errno (tmp)));
+        goto done;
+    }
 
-    /* free alpm */
-    if (handle && alpm_release (handle) == -1)
+    /* all good, put the (validated) files in place */
+    snprintf (dst, PATH_MAX, "%ssync/%s.db.sig", dbpath, name);
+    if (!copy_file (stg_sig, dst, mtime))
     {
-        method_failed ("FreeAlpm", _("Failed to release alpm library\n"));
+        debug ("ImportDbs: failed to write %s", dst);
+        goto done;
     }
-    else
+    snprintf (dst, PATH_MAX, "%ssync/%s.db", dbpath, name);
+    if (!copy_file (stg, dst, mtime))
     {
-        method_finished ("FreeAlpm");
+        debug ("ImportDbs: failed to write %s", dst);
+        goto done;
     }
-    handle = NULL;
+    alpm_logaction (handle, PREFIX, "imported database %s\n", name);
+    ret = TRUE;
 
-    /* we have no reason to keep running at this point */
-    g_main_loop_quit (loop);
-    return FALSE;
+done:
+    close (fd);
+    close (fd_sig);
+    unlink (stg_sig);
+    unlink (stg);
+    return ret;
 }
 
 static gboolean
-add_db (GVariant *parameters)
+import_dbs (GVariant *parameters)
 {
-    const gchar  *name;
-    int           siglevel;
-    GVariantIter *servers_iter;
-    alpm_list_t  *servers = NULL;
-
-    /* to extract arrays into alpm_list_t */
-    const gchar *s;
-
-    g_variant_get (parameters, "(sias)",
-            &name,
-            &siglevel,
-            &servers_iter);
-    g_variant_unref (parameters);
-
-    alpm_db_t *db;
-    db = alpm_register_syncdb (handle, name, (alpm_siglevel_t) siglevel);
-    if (db == NULL)
-    {
-        method_failed ("AddDb", _("Could not register database %s: %s\n"),
-                name, alpm_strerror (alpm_errno (handle)));
+    const gchar   *folder;
+    const char    *lockfile;
+    gchar         *staging;
+    gchar          buf[PATH_MAX];
+    alpm_handle_t *tmp;
+    alpm_list_t   *i;
+    uid_t          uid;
+    int            fd_lck;
+    int            nb = 0;
+
+    g_variant_get (parameters, "(&s)", &folder);
+    drop_cached_dbs (nb_dbs);
+
+    if (!get_client_uid (&uid))
+    {
+        g_variant_unref (parameters);
+        method_failed ("ImportDbs", _("Unable to identify client\n"));
         return FALSE;
     }
 
-    while (g_variant_iter_loop (servers_iter, "s", &s))
+    /* we're writing into the sync dbs, so lock like libalpm does */
+    lockfile = alpm_option_get_lockfile (handle);
+    fd_lck = open (lockfile, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0000);
+    if (fd_lck < 0)
     {
-        servers = alpm_list_add (servers, strdup (s));
+        g_variant_unref (parameters);
+        method_failed ("ImportDbs", _("Unable to lock database %s: %s\n"),
+                lockfile, strerror (errno));
+        return FALSE;
     }
-    g_variant_iter_free (servers_iter);
+    close (fd_lck);
 
-    alpm_list_t *i;
-    const char *arch = alpm_option_get_arch (handle);
-    FOR_LIST (i, servers)
+    staging = g_dir_make_tmp ("kalu-dbus-XXXXXX", NULL);
+    if (!staging)
     {
-        char *value = i->data;
-        char *temp = strreplace (value, "$repo", name);
-        char *server;
-
-        if (arch)
-        {
-            server = strreplace (temp, "$arch", arch);
-            free (temp);
-        }
-        else
-        {
-            if (strstr (temp, "$arch"))
-            {
-                free (temp);
-                FREELIST (servers);
-                method_failed ("AddDb",
-                        _("Server %s contains the $arch variable, but no Architecture was defined.\n"),
-                        value);
-                return FALSE;
-            }
-            server = temp;
-        }
-
-        debug ("add server %s into %s", server, name);
-        if (alpm_db_add_server (db, server) != 0)
-        {
-            FREELIST (servers);
-            free (server);
-            /* pm_errno is set by alpm_db_setserver */
-            method_failed ("AddDb",
-                    _("Could not add server %s to database %s: %s\n"),
-                    server,
-                    name,
-                    alpm_strerror (alpm_errno (handle)));
-            return FALSE;
-        }
-        free (server);
+        unlink (lockfile);
+        g_variant_unref (parameters);
+        method_failed ("ImportDbs", _("Unable to create temp folder\n"));
+        return FALSE;
     }
-    FREELIST (servers);
+    snprintf (buf, PATH_MAX, "%s/sync", staging);
+    mkdir (buf, 0700);
 
-    /* ensure db is valid */
-    if (alpm_db_get_valid (db))
+    tmp = alpm_initialize (alpm_option_get_root (handle), staging, NULL);
+    if (!tmp)
     {
-        method_failed ("AddDb", _("Database %s is not valid: %s\n"),
-                name,
-                alpm_strerror (alpm_errno (handle)));
+        unlink (lockfile);
+        rmdir (buf);
+        rmdir (staging);
+        g_free (staging);
+        g_variant_unref (parameters);
+        method_failed ("ImportDbs", _("Failed to initialize alpm library\n"));
         return FALSE;
     }
+    alpm_option_set_gpgdir (tmp, alpm_option_get_gpgdir (handle));
 
-    /* done */
-    method_finished ("AddDb");
-    return FALSE;
-}
-
-static gboolean
-sync_dbs (GVariant *parameters)
-{
-    alpm_list_t        *syncdbs   = NULL;
-    alpm_list_t        *i;
-    int                 ret;
-    sync_db_results_t   result;
-
-    g_variant_unref (parameters);
-
-    syncdbs = alpm_get_syncdbs (handle);
-    emit_signal ("SyncDbs", "i", alpm_list_count (syncdbs));
-    FOR_LIST (i, syncdbs)
+    FOR_LIST (i, alpm_get_syncdbs (handle))
     {
-        alpm_db_t *db = i->data;
-        emit_signal ("SyncDbStart", "s", alpm_db_get_name (db));
-        ret = alpm_db_update (0, db);
-        if (ret < 0)
-        {
-            result = SYNC_FAILURE;
-            alpm_logaction (handle, PREFIX,
-                    "Failed to synchronize database %s: %s\n",
-                    alpm_db_get_name (db),
-                    alpm_strerror (alpm_errno (handle)));
-        }
-        else if (ret == 1)
+        if (import_db (i->data, folder, uid, staging, tmp))
         {
-            result = SYNC_NOT_NEEDED;
+            ++nb;
         }
-        else
+    }
+    g_variant_unref (parameters);
+
+    alpm_release (tmp);
+    unlink (lockfile);
+    rmdir (buf);
+    rmdir (staging);
+    g_free (staging);
+
+    debug ("%d database(s) imported", nb);
+    /* libalpm might have (cached) info from the previous files */
+    if (nb > 0)
+    {
+        gchar *errmsg = NULL;
+
+        if (!reload_dbs (&errmsg))
         {
-            result = SYNC_SUCCESS;
-            alpm_logaction (handle, PREFIX, "synchronized database %s\n",
-                    alpm_db_get_name (db));
+            method_failed ("ImportDbs", "%s", errmsg);
+            g_free (errmsg);
+            return FALSE;
         }
-        emit_signal ("SyncDbEnd", "i", result);
     }
-
-    method_finished ("SyncDbs");
+    emit_signal ("ImportDbs", "i", nb);
+    method_finished ("ImportDbs");
     return FALSE;
 }
 
@@ -1026,6 +2742,7 @@ static gboolean
 get_packages (GVariant *parameters)
 {
     g_variant_unref (parameters);
+    drop_cached_dbs (nb_dbs);
 
     if (alpm_trans_init (handle, 0) == -1)
     {
@@ -1185,9 +2902,12 @@ sysupgrade (GVariant *parameters)
 
     alpm_logaction (handle, PREFIX, "starting sysupgrade...\n");
 
+    dl_prepare ();
     alpm_list_t *alpm_data = NULL;
     if (alpm_trans_commit (handle, &alpm_data) == -1)
     {
+        dl_cleanup ();
+        reset_coalescing ();
         alpm_list_t *i, *details = NULL;
         gchar buf[255], *errmsg;
         size_t len = 0;
@@ -1269,6 +2989,8 @@ sysupgrade (GVariant *parameters)
         return FALSE;
     }
 
+    dl_cleanup ();
+    reset_coalescing ();
     FREELIST (alpm_data);
     alpm_trans_release (handle);
     alpm_logaction (handle, PREFIX, "sysupgrade completed\n");
@@ -1276,6 +2998,102 @@ sysupgrade (GVariant *parameters)
     return FALSE;
 }
 
+/* download all packages of a sysupgrade into the cache, without installing
+ * anything. maxrate is in KiB/s, 0 for no limit */
+static gboolean
+prefetch (GVariant *parameters)
+{
+    guint32 maxrate;
+    alpm_list_t *alpm_data = NULL;
+    enum _alpm_errno_t err;
+    const gchar *dbpath;
+    gchar *lockfile;
+    int fd_lck;
+
+    g_variant_get (parameters, "(u)", &maxrate);
+    g_variant_unref (parameters);
+    drop_cached_dbs (nb_dbs);
+
+    if (alpm_trans_init (handle, ALPM_TRANS_FLAG_DOWNLOADONLY) == -1)
+    {
+        method_failed ("Prefetch",
+                _("Failed to initiate transaction: %s\n"),
+                alpm_strerror (alpm_errno (handle)));
+        return FALSE;
+    }
+
+    if (alpm_sync_sysupgrade (handle, 0) == -1)
+    {
+        method_failed ("Prefetch", "%s",
+                alpm_strerror (alpm_errno (handle)));
+        alpm_trans_release (handle);
+        return FALSE;
+    }
+
+    if (alpm_trans_prepare (handle, &alpm_data) == -1)
+    {
+        /* details will be given to the user on the actual sysupgrade */
+        method_failed ("Prefetch",
+                _("Failed to prepare transaction: %s\n"),
+                alpm_strerror (alpm_errno (handle)));
+        FREELIST (alpm_data);
+        alpm_trans_release (handle);
+        return FALSE;
+    }
+    FREELIST (alpm_data);
+
+    if (!alpm_trans_get_add (handle))
+    {
+        alpm_trans_release (handle);
+        method_finished ("Prefetch");
+        return FALSE;
+    }
+
+    /* our handle locks our copy of the dbs, but packages go into the system's
+     * cache, so we also need the system's lock while downloading */
+    g_variant_get_child (alpm_params, 1, "&s", &dbpath);
+    lockfile = g_build_filename (dbpath, "db.lck", NULL);
+    fd_lck = open (lockfile, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0000);
+    if (fd_lck < 0)
+    {
+        method_failed ("Prefetch", _("Unable to lock database %s: %s\n"),
+                lockfile, strerror (errno));
+        g_free (lockfile);
+        alpm_trans_release (handle);
+        return FALSE;
+    }
+    close (fd_lck);
+
+    max_recv_speed = (curl_off_t) maxrate * 1024;
+    alpm_logaction (handle, PREFIX, "starting prefetch...\n");
+
+    dl_prepare ();
+    if (alpm_trans_commit (handle, &alpm_data) == -1)
+    {
+        err = alpm_errno (handle);
+        method_failed ("Prefetch",
+                _("Failed to commit transaction: %s\n"),
+                alpm_strerror (err));
+        alpm_logaction (handle, PREFIX,
+                "Failed to commit prefetch transaction: %s\n",
+                alpm_strerror (err));
+    }
+    else
+    {
+        alpm_logaction (handle, PREFIX, "prefetch completed\n");
+        method_finished ("Prefetch");
+    }
+
+    dl_cleanup ();
+    reset_coalescing ();
+    max_recv_speed = 0;
+    FREELIST (alpm_data);
+    alpm_trans_release (handle);
+    unlink (lockfile);
+    g_free (lockfile);
+    return FALSE;
+}
+
 static gboolean
 no_sysupgrade (GVariant *parameters)
 {
@@ -1285,6 +3103,15 @@ no_sysupgrade (GVariant *parameters)
     return FALSE;
 }
 
+static gboolean
+enable_event_batch (GVariant *parameters)
+{
+    g_variant_unref (parameters);
+    batch_enabled = TRUE;
+    method_finished ("EnableEventBatch");
+    return FALSE;
+}
+
 #undef method_finished
 #undef method_failed
 
@@ -1293,11 +3120,12 @@ no_sysupgrade (GVariant *parameters)
  ******************/
 
 #define send_error(error, ...)  do {                    \
-    snprintf (buffer, 255, __VA_ARGS__);                \
+    gchar *_msg = g_strdup_printf (__VA_ARGS__);        \
     g_dbus_method_invocation_return_dbus_error (        \
         invocation,                                     \
         "org.jjk.kalu." error,                          \
-        buffer);                                        \
+        _msg);                                          \
+    g_free (_msg);                                      \
     } while (0)
 #define if_method(name, func)   do  {                                   \
         if (g_strcmp0 (method_name, name) == 0)                         \
@@ -1318,12 +3146,24 @@ handle_method_call (GDBusConnection       *conn _UNUSED_,
                     GDBusMethodInvocation *invocation,
                     gpointer               data _UNUSED_)
 {
-    debug ("sender=%s -- client=%s -- method=%s", sender, client, method_name);
+    if (debug_level > 1)
+    {
+        debug ("sender=%s -- client=%s -- method=%s", sender, client,
+                method_name);
+    }
     /* Init: check auth from PolicyKit, and "lock" to client/sender */
-    if (g_strcmp0 (method_name, "Init") == 0)
+    if (g_strcmp0 (method_name, "Init") == 0
+            || g_strcmp0 (method_name, "InitPrefetch") == 0)
     {
         /* we need to send the sender to init, hence the following */
-        GVariant *value = g_variant_new ("(s)", sender);
+        GVariant *value = g_variant_new ("(sb)", sender,
+                g_strcmp0 (method_name, "Init") == 0);
+        /* don't exit while (possibly) waiting on PolicyKit */
+        if (idle_id > 0)
+        {
+            g_source_remove (idle_id);
+            idle_id = 0;
+        }
         parameters = value;
         g_variant_ref (parameters);
         g_timeout_add (1, (GSourceFunc) init, parameters);
@@ -1347,10 +3187,42 @@ handle_method_call (GDBusConnection       *conn _UNUSED_,
 
     /* client/sender has been auth (PK) */
 
+    if (g_strcmp0 (method_name, "SetDebug") == 0)
+    {
+        g_variant_get (parameters, "(u)", &debug_level);
+        g_dbus_method_invocation_return_value (invocation, NULL);
+        return;
+    }
+
+    if (g_strcmp0 (method_name, "OpenPeer") == 0)
+    {
+        open_peer (invocation);
+        return;
+    }
+
+    if (g_strcmp0 (method_name, "ClosePeer") == 0)
+    {
+        close_peer ();
+        g_dbus_method_invocation_return_value (invocation, NULL);
+        return;
+    }
+
     if_method ("InitAlpm",      init_alpm);
     if_method ("FreeAlpm",      free_alpm);
     if_method ("AddDb",         add_db);
+    if_method ("ImportDbs",     import_dbs);
     if_method ("SyncDbs",       sync_dbs);
+    if_method ("Prefetch",      prefetch);
+    if_method ("EnableEventBatch", enable_event_batch);
+
+    /* a prefetch session can't do anything else */
+    if (is_prefetch)
+    {
+        send_error ("PrefetchOnlyError",
+                _("Session initialized for prefetch only\n"));
+        return;
+    }
+
     if_method ("Answer",        answer);
     if_method ("GetPackages",   get_packages);
     if_method ("SysUpgrade",    sysupgrade);
@@ -1414,6 +3286,7 @@ main (int argc _UNUSED_, char *argv[] _UNUSED_)
     g_type_init ();
 
     set_user_agent ();
+    curl_global_init (CURL_GLOBAL_ALL);
 
     owner_id = g_bus_own_name (G_BUS_TYPE_SYSTEM,
             "org.jjk.kalu",
@@ -1428,5 +3301,6 @@ main (int argc _UNUSED_, char *argv[] _UNUSED_)
     g_main_loop_run (loop);
 
     g_bus_unown_name (owner_id);
+    curl_global_cleanup ();
     return 0;
 }
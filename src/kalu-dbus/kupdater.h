@@ -62,4 +62,13 @@ typedef enum _event_t {
     EVENT_KEYRING,
 } event_t;
 
+/* type of events in signal "EventBatch" */
+typedef enum _batch_event_t {
+    BATCH_INSTALLED,
+    BATCH_REINSTALLED,
+    BATCH_REMOVED,
+    BATCH_UPGRADED,
+    BATCH_DOWNGRADED
+} batch_event_t;
+
 #endif /* _KALU_KUPDATER_H */
@@ -22,6 +22,10 @@
 
 #include <config.h>
 
+/* tag debug() messages & allocations */
+#define DEBUG_SUBSYS    SUBSYS_AUR
+#define ALLOC_TAG       "aur"
+
 /* C */
 #include <string.h>
 #include <ctype.h>  /* isalnum() */
@@ -40,25 +44,17 @@
 #include "kalu.h"
 #include "aur.h"
 #include "curl.h"
+#include "stats.h"
 
 #define MAX_URL_LENGTH          1024
 
-static void *
-get_pkg_from_list (const char *pkgname, alpm_list_t *pkgs, gboolean is_watched)
+static watched_package_t *
+get_pkg_from_list (const char *pkgname, alpm_list_t *pkgs)
 {
     alpm_list_t *i;
-    const char *name;
     FOR_LIST (i, pkgs)
     {
-        if (is_watched)
-        {
-            name = ((watched_package_t *) i->data)->name;
-        }
-        else
-        {
-            name = alpm_pkg_get_name ((alpm_pkg_t *) i->data);
-        }
-        if (streq (pkgname, name))
+        if (streq (pkgname, ((watched_package_t *) i->data)->name))
         {
             return i->data;
         }
@@ -75,6 +71,7 @@ gboolean
 aur_has_updates (alpm_list_t **packages,
                  alpm_list_t *aur_pkgs,
                  gboolean is_watched,
+                 cancel_t *cancel,
                  GError **error)
 {
     alpm_list_t *urls = NULL, *i;
@@ -86,7 +83,7 @@ aur_has_updates (alpm_list_t **packages,
     const char *pkgname, *pkgdesc, *pkgver, *oldver;
     cJSON *json, *results, *package;
     int c, j;
-    void *pkg;
+    watched_package_t *pkg;
     kalu_package_t *kpkg;
 
     debug ((is_watched)
@@ -103,14 +100,7 @@ aur_has_updates (alpm_list_t **packages,
         char *end;
         const char *p;
 
-        if (is_watched)
-        {
-            pkgname = ((watched_package_t *) i->data)->name;
-        }
-        else
-        {
-            pkgname = alpm_pkg_get_name ((alpm_pkg_t *) i->data);
-        }
+        pkgname = ((watched_package_t *) i->data)->name;
 
         /* make sure we can at least add the prefix */
         if (len_prefix > max)
@@ -181,7 +171,10 @@ aur_has_updates (alpm_list_t **packages,
     /* download */
     FOR_LIST (i, urls)
     {
-        data = curl_download (i->data, &local_err);
+        gint64 start = stats_now ();
+
+        data = curl_download (i->data, cancel, &local_err);
+        stats_add ("aur: request", start);
         if (local_err != NULL)
         {
             g_propagate_error (error, local_err);
@@ -216,7 +209,7 @@ aur_has_updates (alpm_list_t **packages,
                 pkgdesc = cJSON_GetObjectItem (package, "Description")->valuestring;
                 pkgver = cJSON_GetObjectItem (package, "Version")->valuestring;
                 /* ALPM/watched */
-                pkg = get_pkg_from_list (pkgname, aur_pkgs, is_watched);
+                pkg = get_pkg_from_list (pkgname, aur_pkgs);
                 if (!pkg)
                 {
                     debug ("package %s not found in aur_pkgs", pkgname);
@@ -229,14 +222,7 @@ aur_has_updates (alpm_list_t **packages,
                     cJSON_Delete (json);
                     return FALSE;
                 }
-                if (is_watched)
-                {
-                    oldver = ((watched_package_t *) pkg)->version;
-                }
-                else
-                {
-                    oldver = alpm_pkg_get_version ((alpm_pkg_t *) pkg);
-                }
+                oldver = pkg->version;
                 /* is AUR newer? */
                 if (alpm_pkg_vercmp (pkgver, oldver) == 1)
                 {
@@ -23,10 +23,14 @@
 #ifndef _KALU_AUR_H
 #define _KALU_AUR_H
 
+/* kalu */
+#include "executor.h"
+
 gboolean
 aur_has_updates (alpm_list_t **packages,
                  alpm_list_t *aur_pkgs,
                  gboolean is_watched,
+                 cancel_t *cancel,
                  GError **error);
 
 #endif /* _KALU_AUR_H */
@@ -0,0 +1,572 @@
+/**
+ * kalu - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * bench.c
+ * Copyright (C) 2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+
+#include <config.h>
+
+/* C */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* alpm */
+#include <alpm.h>
+#include <alpm_list.h>
+
+/* glib */
+#include <glib-2.0/glib.h>
+
+/* kalu */
+#include "kalu.h"
+#include "kalu-alpm.h"
+#include "util.h"
+#include "stats.h"
+
+/* benchmark of the libalpm check path: generates a fake system (pacman.conf,
+ * local db & a sync db) of N packages, 1 in 10 having an upgrade available,
+ * plus K foreign packages (installed but in no sync db) and M watched
+ * packages, then times kalu_alpm_load, kalu_alpm_has_updates,
+ * kalu_alpm_has_updates_watched & kalu_alpm_has_foreign against it.
+ *
+ * Each size runs in its own (forked) process, so peak RSS isn't polluted by
+ * the previous ones. It is the peak of the process so far, i.e. it includes
+ * the previous functions.
+ *
+ * With --templates it instead times the rendering of notifications (with the
+ * default templates) for a list of upgrades. */
+
+config_t *config = NULL;
+
+typedef struct _measure_t {
+    gint64          wall;
+    struct rusage   usage;
+} measure_t;
+
+static void
+measure_begin (measure_t *m)
+{
+    getrusage (RUSAGE_SELF, &m->usage);
+    m->wall = g_get_monotonic_time ();
+}
+
+static void
+measure_end (measure_t *m, const gchar *name, gboolean ret, GError *error)
+{
+    struct rusage   usage;
+    gint64          wall;
+    gint64          cpu;
+
+    wall = g_get_monotonic_time () - m->wall;
+    getrusage (RUSAGE_SELF, &usage);
+    cpu = (usage.ru_utime.tv_sec - m->usage.ru_utime.tv_sec) * G_USEC_PER_SEC
+        + (usage.ru_utime.tv_usec - m->usage.ru_utime.tv_usec)
+        + (usage.ru_stime.tv_sec - m->usage.ru_stime.tv_sec) * G_USEC_PER_SEC
+        + (usage.ru_stime.tv_usec - m->usage.ru_stime.tv_usec);
+
+    printf ("%-32s %12.2f %12.2f %14ld",
+            name,
+            (gdouble) wall / 1000.0,
+            (gdouble) cpu / 1000.0,
+            usage.ru_maxrss);
+    if (error)
+    {
+        printf ("  (failed: %s)", error->message);
+    }
+    else if (!ret)
+    {
+        printf ("  (nothing found)");
+    }
+    putchar ('\n');
+}
+
+/* tar (ustar) writing, enough for a sync db */
+
+static void
+tar_header (FILE *fp, const gchar *name, gboolean is_dir, size_t size)
+{
+    unsigned char   header[512];
+    unsigned int    sum = 0;
+    gint            i;
+
+    memzero (header, 512);
+    snprintf ((char *) header, 100, "%s", name);
+    snprintf ((char *) header + 100, 8, "%07o", (is_dir) ? 0755 : 0644);
+    snprintf ((char *) header + 108, 8, "%07o", 0);
+    snprintf ((char *) header + 116, 8, "%07o", 0);
+    snprintf ((char *) header + 124, 12, "%011lo", (unsigned long) size);
+    snprintf ((char *) header + 136, 12, "%011lo", (unsigned long) time (NULL));
+    memset (header + 148, ' ', 8);
+    header[156] = (is_dir) ? '5' : '0';
+    memcpy (header + 257, "ustar", 6);
+    memcpy (header + 263, "00", 2);
+    for (i = 0; i < 512; ++i)
+    {
+        sum += header[i];
+    }
+    snprintf ((char *) header + 148, 8, "%06o", sum);
+    fwrite (header, 1, 512, fp);
+}
+
+static void
+tar_file (FILE *fp, const gchar *name, const gchar *data, size_t len)
+{
+    static const char pad[512] = { 0 };
+
+    tar_header (fp, name, FALSE, len);
+    fwrite (data, 1, len, fp);
+    if (len % 512)
+    {
+        fwrite (pad, 1, 512 - len % 512, fp);
+    }
+}
+
+static gboolean
+write_file (const gchar *file, const gchar *data, GError **error)
+{
+    return g_file_set_contents (file, data, -1, error);
+}
+
+/* generates the fake system in folder; returns the list of watched packages
+ * (watched_package_t) */
+static gboolean
+generate (const gchar *folder, gint nb_pkgs, gint nb_watched, gint nb_foreign,
+        alpm_list_t **watched, GError **error)
+{
+    gchar    buf[MAX_PATH];
+    gchar    name[32];
+    GString *desc;
+    FILE    *fp;
+    gint     i;
+
+    snprintf (buf, MAX_PATH, "%s/pacman.conf", folder);
+    desc = g_string_new (NULL);
+    g_string_printf (desc,
+            "[options]\n"
+            "RootDir = %s/root/\n"
+            "DBPath = %s/db/\n"
+            "CacheDir = %s/cache/\n"
+            "SigLevel = Never\n"
+            "\n"
+            "[bench]\n"
+            "Server = file://%s/repo\n",
+            folder, folder, folder, folder);
+    if (!write_file (buf, desc->str, error))
+    {
+        g_string_free (desc, TRUE);
+        return FALSE;
+    }
+
+    snprintf (buf, MAX_PATH, "%s/root", folder);
+    mkdir (buf, 0755);
+    snprintf (buf, MAX_PATH, "%s/cache", folder);
+    mkdir (buf, 0755);
+    snprintf (buf, MAX_PATH, "%s/db", folder);
+    mkdir (buf, 0755);
+    snprintf (buf, MAX_PATH, "%s/db/sync", folder);
+    mkdir (buf, 0755);
+    snprintf (buf, MAX_PATH, "%s/db/local", folder);
+    mkdir (buf, 0755);
+    snprintf (buf, MAX_PATH, "%s/db/local/ALPM_DB_VERSION", folder);
+    if (!write_file (buf, "9\n", error))
+    {
+        g_string_free (desc, TRUE);
+        return FALSE;
+    }
+
+    /* local db: all packages installed (1.0-1), plus the foreign ones */
+    for (i = 0; i < nb_pkgs + nb_foreign; ++i)
+    {
+        if (i < nb_pkgs)
+        {
+            snprintf (name, 32, "pkg%06d", i);
+        }
+        else
+        {
+            snprintf (name, 32, "foreign%06d", i - nb_pkgs);
+        }
+        snprintf (buf, MAX_PATH, "%s/db/local/%s-1.0-1", folder, name);
+        if (mkdir (buf, 0755) < 0)
+        {
+            g_set_error (error, KALU_ERROR, 1, "Unable to create %s: %s",
+                    buf, strerror (errno));
+            g_string_free (desc, TRUE);
+            return FALSE;
+        }
+        g_string_printf (desc,
+                "%%NAME%%\n%s\n\n"
+                "%%VERSION%%\n1.0-1\n\n"
+                "%%DESC%%\nbenchmark package %s\n\n"
+                "%%ARCH%%\nany\n\n"
+                "%%BUILDDATE%%\n1370000000\n\n"
+                "%%INSTALLDATE%%\n1370000000\n\n"
+                "%%SIZE%%\n4096\n\n"
+                "%%REASON%%\n0\n\n",
+                name, name);
+        snprintf (buf, MAX_PATH, "%s/db/local/%s-1.0-1/desc", folder, name);
+        if (!write_file (buf, desc->str, error))
+        {
+            g_string_free (desc, TRUE);
+            return FALSE;
+        }
+        snprintf (buf, MAX_PATH, "%s/db/local/%s-1.0-1/files", folder, name);
+        if (!write_file (buf, "", error))
+        {
+            g_string_free (desc, TRUE);
+            return FALSE;
+        }
+    }
+
+    /* sync db: 1 in 10 packages has an upgrade (1.0-2) */
+    snprintf (buf, MAX_PATH, "%s/db/sync/bench.db", folder);
+    fp = fopen (buf, "w");
+    if (!fp)
+    {
+        g_set_error (error, KALU_ERROR, 1, "Unable to create %s: %s",
+                buf, strerror (errno));
+        g_string_free (desc, TRUE);
+        return FALSE;
+    }
+    for (i = 0; i < nb_pkgs; ++i)
+    {
+        const gchar *version = (i % 10 == 0) ? "1.0-2" : "1.0-1";
+
+        snprintf (name, 32, "pkg%06d", i);
+        snprintf (buf, MAX_PATH, "%s-%s/", name, version);
+        tar_header (fp, buf, TRUE, 0);
+        g_string_printf (desc,
+                "%%FILENAME%%\n%s-%s-any.pkg.tar.xz\n\n"
+                "%%NAME%%\n%s\n\n"
+                "%%VERSION%%\n%s\n\n"
+                "%%DESC%%\nbenchmark package %s\n\n"
+                "%%CSIZE%%\n1024\n\n"
+                "%%ISIZE%%\n4096\n\n"
+                "%%ARCH%%\nany\n\n"
+                "%%BUILDDATE%%\n1370000000\n\n",
+                name, version, name, version, name);
+        snprintf (buf, MAX_PATH, "%s-%s/desc", name, version);
+        tar_file (fp, buf, desc->str, desc->len);
+    }
+    /* end of archive */
+    for (i = 0; i < 2; ++i)
+    {
+        static const char zeros[512] = { 0 };
+        fwrite (zeros, 1, 512, fp);
+    }
+    fclose (fp);
+    g_string_free (desc, TRUE);
+
+    /* watched packages, spread over the list, all with an update */
+    for (i = 0; i < nb_watched && i < nb_pkgs; ++i)
+    {
+        watched_package_t *w_pkg;
+
+        snprintf (name, 32, "pkg%06d", (gint) ((gint64) i * nb_pkgs / nb_watched));
+        w_pkg = new0 (watched_package_t, 1);
+        w_pkg->name = strdup (name);
+        w_pkg->version = strdup ("0.9-1");
+        *watched = alpm_list_add (*watched, w_pkg);
+    }
+
+    return TRUE;
+}
+
+static void
+free_kalu_package (kalu_package_t *package)
+{
+    free (package->name);
+    free (package->desc);
+    free (package->old_version);
+    free (package->new_version);
+    free (package);
+}
+
+static void
+free_w_pkg (watched_package_t *w_pkg)
+{
+    free (w_pkg->name);
+    free (w_pkg->version);
+    free (w_pkg);
+}
+
+/* renders the notification (as with the default templates for upgrades) for
+ * a list of nb_pkgs packages, nb_runs times */
+static void
+bench_templates (gint nb_pkgs, gint nb_runs)
+{
+    alpm_list_t    *packages = NULL;
+    tpl_t          *tpl_title;
+    tpl_t          *tpl_package;
+    tpl_totals_t    totals;
+    const char     *values[NB_TPL_VARS] = { NULL };
+    char            buf[32];
+    measure_t       m;
+    gint64          start;
+    size_t          len = 0;
+    gint            i;
+
+    for (i = 0; i < nb_pkgs; ++i)
+    {
+        kalu_package_t *package;
+
+        package = new0 (kalu_package_t, 1);
+        snprintf (buf, 32, "pkg%06d", i);
+        package->name = strdup (buf);
+        snprintf (buf, 32, "benchmark <%d> & co", i);
+        package->desc = strdup (buf);
+        package->old_version = strdup ("1.0-1");
+        package->new_version = strdup ("1.0-2");
+        package->dl_size = 1024 * (guint) (i % 4096);
+        package->old_size = 4096 * (guint) (i % 1024);
+        package->new_size = 4096 * (guint) (i % 1024) + 512;
+        packages = alpm_list_add (packages, package);
+    }
+
+    tpl_title = tpl_compile ("$NB updates available (D: $DL; N: $NET)");
+    tpl_package = tpl_compile ("- <b>$PKG</b> $OLD > <b>$NEW</b> (D: $DL; N: $NET)");
+
+    printf ("\nrendering notifications for %d upgrades, %d times\n",
+            nb_pkgs, nb_runs);
+    printf ("%-32s %12s %12s %14s\n",
+            "function", "wall (ms)", "cpu (ms)", "peak RSS (KiB)");
+    measure_begin (&m);
+    start = g_get_monotonic_time ();
+    for (i = 0; i < nb_runs; ++i)
+    {
+        char *text, *summary;
+
+        text = render_packages (tpl_package, "\n", packages, FALSE, TRUE,
+                &totals);
+        snprintf (buf, 32, "%d", totals.nb);
+        values[TPL_NB] = buf;
+        values[TPL_DL] = "42 MiB";
+        values[TPL_NET] = "1 MiB";
+        summary = new (char, tpl_len (tpl_title, values, TRUE) + 1);
+        *tpl_render (tpl_title, summary, values, TRUE) = '\0';
+        len = strlen (text);
+        free (summary);
+        free (text);
+    }
+    measure_end (&m, "notification (all runs)", TRUE, NULL);
+    printf ("%.3f ms per notification, %zu bytes of text\n",
+            (gdouble) (g_get_monotonic_time () - start) / 1000.0 / nb_runs,
+            len);
+
+    tpl_free (tpl_title);
+    tpl_free (tpl_package);
+    alpm_list_free_inner (packages, (alpm_list_fn_free) free_kalu_package);
+    alpm_list_free (packages);
+}
+
+/* runs in a forked process */
+static int
+run (const gchar *folder, alpm_list_t *watched)
+{
+    measure_t    m;
+    GError      *error = NULL;
+    alpm_list_t *packages = NULL;
+    gchar        conffile[MAX_PATH];
+    gboolean     ret;
+
+    snprintf (conffile, MAX_PATH, "%s/pacman.conf", folder);
+
+    measure_begin (&m);
+    ret = kalu_alpm_load (conffile, &error);
+    measure_end (&m, "kalu_alpm_load", ret, error);
+    if (!ret)
+    {
+        g_clear_error (&error);
+        return 1;
+    }
+
+    measure_begin (&m);
+    ret = kalu_alpm_has_updates (&packages, &error);
+    measure_end (&m, "kalu_alpm_has_updates", ret, error);
+    g_clear_error (&error);
+    alpm_list_free_inner (packages, (alpm_list_fn_free) free_kalu_package);
+    alpm_list_free (packages);
+    packages = NULL;
+
+    measure_begin (&m);
+    ret = kalu_alpm_has_updates_watched (&packages, watched, &error);
+    measure_end (&m, "kalu_alpm_has_updates_watched", ret, error);
+    g_clear_error (&error);
+    alpm_list_free_inner (packages, (alpm_list_fn_free) free_kalu_package);
+    alpm_list_free (packages);
+    packages = NULL;
+
+    measure_begin (&m);
+    ret = kalu_alpm_has_foreign (&packages, NULL, &error);
+    measure_end (&m, "kalu_alpm_has_foreign", ret, error);
+    g_clear_error (&error);
+    alpm_list_free_inner (packages, (alpm_list_fn_free) free_w_pkg);
+    alpm_list_free (packages);
+
+    kalu_alpm_free ();
+    return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+    GError          *error      = NULL;
+    GOptionContext  *context;
+    gint             nb_watched = 50;
+    gint             nb_foreign = 100;
+    gboolean         keep       = FALSE;
+    gint             nb_tpl     = 0;
+    const gchar     *default_sizes[] = { "1000", "10000", "100000" };
+    const gchar    **sizes;
+    gint             nb_sizes;
+    gint             ret        = 0;
+    gint             i;
+    GOptionEntry     options[] = {
+        { "watched",    'w', 0, G_OPTION_ARG_INT, &nb_watched,
+            "Number of watched packages (default: 50)", "M" },
+        { "foreign",    'f', 0, G_OPTION_ARG_INT, &nb_foreign,
+            "Number of foreign packages (default: 100)", "K" },
+        { "keep",       'k', 0, G_OPTION_ARG_NONE, &keep,
+            "Don't remove the generated files", NULL },
+        { "templates",  't', 0, G_OPTION_ARG_INT, &nb_tpl,
+            "Time rendering notifications for N upgrades instead", "N" },
+        { NULL }
+    };
+
+    context = g_option_context_new ("[N...] - benchmark kalu's libalpm checks");
+    g_option_context_add_main_entries (context, options, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+        fprintf (stderr, "option parsing failed: %s\n", error->message);
+        g_option_context_free (context);
+        return 1;
+    }
+    g_option_context_free (context);
+
+    config = new0 (config_t, 1);
+    stats_check_begin ();
+
+    if (nb_tpl > 0)
+    {
+        bench_templates (nb_tpl, 100);
+        free (config);
+        return 0;
+    }
+
+    if (argc > 1)
+    {
+        sizes = (const gchar **) argv + 1;
+        nb_sizes = argc - 1;
+    }
+    else
+    {
+        sizes = default_sizes;
+        nb_sizes = (gint) G_N_ELEMENTS (default_sizes);
+    }
+
+    for (i = 0; i < nb_sizes; ++i)
+    {
+        alpm_list_t *watched = NULL;
+        gchar       *folder;
+        gint         nb_pkgs;
+        gint64       start;
+        pid_t        pid;
+
+        nb_pkgs = atoi (sizes[i]);
+        if (nb_pkgs <= 0)
+        {
+            fprintf (stderr, "Invalid number of packages: %s\n", sizes[i]);
+            ret = 1;
+            continue;
+        }
+
+        folder = g_dir_make_tmp ("kalu-bench-XXXXXX", &error);
+        if (!folder)
+        {
+            fprintf (stderr, "%s\n", error->message);
+            g_clear_error (&error);
+            ret = 1;
+            break;
+        }
+
+        start = g_get_monotonic_time ();
+        if (!generate (folder, nb_pkgs, nb_watched, nb_foreign, &watched,
+                    &error))
+        {
+            fprintf (stderr, "Failed to generate databases: %s\n",
+                    error->message);
+            g_clear_error (&error);
+            ret = 1;
+        }
+        else
+        {
+            printf ("\n%d packages (%d upgrades), %d watched, %d foreign "
+                    "-- generated in %.2f ms (%s)\n",
+                    nb_pkgs, (nb_pkgs + 9) / 10, nb_watched, nb_foreign,
+                    (gdouble) (g_get_monotonic_time () - start) / 1000.0,
+                    folder);
+            printf ("%-32s %12s %12s %14s\n",
+                    "function", "wall (ms)", "cpu (ms)", "peak RSS (KiB)");
+            fflush (stdout);
+
+            pid = fork ();
+            if (pid == 0)
+            {
+                int r = run (folder, watched);
+
+                /* _exit doesn't flush stdio, e.g. when piped into tee */
+                fflush (stdout);
+                _exit (r);
+            }
+            else if (pid > 0)
+            {
+                int status;
+
+                waitpid (pid, &status, 0);
+                if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+                {
+                    ret = 1;
+                }
+            }
+            else
+            {
+                fprintf (stderr, "Unable to fork: %s\n", strerror (errno));
+                ret = 1;
+            }
+        }
+
+        alpm_list_free_inner (watched, (alpm_list_fn_free) free_w_pkg);
+        alpm_list_free (watched);
+        if (!keep)
+        {
+            rmrf (folder);
+        }
+        g_free (folder);
+    }
+
+    free (config);
+    return ret;
+}
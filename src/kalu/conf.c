@@ -237,6 +237,7 @@ parse_pacman_conf (const char       *file,
     {
         *pacconf = new0 (pacman_config_t, 1);
         (*pacconf)->siglevel = ALPM_SIG_USE_DEFAULT;
+        (*pacconf)->paralleldownloads = 1;
     }
     pacman_config_t *pac_conf = *pacconf;
     /* the db/repo we're currently parsing, if any */
@@ -498,6 +499,26 @@ parse_pacman_conf (const char       *file,
                     pac_conf->usedelta = ratio;
                     debug ("config: usedelta=%f", ratio);
                 }
+                else if (streq (key, "ParallelDownloads"))
+                {
+                    char *end;
+                    long nb = strtol (value, &end, 10);
+                    if (*end != '\0' || nb < 1)
+                    {
+                        set_error ("config file %s, line %d: invalid number of parallel downloads: %s",
+                                file, linenum, value);
+                        success = FALSE;
+                        goto cleanup;
+                    }
+                    if (nb > 100)
+                    {
+                        debug ("config file %s, line %d: too many parallel downloads (%s), using 100",
+                                file, linenum, value);
+                        nb = 100;
+                    }
+                    pac_conf->paralleldownloads = (int) nb;
+                    debug ("config: paralleldownloads=%d", (int) nb);
+                }
                 /* we silently ignore "unrecognized" options, since we don't
                  * parse all of pacman's options anyways... */
             }
@@ -822,6 +843,23 @@ parse_config_file (const char       *file,
 
                     debug ("config: interval: %d", config->interval);
                 }
+                else if (streq (key, "IntervalMin")
+                        || streq (key, "IntervalMax"))
+                {
+                    int *interval = (streq (key, "IntervalMin"))
+                        ? &config->interval_min
+                        : &config->interval_max;
+
+                    *interval = atoi (value);
+                    if (*interval <= 0)
+                    {
+                        *interval = 0;
+                        add_error ("invalid value for %s: %s", key, value);
+                        continue;
+                    }
+                    *interval *= 60; /* minutes into seconds */
+                    debug ("config: %s: %d", key, *interval);
+                }
                 else if (streq (key, "Timeout"))
                 {
                     if (streq (value, "DEFAULT"))
@@ -1159,6 +1197,84 @@ parse_config_file (const char       *file,
                         continue;
                     }
                 }
+                else if (streq (key, "SharedCache"))
+                {
+                    setstringoption (value, "sharedcache", &(config->shared_cache));
+                }
+                else if (streq (key, "SharedCacheMaxAge"))
+                {
+                    config->shared_cache_max_age = atoi (value);
+                    if (config->shared_cache_max_age <= 0)
+                    {
+                        config->shared_cache_max_age = 7200;
+                        add_error ("invalid value for %s: %s", key, value);
+                        continue;
+                    }
+                    config->shared_cache_max_age *= 60; /* minutes into seconds */
+                    debug ("config: %s: %d", key, config->shared_cache_max_age);
+                }
+                else if (streq (key, "PrometheusFile"))
+                {
+                    setstringoption (value, "prometheusfile", &(config->prom_file));
+                }
+                else if (streq (key, "MirrorProbe"))
+                {
+                    if (value[0] == '0' && value[1] == '\0')
+                    {
+                        config->mirror_probe = FALSE;
+                        debug ("config: disable mirror probe");
+                    }
+                    else if (value[0] == '1' && value[1] == '\0')
+                    {
+                        config->mirror_probe = TRUE;
+                        debug ("config: enable mirror probe");
+                    }
+                    else
+                    {
+                        add_error ("unknown value for %s: %s", key, value);
+                        continue;
+                    }
+                }
+                else if (streq (key, "UpdaterIdleTimeout"))
+                {
+                    config->updater_idle_timeout = atoi (value);
+                    if (config->updater_idle_timeout < 0)
+                    {
+                        config->updater_idle_timeout = 120;
+                        add_error ("invalid value for %s: %s", key, value);
+                        continue;
+                    }
+                    debug ("config: %s: %d", key, config->updater_idle_timeout);
+                }
+                else if (streq (key, "Prefetch"))
+                {
+                    if (value[0] == '0' && value[1] == '\0')
+                    {
+                        config->prefetch = FALSE;
+                        debug ("config: disable prefetch");
+                    }
+                    else if (value[0] == '1' && value[1] == '\0')
+                    {
+                        config->prefetch = TRUE;
+                        debug ("config: enable prefetch");
+                    }
+                    else
+                    {
+                        add_error ("unknown value for %s: %s", key, value);
+                        continue;
+                    }
+                }
+                else if (streq (key, "PrefetchRate"))
+                {
+                    config->prefetch_rate = atoi (value);
+                    if (config->prefetch_rate < 0)
+                    {
+                        config->prefetch_rate = 0;
+                        add_error ("invalid value for %s: %s", key, value);
+                        continue;
+                    }
+                    debug ("config: %s: %d", key, config->prefetch_rate);
+                }
                 else
                 {
                     add_error ("unknown option: %s", key);
@@ -59,6 +59,7 @@ typedef struct _pacman_config_t {
     int              checkspace;
     int              usesyslog;
     double           usedelta;
+    int              paralleldownloads;
     alpm_list_t     *ignorepkgs;
     alpm_list_t     *ignoregroups;
     alpm_list_t     *noupgrades;
@@ -23,7 +23,12 @@
 #include <config.h>
 
 /* C */
+#include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
 
 /* curl */
 #include <curl/curl.h>
@@ -32,6 +37,10 @@
 #include "kalu.h"
 #include "curl.h"
 
+/* total of bytes downloaded, see curl_done() */
+static guint64 downloaded = 0;
+G_LOCK_DEFINE_STATIC (downloaded);
+
 /* struct to hold data downloaded via curl */
 typedef struct _string_t {
     char   *content;
@@ -58,15 +67,27 @@ curl_write (void *content, size_t size, size_t nmemb, string_t *data)
     return total;
 }
 
-char *
-curl_download (const char *url, GError **error)
+/* returning non-zero aborts the transfer. This is called at least once per
+ * second, even when no data is transferred */
+#if LIBCURL_VERSION_NUM >= 0x072000
+static int
+curl_xferinfo (cancel_t *cancel,
+               curl_off_t dltotal _UNUSED_, curl_off_t dlnow _UNUSED_,
+               curl_off_t ultotal _UNUSED_, curl_off_t ulnow _UNUSED_)
+#else
+static int
+curl_progress (cancel_t *cancel,
+               double dltotal _UNUSED_, double dlnow _UNUSED_,
+               double ultotal _UNUSED_, double ulnow _UNUSED_)
+#endif
 {
-    CURL *curl;
-    string_t data;
-    char errmsg[CURL_ERROR_SIZE];
+    return cancel_is_cancelled (cancel);
+}
 
-    debug ("downloading %s", url);
-    zero (data);
+static CURL *
+new_curl (const char *url, cancel_t *cancel, char *errmsg, GError **error)
+{
+    CURL *curl;
 
     curl = curl_easy_init();
     if (!curl)
@@ -78,9 +99,23 @@ curl_download (const char *url, GError **error)
     curl_easy_setopt (curl, CURLOPT_USERAGENT, PACKAGE_NAME "/" PACKAGE_VERSION);
     curl_easy_setopt (curl, CURLOPT_URL, url);
     curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1);
-    curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 1);
-    curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, (curl_write_callback) curl_write);
-    curl_easy_setopt (curl, CURLOPT_WRITEDATA, (void *) &data);
+    if (cancel)
+    {
+        curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 0);
+#if LIBCURL_VERSION_NUM >= 0x072000
+        curl_easy_setopt (curl, CURLOPT_XFERINFOFUNCTION, curl_xferinfo);
+        curl_easy_setopt (curl, CURLOPT_XFERINFODATA, (void *) cancel);
+#else
+        curl_easy_setopt (curl, CURLOPT_PROGRESSFUNCTION, curl_progress);
+        curl_easy_setopt (curl, CURLOPT_PROGRESSDATA, (void *) cancel);
+#endif
+    }
+    else
+    {
+        curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 1);
+    }
+    /* we might be running from multiple threads at once */
+    curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1);
     curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, errmsg);
     if (config->use_ip == IPv4)
     {
@@ -93,17 +128,82 @@ curl_download (const char *url, GError **error)
         curl_easy_setopt (curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V6);
     }
 
-    if (curl_easy_perform (curl) != 0)
+    return curl;
+}
+
+static void
+set_curl_error (CURLcode code, const char *errmsg, GError **error)
+{
+    if (code == CURLE_ABORTED_BY_CALLBACK)
     {
-        curl_easy_cleanup (curl);
+        g_set_error (error, KALU_ERROR, 1, _("Operation cancelled"));
+    }
+    else
+    {
+        g_set_error (error, KALU_ERROR, 1, "%s", errmsg);
+    }
+}
+
+/* accounts for what was downloaded, and cleans up */
+static void
+curl_done (CURL *curl)
+{
+    double size = 0;
+
+    if (curl_easy_getinfo (curl, CURLINFO_SIZE_DOWNLOAD, &size) == CURLE_OK
+            && size > 0)
+    {
+        G_LOCK (downloaded);
+        downloaded += (guint64) size;
+        G_UNLOCK (downloaded);
+    }
+    curl_easy_cleanup (curl);
+}
+
+/* returns the total of bytes downloaded so far */
+guint64
+curl_get_downloaded (void)
+{
+    guint64 total;
+
+    G_LOCK (downloaded);
+    total = downloaded;
+    G_UNLOCK (downloaded);
+    return total;
+}
+
+/* cancel (can be NULL) is checked during the transfer, to abort it */
+char *
+curl_download (const char *url, cancel_t *cancel, GError **error)
+{
+    CURL *curl;
+    CURLcode code;
+    string_t data;
+    char errmsg[CURL_ERROR_SIZE];
+
+    debug ("downloading %s", url);
+    zero (data);
+
+    curl = new_curl (url, cancel, errmsg, error);
+    if (!curl)
+    {
+        return NULL;
+    }
+    curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, (curl_write_callback) curl_write);
+    curl_easy_setopt (curl, CURLOPT_WRITEDATA, (void *) &data);
+
+    code = curl_easy_perform (curl);
+    if (code != 0)
+    {
+        curl_done (curl);
         if (data.content != NULL)
         {
             free (data.content);
         }
-        g_set_error (error, KALU_ERROR, 1, "%s", errmsg);
+        set_curl_error (code, errmsg, error);
         return NULL;
     }
-    curl_easy_cleanup (curl);
+    curl_done (curl);
     debug ("downloaded %d bytes", data.len);
 
     /* content is not NULL-terminated yet */
@@ -111,3 +211,97 @@ curl_download (const char *url, GError **error)
 
     return data.content;
 }
+
+/* downloads url into folder, as a file named after the url's basename (used
+ * as libalpm's fetch callback). Unless force, nothing is downloaded if the
+ * file there is up to date.
+ * Returns 0 when downloaded, 1 if up to date, -1 on error */
+int
+curl_download_file (const char *url, const char *folder, gboolean force,
+                    cancel_t *cancel, GError **error)
+{
+    CURL *curl;
+    CURLcode code;
+    FILE *fp;
+    struct stat st;
+    gchar *file;
+    gchar *part;
+    const char *name;
+    long unmet = 0;
+    long filetime = -1;
+    int ret = -1;
+    char errmsg[CURL_ERROR_SIZE];
+
+    name = strrchr (url, '/');
+    name = (name) ? name + 1 : url;
+    file = g_build_filename (folder, name, NULL);
+    part = g_strconcat (file, ".part", NULL);
+    debug ("downloading %s to %s", url, file);
+
+    curl = new_curl (url, cancel, errmsg, error);
+    if (!curl)
+    {
+        goto cleanup;
+    }
+
+    fp = fopen (part, "wb");
+    if (!fp)
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to open %s: %s"),
+                part, strerror (errno));
+        curl_easy_cleanup (curl);
+        goto cleanup;
+    }
+
+    if (!force && stat (file, &st) == 0)
+    {
+        curl_easy_setopt (curl, CURLOPT_TIMECONDITION, CURL_TIMECOND_IFMODSINCE);
+        curl_easy_setopt (curl, CURLOPT_TIMEVALUE, (long) st.st_mtime);
+    }
+    curl_easy_setopt (curl, CURLOPT_FAILONERROR, 1);
+    curl_easy_setopt (curl, CURLOPT_FILETIME, 1);
+    curl_easy_setopt (curl, CURLOPT_WRITEDATA, (void *) fp);
+
+    code = curl_easy_perform (curl);
+    fclose (fp);
+    if (code != 0)
+    {
+        set_curl_error (code, errmsg, error);
+        curl_done (curl);
+        unlink (part);
+        goto cleanup;
+    }
+    curl_easy_getinfo (curl, CURLINFO_CONDITION_UNMET, &unmet);
+    curl_easy_getinfo (curl, CURLINFO_FILETIME, &filetime);
+    curl_done (curl);
+
+    if (unmet)
+    {
+        debug ("%s is up to date", file);
+        unlink (part);
+        ret = 1;
+        goto cleanup;
+    }
+
+    if (filetime >= 0)
+    {
+        struct timeval tv[2];
+
+        tv[0].tv_sec = tv[1].tv_sec = (time_t) filetime;
+        tv[0].tv_usec = tv[1].tv_usec = 0;
+        utimes (part, tv);
+    }
+    if (rename (part, file) < 0)
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to rename %s: %s"),
+                part, strerror (errno));
+        unlink (part);
+        goto cleanup;
+    }
+    ret = 0;
+
+cleanup:
+    g_free (file);
+    g_free (part);
+    return ret;
+}
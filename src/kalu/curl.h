@@ -26,7 +26,17 @@
 /* glib */
 #include <glib-2.0/glib.h>
 
+/* kalu */
+#include "executor.h"
+
 char *
-curl_download (const char *url, GError **error);
+curl_download (const char *url, cancel_t *cancel, GError **error);
+
+int
+curl_download_file (const char *url, const char *folder, gboolean force,
+                    cancel_t *cancel, GError **error);
+
+guint64
+curl_get_downloaded (void);
 
 #endif /* _KALU_CURL_H */
@@ -0,0 +1,359 @@
+/**
+ * kalu - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * daemon.c
+ * Copyright (C) 2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+
+#include <config.h>
+
+/* C */
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* glib */
+#include <glib-2.0/glib.h>
+#include <glib-unix.h>
+
+/* kalu */
+#include "kalu.h"
+#include "daemon.h"
+#include "kalu-alpm.h"
+#include "rt_timeout.h"
+#include "util.h"
+#include "executor.h"
+
+static GMainLoop   *loop            = NULL;
+static FILE        *output          = NULL; /* log file (else stdout) */
+static int          sock            = -1;   /* local socket (datagrams) */
+static gboolean     is_paused       = FALSE;
+static gboolean     is_checking     = FALSE;
+static gboolean     is_quitting     = FALSE;
+static skip_next_t  skip_next       = SKIP_UNKNOWN;
+static guint        timeout         = 0;
+static guint        timeout_skip    = 0;
+
+static gboolean auto_check (gpointer data);
+
+/* set where reports are sent: if path is a socket, each report is sent as a
+ * datagram; else it's a log file, reports appended with a timestamp. NULL
+ * means back to stdout */
+gboolean
+daemon_set_output (const gchar *path, GError **error)
+{
+    struct stat filestat;
+
+    if (output != NULL)
+    {
+        fclose (output);
+        output = NULL;
+    }
+    if (sock >= 0)
+    {
+        close (sock);
+        sock = -1;
+    }
+
+    if (path == NULL)
+    {
+        return TRUE;
+    }
+
+    if (0 == stat (path, &filestat) && S_ISSOCK (filestat.st_mode))
+    {
+        struct sockaddr_un addr;
+
+        if (strlen (path) >= sizeof (addr.sun_path))
+        {
+            g_set_error (error, KALU_ERROR, 1, _("Path too long: %s"), path);
+            return FALSE;
+        }
+        zero (addr);
+        addr.sun_family = AF_UNIX;
+        strcpy (addr.sun_path, path);
+
+        sock = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (sock < 0 || 0 != connect (sock, (struct sockaddr *) &addr,
+                    sizeof (addr)))
+        {
+            g_set_error (error, KALU_ERROR, 1,
+                    _("Unable to connect to socket %s: %s"),
+                    path, strerror (errno));
+            if (sock >= 0)
+            {
+                close (sock);
+                sock = -1;
+            }
+            return FALSE;
+        }
+        debug ("reporting to socket %s", path);
+        return TRUE;
+    }
+
+    output = fopen (path, "a");
+    if (output == NULL)
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to open %s: %s"),
+                path, strerror (errno));
+        return FALSE;
+    }
+    debug ("reporting to file %s", path);
+    return TRUE;
+}
+
+void
+daemon_report (const gchar *summary, const gchar *text, gboolean is_error)
+{
+    if (sock >= 0)
+    {
+        gchar *s;
+
+        s = g_strdup_printf ("%s\n%s", summary, (text) ? text : "");
+        if (send (sock, s, strlen (s), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+        {
+            debug ("failed to send report: %s", strerror (errno));
+        }
+        g_free (s);
+    }
+    else if (output != NULL)
+    {
+        time_t    now;
+        struct tm tm;
+        char      buf[20];
+
+        now = time (NULL);
+        localtime_r (&now, &tm);
+        strftime (buf, 20, "%Y-%m-%d %H:%M:%S", &tm);
+        fprintf (output, "[%s] %s\n", buf, summary);
+        if (text)
+        {
+            fprintf (output, "%s\n", text);
+        }
+        fflush (output);
+    }
+    else
+    {
+        FILE *f = (is_error) ? stderr : stdout;
+
+        fprintf (f, "%s\n", summary);
+        if (text)
+        {
+            fprintf (f, "%s\n", text);
+        }
+        fflush (f);
+    }
+}
+
+static void
+set_pause (gboolean paused)
+{
+    if (is_paused == paused && (paused || timeout > 0))
+    {
+        return;
+    }
+
+    is_paused = paused;
+    if (paused)
+    {
+        debug ("pausing: disable next auto-checks");
+        if (timeout > 0)
+        {
+            g_source_remove (timeout);
+            timeout = 0;
+        }
+        if (is_checking)
+        {
+            debug ("pausing: cancel check in progress");
+            executor_cancel_all (JOB_CHECK);
+        }
+    }
+    else
+    {
+        debug ("resuming: starting auto-checks");
+        auto_check (NULL);
+    }
+}
+
+/* back in the main loop, once the check is over */
+static gboolean
+check_done (gpointer data _UNUSED_)
+{
+    is_checking = FALSE;
+
+    if (is_quitting)
+    {
+        g_main_loop_quit (loop);
+    }
+    else if (!is_paused && timeout == 0)
+    {
+        guint seconds;
+
+        seconds = get_interval ();
+        timeout = rt_timeout_add_seconds (seconds, auto_check, NULL);
+        debug ("next auto-checks in %d seconds", seconds);
+    }
+    return FALSE;
+}
+
+static void
+check_job (gpointer data _UNUSED_, cancel_t *cancel)
+{
+    kalu_check_work (TRUE, cancel);
+    g_main_context_invoke (NULL, check_done, NULL);
+}
+
+/* checks run from the executor, so signals (pause/quit) are still processed
+ * meanwhile, and can cancel it */
+static gboolean
+auto_check (gpointer data _UNUSED_)
+{
+    GError *error = NULL;
+
+    /* we might have been called directly, i.e. not from the timeout */
+    if (timeout > 0)
+    {
+        g_source_remove (timeout);
+        timeout = 0;
+    }
+
+    if (is_checking)
+    {
+        return FALSE;
+    }
+    is_checking = TRUE;
+
+    if (!executor_run (JOB_CHECK, check_job, NULL, NULL, &error))
+    {
+        debug ("unable to queue check, running it now: %s", error->message);
+        g_clear_error (&error);
+        kalu_check_work (TRUE, NULL);
+        check_done (NULL);
+    }
+    return FALSE;
+}
+
+/* same as skip_next_timeout() in gui.c, minus everything GUI */
+static gboolean
+skip_next_timeout (gpointer data _UNUSED_)
+{
+    gboolean paused;
+    gint hour, minute;
+    guint seconds;
+
+    timeout_skip = 0;
+
+    /* first time we're called, determine where we're at */
+    if (skip_next == SKIP_UNKNOWN)
+    {
+        if (!config->has_skip)
+        {
+            debug ("skip period: none set");
+            /* we should still trigger auto-checks */
+            set_pause (FALSE);
+            return FALSE;
+        }
+        skip_next = (is_within_skip ()) ? SKIP_BEGIN : SKIP_END;
+    }
+
+    /* toggle state */
+    paused = (skip_next == SKIP_BEGIN);
+    debug ("skip period: auto-%s", (paused) ? "pausing" : "resuming");
+    set_pause (paused);
+
+    /* set new timeout_skip */
+    if (paused)
+    {
+        skip_next = SKIP_END;
+        hour = config->skip_end_hour;
+        minute = config->skip_end_minute;
+    }
+    else
+    {
+        skip_next = SKIP_BEGIN;
+        hour = config->skip_begin_hour;
+        minute = config->skip_begin_minute;
+    }
+
+    seconds = get_seconds_until (hour, minute);
+    timeout_skip = rt_timeout_add_seconds (seconds, skip_next_timeout, NULL);
+    debug ("next skip period in %d seconds", seconds);
+    return FALSE;
+}
+
+static gboolean
+quit_cb (gpointer data _UNUSED_)
+{
+    debug ("signal received, exiting");
+    if (is_checking)
+    {
+        /* we'll quit once the check is over, i.e. as soon as it noticed */
+        is_quitting = TRUE;
+        executor_cancel_all (JOB_CHECK);
+    }
+    else
+    {
+        g_main_loop_quit (loop);
+    }
+    return TRUE;
+}
+
+/* runs auto-checks every interval (honoring the skip period) until we get a
+ * SIGINT/SIGTERM. Config, curl, and the local copy of dbs (see
+ * kalu_alpm_set_keep_cache) all stay around between checks. */
+void
+daemon_run (void)
+{
+    debug ("starting daemon");
+    kalu_alpm_set_keep_cache (TRUE);
+
+    loop = g_main_loop_new (NULL, FALSE);
+    g_unix_signal_add (SIGINT, quit_cb, NULL);
+    g_unix_signal_add (SIGTERM, quit_cb, NULL);
+#ifdef ENABLE_ALLOC_STATS
+    g_unix_signal_add (SIGUSR1, dump_alloc_stats, NULL);
+#endif
+
+    /* takes care of setting timeout_skip (if needed) and also triggers the
+     * auto-checks (unless within skip period) */
+    skip_next_timeout (NULL);
+
+    g_main_loop_run (loop);
+
+    if (timeout > 0)
+    {
+        g_source_remove (timeout);
+        timeout = 0;
+    }
+    if (timeout_skip > 0)
+    {
+        g_source_remove (timeout_skip);
+        timeout_skip = 0;
+    }
+    g_main_loop_unref (loop);
+    loop = NULL;
+
+    kalu_alpm_set_keep_cache (FALSE);
+    debug ("daemon stopped");
+}
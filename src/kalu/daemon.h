@@ -0,0 +1,39 @@
+/**
+ * kalu - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * daemon.h
+ * Copyright (C) 2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _KALU_DAEMON_H
+#define _KALU_DAEMON_H
+
+/* glib */
+#include <glib-2.0/glib.h>
+
+gboolean
+daemon_set_output (const gchar *path, GError **error);
+
+void
+daemon_report (const gchar *summary, const gchar *text, gboolean is_error);
+
+void
+daemon_run (void);
+
+#endif /* _KALU_DAEMON_H */
@@ -0,0 +1,252 @@
+/**
+ * kalu - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * executor.c
+ * Copyright (C) 2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+
+#include <config.h>
+
+/* glib */
+#include <glib-2.0/glib.h>
+
+/* kalu */
+#include "kalu.h"
+#include "executor.h"
+
+typedef struct _job_t {
+    job_type_t   type;
+    job_fn       func;
+    gpointer     data;
+    cancel_t    *cancel;
+} job_t;
+
+/* each type of jobs gets its own pool & limit, so e.g. command lines (which
+ * can run for a long time) can't take all threads away from checks, which
+ * themselves wait on their stages */
+typedef struct _job_type_info_t {
+    const gchar *name;
+    gint         max_threads;
+    GThreadPool *pool;
+    GSList      *jobs;      /* queued & running, for executor_cancel_all */
+    guint        queued;
+    guint        running;
+    guint        done;
+} job_type_info_t;
+
+static job_type_info_t job_types[NB_JOB_TYPES] = {
+    { "check",      1, NULL, NULL, 0, 0, 0 },
+    { "stage",      3, NULL, NULL, 0, 0, 0 },
+    { "cmdline",    2, NULL, NULL, 0, 0, 0 },
+};
+
+static GMutex mutex;
+/* set by executor_free, no more jobs (nor pools) after that */
+static gboolean is_shut_down = FALSE;
+
+cancel_t *
+cancel_new (void)
+{
+    cancel_t *cancel;
+
+    cancel = new0 (cancel_t, 1);
+    cancel->ref = 1;
+    return cancel;
+}
+
+cancel_t *
+cancel_ref (cancel_t *cancel)
+{
+    g_atomic_int_inc (&cancel->ref);
+    return cancel;
+}
+
+void
+cancel_unref (cancel_t *cancel)
+{
+    if (cancel && g_atomic_int_dec_and_test (&cancel->ref))
+    {
+        free (cancel);
+    }
+}
+
+void
+cancel_cancel (cancel_t *cancel)
+{
+    if (cancel)
+    {
+        g_atomic_int_set (&cancel->is_cancelled, 1);
+    }
+}
+
+gboolean
+cancel_is_cancelled (cancel_t *cancel)
+{
+    return cancel && g_atomic_int_get (&cancel->is_cancelled);
+}
+
+static void
+run_job (job_t *job, job_type_info_t *info)
+{
+    g_mutex_lock (&mutex);
+    --info->queued;
+    ++info->running;
+    g_mutex_unlock (&mutex);
+
+    /* func is always called, even if cancelled already, since it owns data;
+     * it's up to it to check cancel and return early */
+    if (cancel_is_cancelled (job->cancel))
+    {
+        debug ("executor: running cancelled %s job", info->name);
+    }
+    job->func (job->data, job->cancel);
+
+    g_mutex_lock (&mutex);
+    --info->running;
+    ++info->done;
+    info->jobs = g_slist_remove (info->jobs, job);
+    g_mutex_unlock (&mutex);
+
+    cancel_unref (job->cancel);
+    free (job);
+}
+
+/* runs func (data, cancel) from a thread of the pool for jobs of type. cancel
+ * can be NULL, one is then created (and can be cancelled through
+ * executor_cancel_all) */
+gboolean
+executor_run (job_type_t type, job_fn func, gpointer data, cancel_t *cancel,
+              GError **error)
+{
+    job_type_info_t *info = &job_types[type];
+    GError          *local_err = NULL;
+    job_t           *job;
+
+    g_mutex_lock (&mutex);
+    if (is_shut_down)
+    {
+        g_mutex_unlock (&mutex);
+        g_set_error (error, KALU_ERROR, 1, _("Shutting down"));
+        return FALSE;
+    }
+    if (info->pool == NULL)
+    {
+        info->pool = g_thread_pool_new ((GFunc) run_job, info,
+                info->max_threads, FALSE, &local_err);
+        if (info->pool == NULL)
+        {
+            g_mutex_unlock (&mutex);
+            g_propagate_error (error, local_err);
+            return FALSE;
+        }
+    }
+
+    job = new0 (job_t, 1);
+    job->type = type;
+    job->func = func;
+    job->data = data;
+    job->cancel = (cancel) ? cancel_ref (cancel) : cancel_new ();
+
+    info->jobs = g_slist_prepend (info->jobs, job);
+    ++info->queued;
+    debug ("executor: queuing %s job (queued=%u; running=%u)",
+            info->name, info->queued, info->running);
+    g_mutex_unlock (&mutex);
+
+    /* even on error (failed to start a new thread) the job remains queued,
+     * for an existing thread to process */
+    if (!g_thread_pool_push (info->pool, job, &local_err))
+    {
+        debug ("executor: unable to start new thread for %s job: %s",
+                info->name, local_err->message);
+        g_clear_error (&local_err);
+    }
+    return TRUE;
+}
+
+void
+executor_cancel_all (job_type_t type)
+{
+    GSList *l;
+
+    g_mutex_lock (&mutex);
+    for (l = job_types[type].jobs; l; l = l->next)
+    {
+        cancel_cancel (((job_t *) l->data)->cancel);
+    }
+    g_mutex_unlock (&mutex);
+}
+
+void
+executor_get_stats (job_type_t type, guint *queued, guint *running,
+                    guint *done)
+{
+    g_mutex_lock (&mutex);
+    if (queued)
+    {
+        *queued = job_types[type].queued;
+    }
+    if (running)
+    {
+        *running = job_types[type].running;
+    }
+    if (done)
+    {
+        *done = job_types[type].done;
+    }
+    g_mutex_unlock (&mutex);
+}
+
+/* cancels everything, waits for running jobs to end, and drops what's still
+ * queued -- such jobs are still run (cancelled, so they must return right
+ * away) from here, since they own their data. Afterwards, executor_run fails */
+void
+executor_free (void)
+{
+    int i;
+
+    g_mutex_lock (&mutex);
+    is_shut_down = TRUE;
+    g_mutex_unlock (&mutex);
+
+    for (i = 0; i < NB_JOB_TYPES; ++i)
+    {
+        executor_cancel_all ((job_type_t) i);
+    }
+
+    for (i = 0; i < NB_JOB_TYPES; ++i)
+    {
+        job_type_info_t *info = &job_types[i];
+
+        if (info->pool == NULL)
+        {
+            continue;
+        }
+        debug ("executor: %s jobs: %u done, %u running, %u dropped",
+                info->name, info->done, info->running, info->queued);
+        g_thread_pool_free (info->pool, TRUE, TRUE);
+        info->pool = NULL;
+
+        /* no more threads, only dropped jobs are left */
+        while (info->jobs)
+        {
+            run_job (info->jobs->data, info);
+        }
+    }
+}
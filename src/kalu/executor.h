@@ -0,0 +1,74 @@
+/**
+ * kalu - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * executor.h
+ * Copyright (C) 2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _KALU_EXECUTOR_H
+#define _KALU_EXECUTOR_H
+
+/* glib */
+#include <glib-2.0/glib.h>
+
+typedef enum {
+    JOB_CHECK = 0,  /* kalu_check_work */
+    JOB_STAGE,      /* stages of a check, see main.c */
+    JOB_CMDLINE,    /* external command lines (upgrades) */
+    NB_JOB_TYPES
+} job_type_t;
+
+/* cancellation token, shared between who runs a job & the job itself */
+typedef struct _cancel_t {
+    gint    ref;
+    gint    is_cancelled;
+} cancel_t;
+
+typedef void (*job_fn) (gpointer data, cancel_t *cancel);
+
+cancel_t *
+cancel_new (void);
+
+cancel_t *
+cancel_ref (cancel_t *cancel);
+
+void
+cancel_unref (cancel_t *cancel);
+
+void
+cancel_cancel (cancel_t *cancel);
+
+gboolean
+cancel_is_cancelled (cancel_t *cancel);
+
+gboolean
+executor_run (job_type_t type, job_fn func, gpointer data, cancel_t *cancel,
+              GError **error);
+
+void
+executor_cancel_all (job_type_t type);
+
+void
+executor_get_stats (job_type_t type, guint *queued, guint *running,
+                    guint *done);
+
+void
+executor_free (void);
+
+#endif /* _KALU_EXECUTOR_H */
@@ -22,6 +22,10 @@
 
 #include <config.h>
 
+/* tag debug() messages & allocations */
+#define DEBUG_SUBSYS    SUBSYS_GUI
+#define ALLOC_TAG       "gui"
+
 /* kalu */
 #include "kalu.h"
 #include "gui.h"
@@ -31,6 +35,9 @@
 #include "conf.h"
 #include "news.h"
 #include "rt_timeout.h"
+#include "util.h"
+#include "executor.h"
+#include "stats.h"
 #ifndef DISABLE_UPDATER
 #include "kalu-updater.h"
 #include "updater.h"
@@ -50,6 +57,9 @@ static gboolean set_status_icon (gboolean active);
 
 extern kalpm_state_t kalpm_state;
 
+/* quit was asked while a check was running, see menu_quit_cb */
+static gboolean is_quitting = FALSE;
+
 
 void
 free_notif (notif_t *notif)
@@ -182,10 +192,20 @@ show_error_cmdline (gchar *arg[])
 }
 
 static void
-run_cmdline (char *cmdline)
+run_cmdline (char *cmdline, cancel_t *cancel)
 {
     GError *error = NULL;
 
+    /* dropped on exit */
+    if (cancel_is_cancelled (cancel))
+    {
+        if (cmdline != config->cmdline && cmdline != config->cmdline_aur)
+        {
+            free (cmdline);
+        }
+        return;
+    }
+
     set_kalpm_busy (TRUE);
     debug ("run cmdline: %s", cmdline);
     if (!g_spawn_command_line_sync (cmdline, NULL, NULL, NULL, &error))
@@ -215,6 +235,22 @@ run_cmdline (char *cmdline)
     }
 }
 
+static void
+queue_cmdline (char *cmdline)
+{
+    GError *error = NULL;
+
+    if (!executor_run (JOB_CMDLINE, (job_fn) run_cmdline, cmdline, NULL, &error))
+    {
+        show_error (_("Unable to run command line"), error->message, NULL);
+        g_clear_error (&error);
+        if (cmdline != config->cmdline && cmdline != config->cmdline_aur)
+        {
+            free (cmdline);
+        }
+    }
+}
+
 void
 action_upgrade (NotifyNotification *notification, const char *action, gchar *_cmdline)
 {
@@ -251,10 +287,7 @@ action_upgrade (NotifyNotification *notification, const char *action, gchar *_cm
     if (cmdline)
     {
         /* run in a separate thread, to not block/make GUI unresponsive */
-        g_thread_unref (g_thread_try_new ("action_upgrade",
-                    (GThreadFunc) run_cmdline,
-                    (gpointer) cmdline,
-                    NULL));
+        queue_cmdline (cmdline);
     }
 }
 
@@ -416,9 +449,17 @@ is_pacman_conflicting (alpm_list_t *packages)
     return ret;
 }
 
+static void
+check_job (gpointer is_auto, cancel_t *cancel)
+{
+    kalu_check_work (GPOINTER_TO_INT (is_auto), cancel);
+}
+
 inline void
 kalu_check (gboolean is_auto)
 {
+    GError *error = NULL;
+
     /* in case e.g. the menu was shown (sensitive) before an auto-check started */
     if (kalpm_state.is_busy)
     {
@@ -427,10 +468,14 @@ kalu_check (gboolean is_auto)
     set_kalpm_busy (TRUE);
 
     /* run in a separate thread, to not block/make GUI unresponsive */
-    g_thread_unref (g_thread_try_new ("kalu_check_work",
-                (GThreadFunc) kalu_check_work,
-                GINT_TO_POINTER (is_auto),
-                NULL));
+    if (!executor_run (JOB_CHECK, (job_fn) check_job, GINT_TO_POINTER (is_auto),
+                NULL, &error))
+    {
+        /* might be called from run_cmdline, i.e. not the GUI thread */
+        debug ("unable to start checking for upgrades: %s", error->message);
+        g_clear_error (&error);
+        set_kalpm_busy (FALSE);
+    }
 }
 
 void
@@ -469,14 +514,34 @@ show_last_notifs (void)
     }
 }
 
+/* whether the only thing keeping us busy is a check, which can be cancelled */
+static gboolean
+is_busy_checking (void)
+{
+    guint queued, running;
+
+    executor_get_stats (JOB_CHECK, &queued, &running, NULL);
+    return kalpm_state.is_busy == 1 && queued + running > 0;
+}
+
 static void
 set_pause (gboolean paused)
 {
-    /* in case e.g. the menu was shown (sensitive) before an auto-check started */
-    if (kalpm_state.is_busy || kalpm_state.is_paused == paused)
+    if (kalpm_state.is_paused == paused)
     {
         return;
     }
+    if (kalpm_state.is_busy)
+    {
+        /* a check in progress gets cancelled, but we can't resume while busy
+         * (e.g. the menu was shown (sensitive) before an auto-check started) */
+        if (!paused || !is_busy_checking ())
+        {
+            return;
+        }
+        debug ("pausing: cancel check in progress");
+        executor_cancel_all (JOB_CHECK);
+    }
 
     kalpm_state.is_paused = paused;
     if (paused)
@@ -520,9 +585,18 @@ menu_pause_cb (GtkMenuItem *item _UNUSED_, gpointer data _UNUSED_)
 static void
 menu_quit_cb (GtkMenuItem *item _UNUSED_, gpointer data _UNUSED_)
 {
-    /* in case e.g. the menu was shown (sensitive) before an auto-check started */
     if (kalpm_state.is_busy)
     {
+        /* a check in progress gets cancelled, and we'll quit once it's over
+         * (see set_kalpm_busy) */
+        if (is_busy_checking ())
+        {
+            debug ("quitting: cancel check in progress");
+            is_quitting = TRUE;
+            executor_cancel_all (JOB_CHECK);
+        }
+        /* in case e.g. the menu was shown (sensitive) before an auto-check
+         * started */
         return;
     }
     gtk_main_quit ();
@@ -552,10 +626,7 @@ kalu_sysupgrade (void)
     {
 #endif
         /* run in a separate thread, to not block/make GUI unresponsive */
-        g_thread_unref (g_thread_try_new ("cmd_sysupgrade",
-                    (GThreadFunc) run_cmdline,
-                    (gpointer) config->cmdline,
-                    NULL));
+        queue_cmdline (config->cmdline);
 #ifndef DISABLE_UPDATER
     }
 #endif
@@ -620,6 +691,7 @@ menu_about_cb (GtkMenuItem *item _UNUSED_, gpointer data _UNUSED_)
     GtkAboutDialog  *about;
     GInputStream    *stream;
     GdkPixbuf       *pixbuf;
+    gchar           *s;
     const char *authors[] = {
         "Olivier Brunel", "Dave Gamble", "Pacman Development Team",
         NULL };
@@ -638,7 +710,20 @@ menu_about_cb (GtkMenuItem *item _UNUSED_, gpointer data _UNUSED_)
 
     gtk_about_dialog_set_program_name (about, PACKAGE_NAME);
     gtk_about_dialog_set_version (about, PACKAGE_VERSION);
-    gtk_about_dialog_set_comments (about, PACKAGE_TAG);
+    /* timings of the last checks, if any */
+    s = stats_report ();
+    if (s)
+    {
+        gchar *comments = g_strconcat (PACKAGE_TAG "\n\n", s, NULL);
+
+        gtk_about_dialog_set_comments (about, comments);
+        g_free (comments);
+        g_free (s);
+    }
+    else
+    {
+        gtk_about_dialog_set_comments (about, PACKAGE_TAG);
+    }
     gtk_about_dialog_set_website (about, "http://jjacky.com/kalu");
     gtk_about_dialog_set_website_label (about, "http://jjacky.com/kalu");
     gtk_about_dialog_set_copyright (about, "Copyright (C) 2012-2013 Olivier Brunel");
@@ -686,7 +771,9 @@ icon_popup_cb (GtkStatusIcon *_icon _UNUSED_, guint button, guint activate_time,
     item = gtk_image_menu_item_new_with_label ((kalpm_state.is_paused)
             ? _c("systray-menu", "Resume automatic checks")
             : _c("systray-menu", "Pause automatic checks"));
-    gtk_widget_set_sensitive (item, !kalpm_state.is_busy);
+    /* a check in progress can be cancelled to pause */
+    gtk_widget_set_sensitive (item, !kalpm_state.is_busy
+            || (!kalpm_state.is_paused && is_busy_checking ()));
     image = gtk_image_new_from_stock ((kalpm_state.is_paused)
             ? GTK_STOCK_MEDIA_PLAY
             : GTK_STOCK_MEDIA_PAUSE,
@@ -813,7 +900,7 @@ icon_popup_cb (GtkStatusIcon *_icon _UNUSED_, guint button, guint activate_time,
     gtk_menu_attach (GTK_MENU (menu), item, 0, 1, pos, pos + 1); ++pos;
 
     item = gtk_image_menu_item_new_from_stock (GTK_STOCK_QUIT, NULL);
-    gtk_widget_set_sensitive (item, !kalpm_state.is_busy);
+    gtk_widget_set_sensitive (item, !kalpm_state.is_busy || is_busy_checking ());
     gtk_widget_set_tooltip_text (item, _("Exit kalu"));
     g_signal_connect (G_OBJECT (item), "activate",
             G_CALLBACK (menu_quit_cb), NULL);
@@ -1179,6 +1266,13 @@ switch_status_icon (void)
     return TRUE;
 }
 
+static gboolean
+quit_cb (gpointer data _UNUSED_)
+{
+    gtk_main_quit ();
+    return FALSE;
+}
+
 void
 set_kalpm_busy (gboolean busy)
 {
@@ -1220,6 +1314,13 @@ set_kalpm_busy (gboolean busy)
     }
     else
     {
+        if (is_quitting)
+        {
+            debug ("state non-busy: quitting");
+            g_main_context_invoke (NULL, (GSourceFunc) quit_cb, NULL);
+            return;
+        }
+
         /* remove status icon timeout */
         if (kalpm_state.timeout_icon > 0)
         {
@@ -1235,7 +1336,7 @@ set_kalpm_busy (gboolean busy)
             /* set timeout for next auto-check */
             guint seconds;
 
-            seconds = (guint) config->interval;
+            seconds = get_interval ();
             kalpm_state.timeout = rt_timeout_add_seconds (seconds,
                     (GSourceFunc) kalu_auto_check, NULL);
             debug ("state non-busy: next auto-checks in %d seconds", seconds);
@@ -1263,57 +1364,12 @@ reset_timeout (void)
     }
 
     /* set timeout for next auto-check */
-    seconds = (guint) config->interval;
+    seconds = get_interval ();
     kalpm_state.timeout = rt_timeout_add_seconds (seconds,
             (GSourceFunc) kalu_auto_check, NULL);
     debug ("reset timeout: next auto-checks in %d seconds", seconds);
 }
 
-static inline gboolean
-is_within_skip (void)
-{
-    if (!config->has_skip)
-    {
-        return FALSE;
-    }
-
-    GDateTime *now, *begin, *end;
-    gint year, month, day;
-    gboolean within_skip = FALSE;
-
-    now = g_date_time_new_now_local ();
-    /* create GDateTime for begin & end of skip period */
-    /* Note: begin & end are both for the current day, which means we can
-     * have begin > end, with e.g. 18:00-09:00 */
-    g_date_time_get_ymd (now, &year, &month, &day);
-    begin = g_date_time_new_local (year, month, day,
-            config->skip_begin_hour, config->skip_begin_minute, 0);
-    end = g_date_time_new_local (year, month, day,
-            config->skip_end_hour, config->skip_end_minute, 0);
-
-    /* determine if we're within skip period */
-    /* is begin > end ? e.g. 18:00 -> 09:00 */
-    if (g_date_time_compare (begin, end) == 1)
-    {
-        /* we're within if before end OR after begin */
-        within_skip = (g_date_time_compare (now, end) == -1
-                || g_date_time_compare (now, begin) == 1);
-    }
-    /* e.g. 09:00 -> 18:00 */
-    else
-    {
-        /* we're within if after begin AND before end */
-        within_skip = (g_date_time_compare (now, begin) == 1
-                && g_date_time_compare (now, end) == -1);
-    }
-
-    g_date_time_unref (now);
-    g_date_time_unref (begin);
-    g_date_time_unref (end);
-
-    return within_skip;
-}
-
 void
 skip_next_timeout (void)
 {
@@ -1362,9 +1418,8 @@ skip_next_timeout (void)
     }
 
     /* set new timeout_skip */
-    GDateTime *now, *next;
-    gint year, month, day, h;
     gint hour, minute;
+    guint seconds;
 
     if (paused)
     {
@@ -1379,27 +1434,10 @@ skip_next_timeout (void)
         minute = config->skip_begin_minute;
     }
 
-    now = g_date_time_new_now_local ();
-    g_date_time_get_ymd (now, &year, &month, &day);
-    /* if the timeout is for a time before now, it gets bumped to tomorrow */
-    h = g_date_time_get_hour (now);
-    if (h > hour || (h == hour && g_date_time_get_minute (now) > minute))
-    {
-        ++day;
-    }
-    next = g_date_time_new_local (year, month, day, hour, minute, 0);
-
-    GTimeSpan timespan;
-    guint seconds;
-
-    timespan = g_date_time_difference (next, now);
-    seconds = (guint) (timespan / G_TIME_SPAN_SECOND);
+    seconds = get_seconds_until (hour, minute);
     kalpm_state.timeout_skip = rt_timeout_add_seconds (seconds,
             (GSourceFunc) skip_next_timeout, NULL);
     debug ("next skip period in %d seconds", seconds);
-
-    g_date_time_unref (now);
-    g_date_time_unref (next);
 }
 
 gboolean
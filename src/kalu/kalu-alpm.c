@@ -22,11 +22,17 @@
 
 #include <config.h>
 
+/* tag debug() messages & allocations */
+#define DEBUG_SUBSYS    SUBSYS_ALPM
+#define ALLOC_TAG       "alpm"
+
 /* C */
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/file.h>   /* flock */
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -44,6 +50,8 @@
 #include "kalu-alpm.h"
 #include "util.h"
 #include "conf.h"
+#include "curl.h"
+#include "stats.h"
 
 /* global variable */
 unsigned short alpm_verbose;
@@ -51,9 +59,42 @@ unsigned short alpm_verbose;
 
 static kalu_alpm_t *alpm;
 
+/* when keeping cache (daemon), the tmp dbpath & parsed pacman.conf are kept
+ * between checks, so we don't have to copy all dbs/parse it every time */
+static gboolean         keep_cache      = FALSE;
+static gchar           *cached_dbpath   = NULL;
+static pacman_config_t *cached_conf     = NULL;
+static time_t           cached_conf_mtime;
+static gboolean         is_dbpath_reused = FALSE;
+
+/* mirror probe: when keeping cache, we remember the "lastupdate" file of the
+ * mirror (first server) of each db, as of our last sync. If none changed,
+ * there's no need to sync dbs again. */
+typedef struct _mirror_t {
+    char    *url;       /* URL of the lastupdate file */
+    char    *last;      /* its content as of last successful sync */
+    char    *pending;   /* its content as of the probe */
+} mirror_t;
+
+static alpm_list_t     *mirrors         = NULL;
+static gboolean         can_probe       = FALSE;
+
+/* libalpm's fetch callback has no user data, so this is the token of the
+ * kalu_alpm_syncdbs in progress (there's only one handle at a time) */
+static cancel_t        *fetch_cancel    = NULL;
+
+/* shared cache (see kalu_alpm_cache_sync): when our copy of the dbs comes from
+ * a fresh shared cache, there's no need to sync them */
+static gboolean         is_shared_cache_used = FALSE;
+static gint             nb_shared_synced = 0;
+
 static gboolean copy_file (const gchar *from, const gchar *to);
-static gboolean create_local_db (const gchar *dbpath, gchar **newpath,
+static gboolean copy_sync_dbs (const gchar *dbpath, const gchar *folder,
+        gboolean only_newer, const gchar *refpath, gint *nb_copied,
         GError **error);
+static gboolean create_local_db (const gchar *dbpath, const gchar *syncpath,
+        gchar **newpath, gint *nb_copied, GError **error);
+static void add_mirrors (pacman_config_t *pac_conf);
 
 
 
@@ -83,56 +124,45 @@ copy_file (const gchar *from, const gchar *to)
     return TRUE;
 }
 
+/* whether both files have the same content */
 static gboolean
-create_local_db (const gchar *_dbpath, gchar **newpath, GError **error)
+is_same_content (const gchar *file1, const gchar *file2)
 {
-    gchar    buf[MAX_PATH];
-    gchar    buf2[MAX_PATH];
-    gchar   *dbpath;
-    size_t   l;
-    gchar   *folder;
-    GDir    *dir;
+    struct stat st1, st2;
+    gchar *c1, *c2;
+    gsize  l1, l2;
+    gboolean ret;
 
-    debug ("creating local db");
-
-    /* create folder in tmp dir */
-    if (NULL == (folder = g_dir_make_tmp ("kalu-XXXXXX", NULL)))
+    if (0 != stat (file1, &st1) || 0 != stat (file2, &st2)
+            || st1.st_size != st2.st_size)
     {
-        g_set_error (error, KALU_ERROR, 1, _("Unable to create temp folder"));
         return FALSE;
     }
-    debug ("created tmp folder %s", folder);
-
-    /* dbpath will not be slash-terminated */
-    dbpath = strdup (_dbpath);
-    l = strlen (dbpath) - 1;
-    if (dbpath[l] == '/')
+    if (!g_file_get_contents (file1, &c1, &l1, NULL))
     {
-        dbpath[l] = '\0';
+        return FALSE;
     }
-
-    /* symlink local */
-    snprintf (buf, MAX_PATH - 1, "%s/local", dbpath);
-    snprintf (buf2, MAX_PATH - 1, "%s/local", folder);
-    if (0 != symlink (buf, buf2))
+    if (!g_file_get_contents (file2, &c2, &l2, NULL))
     {
-        g_set_error (error, KALU_ERROR, 1,
-                _("Unable to create symlink %s"),
-                buf2);
-        goto error;
+        g_free (c1);
+        return FALSE;
     }
-    debug ("created symlink %s", buf2);
+    ret = (l1 == l2 && 0 == memcmp (c1, c2, l1));
+    g_free (c1);
+    g_free (c2);
+    return ret;
+}
 
-    /* copy databases in sync */
-    snprintf (buf, MAX_PATH - 1, "%s/sync", folder);
-    if (0 != mkdir (buf, 0700))
-    {
-        g_set_error (error, KALU_ERROR, 1,
-                _("Unable to create folder %s"),
-                buf);
-        goto error;
-    }
-    debug ("created folder %s", buf);
+/* nb_copied (if not NULL) is set to the nb of dbs (not other files, e.g.
+ * signatures) copied whose content changed, compared to the copy in folder if
+ * any, else to the one in refpath (if not NULL) */
+static gboolean
+copy_sync_dbs (const gchar *dbpath, const gchar *folder, gboolean only_newer,
+        const gchar *refpath, gint *nb_copied, GError **error)
+{
+    gchar    buf[MAX_PATH];
+    gchar    buf2[MAX_PATH];
+    GDir    *dir;
 
     snprintf (buf, MAX_PATH - 1, "%s/sync", dbpath);
     if (NULL == (dir = g_dir_open (buf, 0, NULL)))
@@ -140,13 +170,19 @@ create_local_db (const gchar *_dbpath, gchar **newpath, GError **error)
         g_set_error (error, KALU_ERROR, 1,
                 _("Unable to open folder %s"),
                 buf);
-        goto error;
+        return FALSE;
     }
 
     const gchar    *file;
     struct stat     filestat;
+    struct stat     copystat;
     struct utimbuf  times;
+    gboolean        has_changed;
 
+    if (nb_copied)
+    {
+        *nb_copied = 0;
+    }
     while ((file = g_dir_read_name (dir)))
     {
         snprintf (buf, MAX_PATH - 1, "%s/sync/%s", dbpath, file);
@@ -157,13 +193,39 @@ create_local_db (const gchar *_dbpath, gchar **newpath, GError **error)
             if (S_ISREG (filestat.st_mode))
             {
                 snprintf (buf2, MAX_PATH - 1, "%s/sync/%s", folder, file);
+                /* is our copy still up to date? (it might even be newer) */
+                if (only_newer && 0 == stat (buf2, &copystat)
+                        && copystat.st_mtime >= filestat.st_mtime)
+                {
+                    debug ("%s is up to date", buf2);
+                    continue;
+                }
+                has_changed = TRUE;
+                if (nb_copied && g_str_has_suffix (file, ".db"))
+                {
+                    if (0 == stat (buf2, &copystat))
+                    {
+                        has_changed = !is_same_content (buf, buf2);
+                    }
+                    else if (refpath)
+                    {
+                        gchar ref[MAX_PATH];
+
+                        snprintf (ref, MAX_PATH - 1, "%s/sync/%s", refpath, file);
+                        has_changed = !is_same_content (buf, ref);
+                    }
+                }
                 if (!copy_file (buf, buf2))
                 {
                     g_set_error (error, KALU_ERROR, 1,
                             _("Copy failed for %s"),
                             buf);
                     g_dir_close (dir);
-                    goto error;
+                    return FALSE;
+                }
+                if (nb_copied && has_changed && g_str_has_suffix (file, ".db"))
+                {
+                    ++*nb_copied;
                 }
                 /* preserve time */
                 times.actime = filestat.st_atime;
@@ -187,10 +249,70 @@ create_local_db (const gchar *_dbpath, gchar **newpath, GError **error)
         {
             g_set_error (error, KALU_ERROR, 1, _("Unable to stat %s\n"), buf);
             g_dir_close (dir);
-            goto error;
+            return FALSE;
         }
     }
     g_dir_close (dir);
+    return TRUE;
+}
+
+/* local is a symlink to the one in _dbpath, sync dbs are copied from
+ * syncpath (i.e. _dbpath, or the shared cache) */
+static gboolean
+create_local_db (const gchar *_dbpath, const gchar *syncpath, gchar **newpath,
+        gint *nb_copied, GError **error)
+{
+    gchar    buf[MAX_PATH];
+    gchar    buf2[MAX_PATH];
+    gchar   *dbpath;
+    size_t   l;
+    gchar   *folder;
+
+    debug ("creating local db");
+
+    /* create folder in tmp dir */
+    if (NULL == (folder = g_dir_make_tmp ("kalu-XXXXXX", NULL)))
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to create temp folder"));
+        return FALSE;
+    }
+    debug ("created tmp folder %s", folder);
+
+    /* dbpath will not be slash-terminated */
+    dbpath = strdup (_dbpath);
+    l = strlen (dbpath) - 1;
+    if (dbpath[l] == '/')
+    {
+        dbpath[l] = '\0';
+    }
+
+    /* symlink local */
+    snprintf (buf, MAX_PATH - 1, "%s/local", dbpath);
+    snprintf (buf2, MAX_PATH - 1, "%s/local", folder);
+    if (0 != symlink (buf, buf2))
+    {
+        g_set_error (error, KALU_ERROR, 1,
+                _("Unable to create symlink %s"),
+                buf2);
+        goto error;
+    }
+    debug ("created symlink %s", buf2);
+
+    /* copy databases in sync */
+    snprintf (buf, MAX_PATH - 1, "%s/sync", folder);
+    if (0 != mkdir (buf, 0700))
+    {
+        g_set_error (error, KALU_ERROR, 1,
+                _("Unable to create folder %s"),
+                buf);
+        goto error;
+    }
+    debug ("created folder %s", buf);
+
+    if (!copy_sync_dbs (syncpath, folder, FALSE, dbpath, nb_copied, error))
+    {
+        goto error;
+    }
     free (dbpath);
 
     *newpath = folder;
@@ -202,85 +324,243 @@ error:
     return FALSE;
 }
 
+/* frees pac_conf, making sure it isn't kept in cache */
 static void
-log_cb (alpm_loglevel_t level, const char *fmt, va_list args)
+release_pacman_config (pacman_config_t *pac_conf)
 {
-    gchar *s;
-    gsize l;
+    if (pac_conf == cached_conf)
+    {
+        cached_conf = NULL;
+    }
+    free_pacman_config (pac_conf);
+}
 
+static void
+log_cb (alpm_loglevel_t level, const char *fmt, va_list args)
+{
     if (!fmt || *fmt == '\0')
     {
         return;
     }
 
-    if (config->is_debug == 2 && (level & (ALPM_LOG_DEBUG | ALPM_LOG_FUNCTION)))
+    /* level 2 for alpm's messages, 3 to include its debug ones */
+    if (!log_enabled (SUBSYS_ALPM,
+                (level & (ALPM_LOG_DEBUG | ALPM_LOG_FUNCTION)) ? 3 : 2))
     {
         return;
     }
 
-    s = g_strdup_vprintf (fmt, args);
-    l = strlen (s);
-    if (s[--l] == '\n')
-        s[l] = '\0';
+    log_vmsg (SUBSYS_ALPM, fmt, args);
+}
 
-    debug ("ALPM: %s", s);
-    g_free (s);
+/* returns the URL of server (from pacman.conf) for db dbname */
+static char *
+get_server_url (const char *value, const char *dbname, const char *arch,
+        GError **error)
+{
+    /* let's attempt a replacement for the current repo */
+    char *temp = strreplace (value, "$repo", dbname);
+    char *server;
+
+    /* let's attempt a replacement for the arch */
+    if (arch)
+    {
+        server = strreplace (temp, "$arch", arch);
+        free (temp);
+    }
+    else
+    {
+        if (strstr (temp, "$arch"))
+        {
+            g_set_error (error, KALU_ERROR, 1,
+                    _("Server %s contains the $arch variable, "
+                        "but no Architecture was defined"),
+                    value);
+            free (temp);
+            return NULL;
+        }
+        server = temp;
+    }
+    return server;
+}
+
+static void
+set_options (pacman_config_t *pac_conf)
+{
+    /* set arch & some options (what to ignore during update) */
+    alpm_option_set_arch (alpm->handle, pac_conf->arch);
+    alpm_option_set_ignorepkgs (alpm->handle, pac_conf->ignorepkgs);
+    alpm_option_set_ignoregroups (alpm->handle, pac_conf->ignoregroups);
+    /* cachedirs are used when determining download size */
+    alpm_option_set_cachedirs (alpm->handle, pac_conf->cachedirs);
+
+    if (log_enabled (SUBSYS_ALPM, 2))
+        alpm_option_set_logcb (alpm->handle, log_cb);
+}
+
+/* if the shared cache is usable (exists, isn't being synced & isn't stale)
+ * returns TRUE and sets fd to its lock, held (shared) until closed */
+static gboolean
+open_shared_cache (int *fd)
+{
+    gchar    buf[MAX_PATH];
+    gchar   *contents;
+    time_t   synced;
+
+    snprintf (buf, MAX_PATH - 1, "%s/lock", config->shared_cache);
+    *fd = open (buf, O_RDONLY | O_CLOEXEC);
+    if (*fd < 0)
+    {
+        debug ("shared cache: cannot open %s: %s", buf, strerror (errno));
+        return FALSE;
+    }
+    /* don't wait on a sync in progress, we'll just do without */
+    if (flock (*fd, LOCK_SH | LOCK_NB) < 0)
+    {
+        debug ("shared cache: unavailable (%s)", strerror (errno));
+        goto err;
+    }
+
+    snprintf (buf, MAX_PATH - 1, "%s/lastsync", config->shared_cache);
+    if (!g_file_get_contents (buf, &contents, NULL, NULL))
+    {
+        debug ("shared cache: no %s", buf);
+        goto err;
+    }
+    synced = (time_t) g_ascii_strtoll (contents, NULL, 10);
+    g_free (contents);
+    if (time (NULL) - synced > config->shared_cache_max_age)
+    {
+        debug ("shared cache: stale, last synced %ld", (long) synced);
+        goto err;
+    }
+
+    debug ("shared cache: using %s (last synced %ld)", config->shared_cache,
+            (long) synced);
+    return TRUE;
+
+err:
+    close (*fd);
+    *fd = -1;
+    return FALSE;
 }
 
 gboolean
 kalu_alpm_load (const gchar *conffile, GError **error)
 {
     GError             *local_err = NULL;
-    gchar              *newpath;
+    gchar              *newpath = NULL;
     enum _alpm_errno_t  err;
     pacman_config_t    *pac_conf = NULL;
+    struct stat         filestat;
+    const gchar        *syncpath;
+    int                 lock_fd = -1;
+    gint                nb_copied = 0;
+    gint64              start;
 
-    /* parse pacman.conf */
-    debug ("parsing pacman.conf (%s) for options", conffile);
-    if (!parse_pacman_conf (conffile, NULL, 0, 0, &pac_conf, &local_err))
+    if (0 != stat (conffile, &filestat))
     {
-        g_propagate_error (error, local_err);
-        free_pacman_config (pac_conf);
-        return FALSE;
+        filestat.st_mtime = 0;
+    }
+    if (cached_conf != NULL && filestat.st_mtime == cached_conf_mtime)
+    {
+        debug ("using cached pacman.conf (%s)", conffile);
+        pac_conf = cached_conf;
+    }
+    else
+    {
+        /* parse pacman.conf */
+        debug ("parsing pacman.conf (%s) for options", conffile);
+        if (!parse_pacman_conf (conffile, NULL, 0, 0, &pac_conf, &local_err))
+        {
+            g_propagate_error (error, local_err);
+            free_pacman_config (pac_conf);
+            return FALSE;
+        }
+        /* things (e.g. dbpath) might have changed, drop everything cached */
+        kalu_alpm_drop_cache ();
+        cached_conf_mtime = filestat.st_mtime;
     }
 
     debug ("setting up libalpm");
     alpm = new0 (kalu_alpm_t, 1);
 
-    /* create tmp copy of db (so we can sync w/out being root) */
-    if (!create_local_db (pac_conf->dbpath, &newpath, &local_err))
+    /* use the shared cache if there's a fresh one, else the system dbs */
+    syncpath = pac_conf->dbpath;
+    is_shared_cache_used = FALSE;
+    if (config->shared_cache && open_shared_cache (&lock_fd))
+    {
+        syncpath = config->shared_cache;
+    }
+
+    /* create tmp copy of db (so we can sync w/out being root), or update the
+     * one we kept */
+    start = stats_now ();
+    is_dbpath_reused = FALSE;
+    if (cached_dbpath != NULL)
+    {
+        gchar *dbpath = cached_dbpath;
+
+        cached_dbpath = NULL;
+        debug ("updating local db %s", dbpath);
+        if (copy_sync_dbs (syncpath, dbpath, TRUE, pac_conf->dbpath,
+                    (lock_fd >= 0) ? &nb_copied : NULL, &local_err))
+        {
+            newpath = dbpath;
+            is_dbpath_reused = TRUE;
+        }
+        else
+        {
+            debug ("failed to update local db: %s", local_err->message);
+            g_clear_error (&local_err);
+            rmrf (dbpath);
+            free (dbpath);
+        }
+    }
+    if (newpath == NULL && !create_local_db (pac_conf->dbpath, syncpath,
+                &newpath, (lock_fd >= 0) ? &nb_copied : NULL, &local_err))
     {
+        if (lock_fd >= 0)
+        {
+            close (lock_fd);
+        }
         g_set_error (error, KALU_ERROR, 1,
                 _("Unable to create local copy of database: %s"),
                 local_err->message);
         g_clear_error (&local_err);
-        free_pacman_config (pac_conf);
+        release_pacman_config (pac_conf);
         kalu_alpm_free ();
         return FALSE;
     }
     alpm->dbpath = newpath;
+    if (lock_fd >= 0)
+    {
+        /* releases the lock */
+        close (lock_fd);
+        is_shared_cache_used = TRUE;
+        nb_shared_synced = nb_copied;
+    }
+    stats_add ("alpm: copy dbs", start);
 
     /* init libalpm */
+    start = stats_now ();
     alpm->handle = alpm_initialize (pac_conf->rootdir, alpm->dbpath, &err);
     if (alpm->handle == NULL)
     {
         g_set_error (error, KALU_ERROR, 1,
                 _("Failed to initialize alpm library: %s"),
                 alpm_strerror (err));
-        free_pacman_config (pac_conf);
+        release_pacman_config (pac_conf);
         kalu_alpm_free ();
         return FALSE;
     }
 
-    /* set arch & some options (what to ignore during update) */
-    alpm_option_set_arch (alpm->handle, pac_conf->arch);
-    alpm_option_set_ignorepkgs (alpm->handle, pac_conf->ignorepkgs);
-    alpm_option_set_ignoregroups (alpm->handle, pac_conf->ignoregroups);
-    /* cachedirs are used when determining download size */
-    alpm_option_set_cachedirs (alpm->handle, pac_conf->cachedirs);
+    set_options (pac_conf);
 
-    if (config->is_debug > 1)
-        alpm_option_set_logcb (alpm->handle, log_cb);
+    if (keep_cache)
+    {
+        add_mirrors (pac_conf);
+    }
 
     /* now we need to add dbs */
     alpm_list_t *i;
@@ -289,6 +569,20 @@ kalu_alpm_load (const gchar *conffile, GError **error)
         database_t  *db_conf = i->data;
         alpm_db_t   *db;
 
+        /* a db not in the shared cache means we'll have to sync after all */
+        if (is_shared_cache_used)
+        {
+            gchar buf[MAX_PATH];
+
+            snprintf (buf, MAX_PATH - 1, "%s/sync/%s.db", alpm->dbpath,
+                    db_conf->name);
+            if (0 != access (buf, F_OK))
+            {
+                debug ("shared cache: no %s, will sync dbs", buf);
+                is_shared_cache_used = FALSE;
+            }
+        }
+
         /* register db */
         debug ("register %s", db_conf->name);
         db = alpm_register_syncdb (alpm->handle, db_conf->name,
@@ -298,7 +592,7 @@ kalu_alpm_load (const gchar *conffile, GError **error)
             g_set_error (error, KALU_ERROR, 1,
                     _("Could not register database %s: %s"),
                     db_conf->name, alpm_strerror (alpm_errno (alpm->handle)));
-            free_pacman_config (pac_conf);
+            release_pacman_config (pac_conf);
             kalu_alpm_free ();
             return FALSE;
         }
@@ -309,32 +603,14 @@ kalu_alpm_load (const gchar *conffile, GError **error)
         {
             char        *value  = j->data;
             const char  *dbname = alpm_db_get_name (db);
-            /* let's attempt a replacement for the current repo */
-            char        *temp   = strreplace (value, "$repo", dbname);
-            /* let's attempt a replacement for the arch */
-            const char  *arch   = pac_conf->arch;
             char        *server;
 
-            if (arch)
-            {
-                server = strreplace (temp, "$arch", arch);
-                free (temp);
-            }
-            else
+            server = get_server_url (value, dbname, pac_conf->arch, error);
+            if (server == NULL)
             {
-                if (strstr (temp, "$arch"))
-                {
-                    g_set_error (error, KALU_ERROR, 1,
-                            _("Server %s contains the $arch variable, "
-                                "but no Architecture was defined"),
-                            value);
-                    free (temp);
-                    free (value);
-                    free_pacman_config (pac_conf);
-                    kalu_alpm_free ();
-                    return FALSE;
-                }
-                server = temp;
+                release_pacman_config (pac_conf);
+                kalu_alpm_free ();
+                return FALSE;
             }
 
             debug ("add server %s into %s", server, dbname);
@@ -348,7 +624,7 @@ kalu_alpm_load (const gchar *conffile, GError **error)
                         alpm_strerror (alpm_errno (alpm->handle)));
                 free (server);
                 free (value);
-                free_pacman_config (pac_conf);
+                release_pacman_config (pac_conf);
                 kalu_alpm_free ();
                 return FALSE;
             }
@@ -359,38 +635,227 @@ kalu_alpm_load (const gchar *conffile, GError **error)
 
     /* set global var */
     alpm_verbose = pac_conf->verbosepkglists;
+    stats_add ("alpm: init", start);
 
-    free_pacman_config (pac_conf);
+    if (keep_cache)
+    {
+        cached_conf = pac_conf;
+    }
+    else
+    {
+        free_pacman_config (pac_conf);
+    }
     return TRUE;
 }
 
-gboolean
-kalu_alpm_syncdbs (gint *nb_dbs_synced, GError **error)
+static void
+free_mirror (mirror_t *mirror)
 {
-    alpm_list_t     *sync_dbs   = NULL;
-    alpm_list_t     *i;
-    GError          *local_err  = NULL;
-    int              ret;
+    free (mirror->url);
+    free (mirror->last);
+    free (mirror->pending);
+    free (mirror);
+}
 
-    if (!check_syncdbs (alpm, 1, 0, &local_err))
-    {
-        g_propagate_error (error, local_err);
-        return FALSE;
-    }
+/* lists the mirrors to probe, i.e. the lastupdate file at the root of the
+ * first server of each db; which needs to contain $repo so we can find it */
+static void
+add_mirrors (pacman_config_t *pac_conf)
+{
+    alpm_list_t *i, *j;
 
-    sync_dbs = alpm_get_syncdbs (alpm->handle);
-    *nb_dbs_synced = 0;
-    FOR_LIST (i, sync_dbs)
+    can_probe = TRUE;
+    FOR_LIST (i, pac_conf->databases)
     {
-        alpm_db_t *db = i->data;
+        database_t *db_conf = i->data;
+        const char *server;
+        const char *s;
+        char       *url;
+        gboolean    found = FALSE;
+
+        if (db_conf->servers == NULL
+                || NULL == (s = strstr (db_conf->servers->data, "$repo")))
+        {
+            debug ("mirror probe: unable to probe for %s", db_conf->name);
+            can_probe = FALSE;
+            return;
+        }
+        server = db_conf->servers->data;
 
+        url = new (char, (size_t) (s - server) + strlen ("lastupdate") + 1);
+        memcpy (url, server, (size_t) (s - server));
+        strcpy (url + (s - server), "lastupdate");
+
+        FOR_LIST (j, mirrors)
+        {
+            if (streq (((mirror_t *) j->data)->url, url))
+            {
+                found = TRUE;
+                break;
+            }
+        }
+        if (found)
+        {
+            free (url);
+        }
+        else
+        {
+            mirror_t *mirror;
+
+            mirror = new0 (mirror_t, 1);
+            mirror->url = url;
+            mirrors = alpm_list_add (mirrors, mirror);
+            debug ("mirror probe: added %s", url);
+        }
+    }
+}
+
+/* returns TRUE if any mirror was updated since our last sync (or we can't
+ * tell) */
+static gboolean
+probe_mirrors (cancel_t *cancel)
+{
+    alpm_list_t *i;
+    gboolean     has_changed = FALSE;
+
+    FOR_LIST (i, mirrors)
+    {
+        mirror_t *mirror = i->data;
+        GError   *local_err = NULL;
+
+        free (mirror->pending);
+        mirror->pending = curl_download (mirror->url, cancel, &local_err);
+        if (local_err != NULL)
+        {
+            debug ("mirror probe: failed for %s: %s", mirror->url,
+                    local_err->message);
+            g_clear_error (&local_err);
+            mirror->pending = NULL;
+            has_changed = TRUE;
+            continue;
+        }
+        strtrim (mirror->pending);
+
+        if (mirror->last == NULL || !streq (mirror->last, mirror->pending))
+        {
+            debug ("mirror probe: %s updated (%s)", mirror->url,
+                    mirror->pending);
+            has_changed = TRUE;
+        }
+    }
+
+    return has_changed;
+}
+
+/* dbs were synced, so remember what lastupdate was as of the probe */
+static void
+commit_mirrors (void)
+{
+    alpm_list_t *i;
+
+    FOR_LIST (i, mirrors)
+    {
+        mirror_t *mirror = i->data;
+
+        free (mirror->last);
+        mirror->last = mirror->pending;
+        mirror->pending = NULL;
+    }
+}
+
+/* we download dbs ourself (instead of letting libalpm do it) so downloads can
+ * be aborted when the check is cancelled */
+static int
+fetch_cb (const char *url, const char *localpath, int force)
+{
+    GError *local_err = NULL;
+    int     ret;
+
+    ret = curl_download_file (url, localpath, (gboolean) force, fetch_cancel,
+            &local_err);
+    if (ret < 0)
+    {
+        debug ("failed to download %s: %s", url, local_err->message);
+        g_clear_error (&local_err);
+    }
+    return ret;
+}
+
+gboolean
+kalu_alpm_syncdbs (gint *nb_dbs_synced, cancel_t *cancel, GError **error)
+{
+    alpm_list_t     *sync_dbs   = NULL;
+    alpm_list_t     *i;
+    GError          *local_err  = NULL;
+    int              ret;
+    gboolean         probed     = FALSE;
+    gint64           start;
+    gchar            buf[255];
+
+    if (!check_syncdbs (alpm, 1, 0, &local_err))
+    {
+        g_propagate_error (error, local_err);
+        return FALSE;
+    }
+
+    /* dbs were synced by whoever maintains the shared cache */
+    if (is_shared_cache_used)
+    {
+        debug ("shared cache: skipping sync (%d dbs updated)", nb_shared_synced);
+        *nb_dbs_synced = nb_shared_synced;
+        return TRUE;
+    }
+
+    /* a probe is a single small download per mirror; if no mirror was updated
+     * the dbs we synced last time (kept in our dbpath) are still good */
+    if (keep_cache && can_probe && config->mirror_probe && config->is_curl_init)
+    {
+        gboolean has_changed;
+
+        start = stats_now ();
+        probed = TRUE;
+        has_changed = probe_mirrors (cancel);
+        stats_add ("mirror probe", start);
+        if (!has_changed && is_dbpath_reused)
+        {
+            debug ("mirror probe: no mirror updated, skipping sync");
+            *nb_dbs_synced = 0;
+            return TRUE;
+        }
+    }
+
+    if (config->is_curl_init)
+    {
+        fetch_cancel = cancel;
+        alpm_option_set_fetchcb (alpm->handle, fetch_cb);
+    }
+
+    sync_dbs = alpm_get_syncdbs (alpm->handle);
+    *nb_dbs_synced = 0;
+    FOR_LIST (i, sync_dbs)
+    {
+        alpm_db_t *db = i->data;
+
+        if (cancel_is_cancelled (cancel))
+        {
+            g_set_error (error, KALU_ERROR, 1, _("Operation cancelled"));
+            fetch_cancel = NULL;
+            return FALSE;
+        }
+
+        start = stats_now ();
         ret = alpm_db_update (0, db);
+        snprintf (buf, 255, "sync: %s", alpm_db_get_name (db));
+        stats_add (buf, start);
         if (ret < 0)
         {
             g_set_error (error, KALU_ERROR, 1,
                     _("Failed to update %s: %s"),
                     alpm_db_get_name (db),
-                    alpm_strerror (alpm_errno (alpm->handle)));
+                    (cancel_is_cancelled (cancel))
+                    ? _("Operation cancelled")
+                    : alpm_strerror (alpm_errno (alpm->handle)));
+            fetch_cancel = NULL;
             return FALSE;
         }
         else if (ret == 1)
@@ -404,6 +869,11 @@ kalu_alpm_syncdbs (gint *nb_dbs_synced, GError **error)
         }
     }
 
+    fetch_cancel = NULL;
+    if (probed)
+    {
+        commit_mirrors ();
+    }
     return TRUE;
 }
 
@@ -413,6 +883,8 @@ kalu_alpm_has_updates (alpm_list_t **packages, GError **error)
     alpm_list_t *i;
     alpm_list_t *data       = NULL;
     GError      *local_err  = NULL;
+    gint64       start;
+    int          ret;
 
     if (!check_syncdbs (alpm, 1, 1, &local_err))
     {
@@ -426,6 +898,7 @@ kalu_alpm_has_updates (alpm_list_t **packages, GError **error)
         return FALSE;
     }
 
+    start = stats_now ();
     if (alpm_sync_sysupgrade (alpm->handle, 0) == -1)
     {
         g_set_error (error, KALU_ERROR, 1, "%s",
@@ -433,7 +906,9 @@ kalu_alpm_has_updates (alpm_list_t **packages, GError **error)
         goto cleanup;
     }
 
-    if (alpm_trans_prepare (alpm->handle, &data) == -1)
+    ret = alpm_trans_prepare (alpm->handle, &data);
+    stats_add ("alpm: prepare", start);
+    if (ret == -1)
     {
         int len = 1024;
         gchar buf[255], err[len--];
@@ -639,7 +1114,12 @@ kalu_alpm_has_foreign (alpm_list_t **packages, alpm_list_t *ignore,
         }
         if (!found)
         {
-            *packages = alpm_list_add (*packages, pkg);
+            watched_package_t *w_pkg;
+
+            w_pkg = new0 (watched_package_t, 1);
+            w_pkg->name = strdup (pkgname);
+            w_pkg->version = strdup (alpm_pkg_get_version (pkg));
+            *packages = alpm_list_add (*packages, w_pkg);
         }
     }
 
@@ -659,13 +1139,613 @@ kalu_alpm_free (void)
         alpm_release (alpm->handle);
     }
 
-    /* yes, we remove the dbpath. because we made a tmp copy of it */
-    if (alpm->dbpath)
+    /* yes, we remove the dbpath. because we made a tmp copy of it. Unless
+     * we're keeping it for next time */
+    if (keep_cache && alpm->dbpath)
     {
-        rmrf (alpm->dbpath);
+        debug ("keeping local db %s", alpm->dbpath);
+        cached_dbpath = alpm->dbpath;
+    }
+    else
+    {
+        if (alpm->dbpath)
+        {
+            rmrf (alpm->dbpath);
+        }
+        free (alpm->dbpath);
     }
-    free (alpm->dbpath);
 
     g_free (alpm);
     alpm = NULL;
 }
+
+void
+kalu_alpm_set_keep_cache (gboolean keep)
+{
+    keep_cache = keep;
+    if (!keep)
+    {
+        kalu_alpm_drop_cache ();
+    }
+}
+
+/* the local copy of dbs kept from the last check, if any. The updater can have
+ * kalu-dbus import them, instead of syncing them all over again */
+const gchar *
+kalu_alpm_get_cached_dbpath (void)
+{
+    return cached_dbpath;
+}
+
+void
+kalu_alpm_drop_cache (void)
+{
+    if (cached_dbpath)
+    {
+        debug ("removing cached local db %s", cached_dbpath);
+        rmrf (cached_dbpath);
+        free (cached_dbpath);
+        cached_dbpath = NULL;
+    }
+    if (cached_conf)
+    {
+        free_pacman_config (cached_conf);
+        cached_conf = NULL;
+    }
+    alpm_list_free_inner (mirrors, (alpm_list_fn_free) free_mirror);
+    alpm_list_free (mirrors);
+    mirrors = NULL;
+    can_probe = FALSE;
+}
+
+/* batch mode: each distinct (repo, servers) is synced only once, into a
+ * shared dbpath; each root then gets its own dbpath, with its local db and
+ * symlinks to the shared sync dbs. */
+
+typedef struct _batch_db_t {
+    char            *name;
+    alpm_list_t     *servers;   /* URLs, i.e. $repo & $arch replaced */
+    alpm_siglevel_t  siglevel;
+    const gchar     *dbpath;    /* shared dbpath it is synced into */
+} batch_db_t;
+
+static alpm_list_t *batch_dbs     = NULL;   /* batch_db_t */
+static alpm_list_t *batch_dbpaths = NULL;   /* shared dbpaths */
+
+static gboolean
+servers_equal (alpm_list_t *l1, alpm_list_t *l2)
+{
+    for ( ; l1 && l2; l1 = l1->next, l2 = l2->next)
+    {
+        if (!streq (l1->data, l2->data))
+        {
+            return FALSE;
+        }
+    }
+    return (l1 == NULL && l2 == NULL);
+}
+
+static void
+free_batch_db (batch_db_t *bdb)
+{
+    free (bdb->name);
+    FREELIST (bdb->servers);
+    free (bdb);
+}
+
+/* returns a shared dbpath without any db named name, creating one if needed */
+static const gchar *
+get_batch_dbpath (const char *name, GError **error)
+{
+    alpm_list_t *i, *j;
+    gchar        buf[MAX_PATH];
+    gchar       *folder;
+
+    FOR_LIST (i, batch_dbpaths)
+    {
+        gboolean is_free = TRUE;
+
+        FOR_LIST (j, batch_dbs)
+        {
+            batch_db_t *bdb = j->data;
+
+            if (bdb->dbpath == i->data && streq (bdb->name, name))
+            {
+                is_free = FALSE;
+                break;
+            }
+        }
+        if (is_free)
+        {
+            return i->data;
+        }
+    }
+
+    if (NULL == (folder = g_dir_make_tmp ("kalu-XXXXXX", NULL)))
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to create temp folder"));
+        return NULL;
+    }
+    snprintf (buf, MAX_PATH - 1, "%s/sync", folder);
+    if (0 != mkdir (buf, 0700))
+    {
+        g_set_error (error, KALU_ERROR, 1,
+                _("Unable to create folder %s"),
+                buf);
+        rmrf (folder);
+        g_free (folder);
+        return NULL;
+    }
+    debug ("created shared dbpath %s", folder);
+    batch_dbpaths = alpm_list_add (batch_dbpaths, folder);
+    return folder;
+}
+
+/* seed the shared copy with the root's own db (preserving its mtime), so
+ * there's no download if it's already up to date */
+static void
+seed_batch_db (batch_db_t *bdb, const char *dbpath)
+{
+    gchar           from[MAX_PATH];
+    gchar           to[MAX_PATH];
+    struct stat     filestat;
+    struct utimbuf  times;
+
+    snprintf (from, MAX_PATH - 1, "%s/sync/%s.db", dbpath, bdb->name);
+    snprintf (to, MAX_PATH - 1, "%s/sync/%s.db", bdb->dbpath, bdb->name);
+    if (0 != stat (from, &filestat) || !copy_file (from, to))
+    {
+        return;
+    }
+    times.actime = filestat.st_atime;
+    times.modtime = filestat.st_mtime;
+    if (0 != utime (to, &times))
+    {
+        /* sucks, but no fail, we'll just have to download this db */
+        debug ("Unable to change time of %s", to);
+    }
+}
+
+static batch_db_t *
+add_batch_db (database_t *db_conf, pacman_config_t *pac_conf, GError **error)
+{
+    alpm_list_t *servers = NULL;
+    alpm_list_t *i;
+    batch_db_t  *bdb;
+
+    FOR_LIST (i, db_conf->servers)
+    {
+        char *server;
+
+        server = get_server_url (i->data, db_conf->name, pac_conf->arch, error);
+        if (server == NULL)
+        {
+            FREELIST (servers);
+            return NULL;
+        }
+        servers = alpm_list_add (servers, server);
+    }
+
+    FOR_LIST (i, batch_dbs)
+    {
+        bdb = i->data;
+        if (streq (bdb->name, db_conf->name)
+                && servers_equal (bdb->servers, servers))
+        {
+            FREELIST (servers);
+            return bdb;
+        }
+    }
+
+    bdb = new0 (batch_db_t, 1);
+    bdb->name = strdup (db_conf->name);
+    bdb->servers = servers;
+    bdb->siglevel = db_conf->siglevel;
+    bdb->dbpath = get_batch_dbpath (bdb->name, error);
+    if (bdb->dbpath == NULL)
+    {
+        free_batch_db (bdb);
+        return NULL;
+    }
+    batch_dbs = alpm_list_add (batch_dbs, bdb);
+    seed_batch_db (bdb, pac_conf->dbpath);
+    return bdb;
+}
+
+gboolean
+kalu_alpm_batch_sync (alpm_list_t *roots, gint *nb_dbs_synced, GError **error)
+{
+    GError             *local_err = NULL;
+    alpm_list_t        *i, *j;
+    enum _alpm_errno_t  err;
+
+    *nb_dbs_synced = 0;
+
+    FOR_LIST (i, roots)
+    {
+        batch_root_t *root = i->data;
+
+        debug ("parsing pacman.conf (%s) for options", root->conffile);
+        if (!parse_pacman_conf (root->conffile, NULL, 0, 0, &root->pac_conf,
+                    &local_err))
+        {
+            g_set_error (error, KALU_ERROR, 1, "%s: %s",
+                    root->conffile, local_err->message);
+            g_clear_error (&local_err);
+            return FALSE;
+        }
+        if (root->rootdir)
+        {
+            /* dbpath is then relative to the root */
+            gchar *dbpath;
+
+            dbpath = g_build_filename (root->rootdir, root->pac_conf->dbpath,
+                    NULL);
+            free (root->pac_conf->dbpath);
+            root->pac_conf->dbpath = strdup (dbpath);
+            g_free (dbpath);
+            free (root->pac_conf->rootdir);
+            root->pac_conf->rootdir = strdup (root->rootdir);
+        }
+
+        FOR_LIST (j, root->pac_conf->databases)
+        {
+            batch_db_t *bdb;
+
+            bdb = add_batch_db (j->data, root->pac_conf, error);
+            if (bdb == NULL)
+            {
+                return FALSE;
+            }
+            root->dbs = alpm_list_add (root->dbs, bdb);
+        }
+    }
+    debug ("batch: %d roots, %d distinct dbs in %d dbpaths",
+            (int) alpm_list_count (roots), (int) alpm_list_count (batch_dbs),
+            (int) alpm_list_count (batch_dbpaths));
+
+    /* sync everything, one handle per shared dbpath */
+    FOR_LIST (i, batch_dbpaths)
+    {
+        alpm_handle_t *handle;
+
+        handle = alpm_initialize ("/", i->data, &err);
+        if (handle == NULL)
+        {
+            g_set_error (error, KALU_ERROR, 1,
+                    _("Failed to initialize alpm library: %s"),
+                    alpm_strerror (err));
+            return FALSE;
+        }
+        if (log_enabled (SUBSYS_ALPM, 2))
+        {
+            alpm_option_set_logcb (handle, log_cb);
+        }
+
+        FOR_LIST (j, batch_dbs)
+        {
+            batch_db_t  *bdb = j->data;
+            alpm_db_t   *db;
+            alpm_list_t *k;
+            int          ret;
+
+            if (bdb->dbpath != i->data)
+            {
+                continue;
+            }
+
+            debug ("register %s", bdb->name);
+            db = alpm_register_syncdb (handle, bdb->name, bdb->siglevel);
+            if (db == NULL)
+            {
+                g_set_error (error, KALU_ERROR, 1,
+                        _("Could not register database %s: %s"),
+                        bdb->name, alpm_strerror (alpm_errno (handle)));
+                alpm_release (handle);
+                return FALSE;
+            }
+            FOR_LIST (k, bdb->servers)
+            {
+                debug ("add server %s into %s", (char *) k->data, bdb->name);
+                alpm_db_add_server (db, k->data);
+            }
+
+            ret = alpm_db_update (0, db);
+            if (ret < 0)
+            {
+                g_set_error (error, KALU_ERROR, 1,
+                        _("Failed to update %s: %s"),
+                        bdb->name,
+                        alpm_strerror (alpm_errno (handle)));
+                alpm_release (handle);
+                return FALSE;
+            }
+            else if (ret == 1)
+            {
+                debug ("%s is up to date", bdb->name);
+            }
+            else
+            {
+                ++*nb_dbs_synced;
+                debug ("%s was updated", bdb->name);
+            }
+        }
+
+        alpm_release (handle);
+    }
+
+    return TRUE;
+}
+
+gboolean
+kalu_alpm_batch_load (batch_root_t *root, GError **error)
+{
+    gchar               buf[MAX_PATH];
+    gchar               buf2[MAX_PATH];
+    alpm_list_t        *i;
+    enum _alpm_errno_t  err;
+
+    debug ("setting up libalpm for root %s",
+            (root->rootdir) ? root->rootdir : root->pac_conf->rootdir);
+    alpm = new0 (kalu_alpm_t, 1);
+
+    if (NULL == (alpm->dbpath = g_dir_make_tmp ("kalu-XXXXXX", NULL)))
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to create temp folder"));
+        kalu_alpm_free ();
+        return FALSE;
+    }
+
+    /* symlink local */
+    snprintf (buf, MAX_PATH - 1, "%s/local", root->pac_conf->dbpath);
+    snprintf (buf2, MAX_PATH - 1, "%s/local", alpm->dbpath);
+    if (0 != symlink (buf, buf2))
+    {
+        g_set_error (error, KALU_ERROR, 1,
+                _("Unable to create symlink %s"),
+                buf2);
+        kalu_alpm_free ();
+        return FALSE;
+    }
+
+    /* symlink the shared sync dbs (and their signatures) */
+    snprintf (buf, MAX_PATH - 1, "%s/sync", alpm->dbpath);
+    if (0 != mkdir (buf, 0700))
+    {
+        g_set_error (error, KALU_ERROR, 1,
+                _("Unable to create folder %s"),
+                buf);
+        kalu_alpm_free ();
+        return FALSE;
+    }
+    FOR_LIST (i, root->dbs)
+    {
+        batch_db_t *bdb = i->data;
+        const char *ext[] = { "db", "db.sig" };
+        int         e;
+
+        for (e = 0; e < 2; ++e)
+        {
+            snprintf (buf, MAX_PATH - 1, "%s/sync/%s.%s",
+                    bdb->dbpath, bdb->name, ext[e]);
+            snprintf (buf2, MAX_PATH - 1, "%s/sync/%s.%s",
+                    alpm->dbpath, bdb->name, ext[e]);
+            if (0 == access (buf, F_OK) && 0 != symlink (buf, buf2))
+            {
+                g_set_error (error, KALU_ERROR, 1,
+                        _("Unable to create symlink %s"),
+                        buf2);
+                kalu_alpm_free ();
+                return FALSE;
+            }
+        }
+    }
+
+    alpm->handle = alpm_initialize (root->pac_conf->rootdir, alpm->dbpath, &err);
+    if (alpm->handle == NULL)
+    {
+        g_set_error (error, KALU_ERROR, 1,
+                _("Failed to initialize alpm library: %s"),
+                alpm_strerror (err));
+        kalu_alpm_free ();
+        return FALSE;
+    }
+    set_options (root->pac_conf);
+
+    FOR_LIST (i, root->dbs)
+    {
+        batch_db_t *bdb = i->data;
+
+        debug ("register %s", bdb->name);
+        if (NULL == alpm_register_syncdb (alpm->handle, bdb->name,
+                    bdb->siglevel))
+        {
+            g_set_error (error, KALU_ERROR, 1,
+                    _("Could not register database %s: %s"),
+                    bdb->name, alpm_strerror (alpm_errno (alpm->handle)));
+            kalu_alpm_free ();
+            return FALSE;
+        }
+    }
+
+    /* set global var */
+    alpm_verbose = root->pac_conf->verbosepkglists;
+
+    return TRUE;
+}
+
+void
+kalu_alpm_batch_free (alpm_list_t *roots)
+{
+    alpm_list_t *i;
+
+    FOR_LIST (i, roots)
+    {
+        batch_root_t *root = i->data;
+
+        free_pacman_config (root->pac_conf);
+        root->pac_conf = NULL;
+        alpm_list_free (root->dbs);
+        root->dbs = NULL;
+    }
+
+    alpm_list_free_inner (batch_dbs, (alpm_list_fn_free) free_batch_db);
+    alpm_list_free (batch_dbs);
+    batch_dbs = NULL;
+
+    FOR_LIST (i, batch_dbpaths)
+    {
+        rmrf (i->data);
+    }
+    alpm_list_free_inner (batch_dbpaths, (alpm_list_fn_free) g_free);
+    alpm_list_free (batch_dbpaths);
+    batch_dbpaths = NULL;
+}
+
+/* shared cache: syncs the dbs from conffile into cachedir, so every user's
+ * kalu can use those (see SharedCache) instead of syncing on its own. Meant to
+ * be ran as root (e.g. from a timer), cachedir being then read-only for users.
+ * cachedir/lock is held (exclusive) during the sync, and cachedir/lastsync
+ * gets the time of the last successful one, so users can tell if it's stale */
+gboolean
+kalu_alpm_cache_sync (const gchar *conffile, const gchar *cachedir,
+        gint *nb_dbs_synced, GError **error)
+{
+    GError             *local_err = NULL;
+    pacman_config_t    *pac_conf = NULL;
+    alpm_handle_t      *handle;
+    enum _alpm_errno_t  err;
+    alpm_list_t        *i, *j;
+    gchar               buf[MAX_PATH];
+    gchar              *s;
+    int                 fd;
+    gboolean            ret = FALSE;
+
+    *nb_dbs_synced = 0;
+
+    debug ("parsing pacman.conf (%s) for options", conffile);
+    if (!parse_pacman_conf (conffile, NULL, 0, 0, &pac_conf, &local_err))
+    {
+        g_propagate_error (error, local_err);
+        free_pacman_config (pac_conf);
+        return FALSE;
+    }
+
+    snprintf (buf, MAX_PATH - 1, "%s/sync", cachedir);
+    if (0 != g_mkdir_with_parents (buf, 0755))
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to create folder %s: %s"),
+                buf, strerror (errno));
+        free_pacman_config (pac_conf);
+        return FALSE;
+    }
+
+    snprintf (buf, MAX_PATH - 1, "%s/lock", cachedir);
+    fd = open (buf, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0 || flock (fd, LOCK_EX) < 0)
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to lock %s: %s"),
+                buf, strerror (errno));
+        if (fd >= 0)
+        {
+            close (fd);
+        }
+        free_pacman_config (pac_conf);
+        return FALSE;
+    }
+    debug ("shared cache: locked %s", buf);
+
+    /* start from the system dbs when they're newer, no need to download
+     * those */
+    if (!copy_sync_dbs (pac_conf->dbpath, cachedir, TRUE, NULL, NULL,
+                &local_err))
+    {
+        debug ("shared cache: unable to seed from %s: %s", pac_conf->dbpath,
+                local_err->message);
+        g_clear_error (&local_err);
+    }
+
+    handle = alpm_initialize ("/", cachedir, &err);
+    if (handle == NULL)
+    {
+        g_set_error (error, KALU_ERROR, 1,
+                _("Failed to initialize alpm library: %s"),
+                alpm_strerror (err));
+        goto cleanup;
+    }
+    alpm_option_set_arch (handle, pac_conf->arch);
+    if (log_enabled (SUBSYS_ALPM, 2))
+    {
+        alpm_option_set_logcb (handle, log_cb);
+    }
+
+    FOR_LIST (i, pac_conf->databases)
+    {
+        database_t  *db_conf = i->data;
+        alpm_db_t   *db;
+        int          r;
+
+        debug ("register %s", db_conf->name);
+        db = alpm_register_syncdb (handle, db_conf->name, db_conf->siglevel);
+        if (db == NULL)
+        {
+            g_set_error (error, KALU_ERROR, 1,
+                    _("Could not register database %s: %s"),
+                    db_conf->name, alpm_strerror (alpm_errno (handle)));
+            goto release;
+        }
+        FOR_LIST (j, db_conf->servers)
+        {
+            char *server;
+
+            server = get_server_url (j->data, db_conf->name, pac_conf->arch,
+                    error);
+            if (server == NULL)
+            {
+                goto release;
+            }
+            debug ("add server %s into %s", server, db_conf->name);
+            alpm_db_add_server (db, server);
+            free (server);
+        }
+
+        r = alpm_db_update (0, db);
+        if (r < 0)
+        {
+            g_set_error (error, KALU_ERROR, 1,
+                    _("Failed to update %s: %s"),
+                    db_conf->name,
+                    alpm_strerror (alpm_errno (handle)));
+            goto release;
+        }
+        else if (r == 1)
+        {
+            debug ("%s is up to date", db_conf->name);
+        }
+        else
+        {
+            ++*nb_dbs_synced;
+            debug ("%s was updated", db_conf->name);
+        }
+    }
+
+    /* g_file_set_contents is atomic, so no need for users to lock to read it */
+    snprintf (buf, MAX_PATH - 1, "%s/lastsync", cachedir);
+    s = g_strdup_printf ("%ld\n", (long) time (NULL));
+    if (!g_file_set_contents (buf, s, -1, &local_err))
+    {
+        g_propagate_error (error, local_err);
+        g_free (s);
+        goto release;
+    }
+    g_free (s);
+    ret = TRUE;
+
+release:
+    alpm_release (handle);
+cleanup:
+    /* releases the lock */
+    close (fd);
+    free_pacman_config (pac_conf);
+    return ret;
+}
@@ -36,6 +36,18 @@ typedef struct _kalu_alpm_t {
     alpm_transflag_t flags;
 } kalu_alpm_t;
 
+/* kalu */
+#include "conf.h"
+#include "executor.h"
+
+typedef struct _batch_root_t {
+    gchar           *conffile;
+    gchar           *rootdir;   /* NULL to use RootDir from pacman.conf */
+    /* set by kalu_alpm_batch_sync */
+    pacman_config_t *pac_conf;
+    alpm_list_t     *dbs;
+} batch_root_t;
+
 /* global variable */
 extern unsigned short alpm_verbose;
 
@@ -43,7 +55,7 @@ gboolean
 kalu_alpm_load (const gchar *conffile, GError **error);
 
 gboolean
-kalu_alpm_syncdbs (gint *nb_dbs_synced, GError **error);
+kalu_alpm_syncdbs (gint *nb_dbs_synced, cancel_t *cancel, GError **error);
 
 gboolean
 kalu_alpm_has_updates (alpm_list_t **packages, GError **error);
@@ -51,10 +63,39 @@ kalu_alpm_has_updates (alpm_list_t **packages, GError **error);
 gboolean
 kalu_alpm_has_updates_watched (alpm_list_t **packages, alpm_list_t *watched, GError **error);
 
+/* packages are watched_package_t (copies), so they can be used after
+ * kalu_alpm_free() */
 gboolean
 kalu_alpm_has_foreign (alpm_list_t **packages, alpm_list_t *ignore, GError **error);
 
 void
 kalu_alpm_free (void);
 
+/* keep the local copy of dbs & parsed pacman.conf between checks */
+void
+kalu_alpm_set_keep_cache (gboolean keep);
+
+void
+kalu_alpm_drop_cache (void);
+
+const gchar *
+kalu_alpm_get_cached_dbpath (void);
+
+/* default folder of the shared cache of sync dbs */
+#define SHARED_CACHE_DIR        "/var/cache/kalu"
+
+gboolean
+kalu_alpm_cache_sync (const gchar *conffile, const gchar *cachedir,
+        gint *nb_dbs_synced, GError **error);
+
+/* batch mode, see kalu-alpm.c */
+gboolean
+kalu_alpm_batch_sync (alpm_list_t *roots, gint *nb_dbs_synced, GError **error);
+
+gboolean
+kalu_alpm_batch_load (batch_root_t *root, GError **error);
+
+void
+kalu_alpm_batch_free (alpm_list_t *roots);
+
 #endif /* _KALU_ALPM_H */
@@ -22,17 +22,25 @@
 
 #include <config.h>
 
+/* tag debug() messages & allocations */
+#define DEBUG_SUBSYS    SUBSYS_UPDATER
+#define ALLOC_TAG       "gui"
+
 /* C */
 #include <string.h>
+#include <unistd.h> /* close */
 
 /* gio - for dbus */
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
 
 /* kalu */
 #include "kalu.h"
 #include "kalu-updater.h"
 #include "closures.h"
 
+/* for the signal handlers (on_<Signal>) & their dispatch */
+#define UPDATER_DBUS_CLIENT
 #include "../kalu-dbus/updater-dbus.h"
 
 
@@ -55,6 +63,9 @@ struct _KaluUpdaterClass
                                      guint               xfered,
                                      guint               total);
 
+    void (*import_dbs)              (KaluUpdater        *kupdater,
+                                     gint                nb);
+
     void (*sync_dbs)                (KaluUpdater        *kupdater,
                                      gint                nb);
 
@@ -158,6 +169,9 @@ struct _KaluUpdaterClass
 struct _KaluUpdaterPrivate
 {
     method_callback_t *method_callbacks;
+    /* peer-to-peer connection to kalu-dbus, for signals (see OpenPeer) */
+    GDBusConnection   *peer;
+    guint              peer_signal_id;
 };
 
 GType       kalu_updater_get_type   (void) G_GNUC_CONST;
@@ -166,6 +180,7 @@ enum
 {
   SIGNAL_DEBUG,
   SIGNAL_DOWNLOADING,
+  SIGNAL_IMPORT_DBS,
   SIGNAL_SYNC_DBS,
   SIGNAL_SYNC_DB_START,
   SIGNAL_SYNC_DB_END,
@@ -250,6 +265,13 @@ kalu_updater_finalize (GObject *object)
     G_GNUC_UNUSED KaluUpdater *kupdater = KALU_UPDATER (object);
 
     free (kupdater->priv->method_callbacks);
+    if (kupdater->priv->peer)
+    {
+        g_dbus_connection_signal_unsubscribe (kupdater->priv->peer,
+                kupdater->priv->peer_signal_id);
+        g_dbus_connection_close (kupdater->priv->peer, NULL, NULL, NULL);
+        g_object_unref (kupdater->priv->peer);
+    }
 
     if (G_OBJECT_CLASS (kalu_updater_parent_class)->finalize != NULL)
     {
@@ -269,13 +291,18 @@ kalu_updater_init (KaluUpdater *kupdater)
             KaluUpdaterPrivate);
     method_callback_t mc[] = {
         {"Init",        FALSE, NULL, NULL},
+        {"InitPrefetch",FALSE, NULL, NULL},
+        {"OpenPeer",    FALSE, NULL, NULL},
         {"InitAlpm",    FALSE, NULL, NULL},
         {"AddDb",       FALSE, NULL, NULL},
+        {"ImportDbs",   FALSE, NULL, NULL},
         {"SyncDbs",     FALSE, NULL, NULL},
         {"GetPackages", FALSE, NULL, NULL},
         {"SysUpgrade",  FALSE, NULL, NULL},
         {"NoSysUpgrade",FALSE, NULL, NULL},
+        {"Prefetch",    FALSE, NULL, NULL},
         {"FreeAlpm",    FALSE, NULL, NULL},
+        {"EnableEventBatch", FALSE, NULL, NULL},
         {NULL, FALSE, NULL, NULL}
     };
     size_t count = sizeof (mc) / sizeof (mc[0]);
@@ -302,496 +329,496 @@ kalu_updater_init (KaluUpdater *kupdater)
         /* emit signal error or something */                                \
     }                                                                       \
 } while (0)
+
+/* signal handlers, as dispatched by kalu_updater_g_signal() -- see
+ * updater-dbus.h (generated from updater-dbus.xml) for their arguments */
+
 static void
-kalu_updater_g_signal (GDBusProxy   *proxy,
-                       const gchar  *sender_name _UNUSED_,
-                       const gchar  *signal_name,
-                       GVariant     *parameters)
+on_Debug (KaluUpdater *kupdater, const gchar *msg)
 {
-    KaluUpdater *kupdater = KALU_UPDATER (proxy);
-    if (g_strcmp0 (signal_name, "Debug") == 0)
-    {
-        gchar *msg;
+    g_signal_emit (kupdater, signals[SIGNAL_DEBUG], 0, msg);
+}
 
-        g_variant_get (parameters, "(s)", &msg);
-        g_signal_emit (kupdater, signals[SIGNAL_DEBUG], 0, msg);
-        free (msg);
-    }
-    else if (g_strcmp0 (signal_name, "MethodFailed") == 0)
+static void
+on_MethodFailed (KaluUpdater *kupdater, const gchar *name, const gchar *msg)
+{
+    if (g_strcmp0 (name, "Answer") == 0)
     {
-        gchar *name, *msg;
-
-        g_variant_get (parameters, "(ss)", &name, &msg);
-        if (msg == NULL)
-        {
-            msg = strdup (_("No error message specified in MethodFailed\n"));
-        }
-
-        if (g_strcmp0 (name, "Answer") == 0)
-        {
-            free (name);
-            free (msg);
-            return;
-        }
+        return;
+    }
 
-        method_callback_t *mc;
-        for (mc = kupdater->priv->method_callbacks; ; ++mc)
+    method_callback_t *mc;
+    for (mc = kupdater->priv->method_callbacks; ; ++mc)
+    {
+        if (g_strcmp0 (mc->name, name) == 0)
         {
-            if (g_strcmp0 (mc->name, name) == 0)
+            if (!mc->is_running)
             {
-                if (!mc->is_running)
-                {
-                    debug ("MethodFailed: method %s not registered running\n",
-                            name);
-                    break;
-                }
-                debug ("MethodFailed for method %s: %s\n", name, msg);
-
-                if (mc->callback == NULL)
-                {
-                    break;
-                }
-
-                KaluMethodCallback cb = mc->callback;
-                gpointer data = mc->data;
-
-                mc->is_running = FALSE;
-                mc->callback = NULL;
-                mc->data = NULL;
-
-                cb (kupdater, msg, data);
+                debug ("MethodFailed: method %s not registered running\n",
+                        name);
                 break;
             }
-            else if (mc->name == NULL)
+            debug ("MethodFailed for method %s: %s\n", name, msg);
+
+            if (mc->callback == NULL)
             {
-                debug ("MethodFailed: Internal method definition missing for %s\n",
-                        name);
+                break;
             }
-        }
 
-        free (name);
-        free (msg);
-    }
-    else if (g_strcmp0 (signal_name, "MethodFinished") == 0)
-    {
-        gchar *name;
+            KaluMethodCallback cb = mc->callback;
+            gpointer data = mc->data;
 
-        g_variant_get (parameters, "(s)", &name);
+            mc->is_running = FALSE;
+            mc->callback = NULL;
+            mc->data = NULL;
 
-        if (g_strcmp0 (name, "Answer") == 0)
+            cb (kupdater, msg, data);
+            break;
+        }
+        else if (mc->name == NULL)
         {
-            free (name);
-            return;
+            debug ("MethodFailed: Internal method definition missing for %s\n",
+                    name);
+            break;
         }
+    }
+}
 
-        method_callback_t *mc;
-        for (mc = kupdater->priv->method_callbacks; ; ++mc)
+static void
+on_MethodFinished (KaluUpdater *kupdater, const gchar *name)
+{
+    if (g_strcmp0 (name, "Answer") == 0)
+    {
+        return;
+    }
+
+    method_callback_t *mc;
+    for (mc = kupdater->priv->method_callbacks; ; ++mc)
+    {
+        if (g_strcmp0 (mc->name, name) == 0)
         {
-            if (g_strcmp0 (mc->name, name) == 0)
+            if (!mc->is_running)
             {
-                if (!mc->is_running)
-                {
-                    debug ("MethodFinished: method %s not registered running\n",
-                            name);
-                    break;
-                }
-                debug ("MethodFinished for method %s\n", name);
-
-                if (mc->callback == NULL)
-                {
-                    break;
-                }
-
-                KaluMethodCallback cb = mc->callback;
-                gpointer data = mc->data;
-
-                mc->is_running = FALSE;
-                mc->callback = NULL;
-                mc->data = NULL;
-
-                cb (kupdater, NULL, data);
+                debug ("MethodFinished: method %s not registered running\n",
+                        name);
                 break;
             }
-            else if (mc->name == NULL)
+            debug ("MethodFinished for method %s\n", name);
+
+            if (mc->callback == NULL)
             {
-                debug ("MethodFinished: Internal method definition missing for %s\n",
-                        name);
+                break;
             }
-        }
 
-        free (name);
+            KaluMethodCallback cb = mc->callback;
+            gpointer data = mc->data;
+
+            mc->is_running = FALSE;
+            mc->callback = NULL;
+            mc->data = NULL;
+
+            cb (kupdater, NULL, data);
+            break;
+        }
+        else if (mc->name == NULL)
+        {
+            debug ("MethodFinished: Internal method definition missing for %s\n",
+                    name);
+            break;
+        }
     }
-    else if (g_strcmp0 (signal_name, "GetPackagesFinished") == 0)
-    {
-        GVariantIter *iter;
-        alpm_list_t *pkgs= NULL;
+}
 
-        method_callback_t *mc;
-        for (mc = kupdater->priv->method_callbacks; ; ++mc)
+static void
+on_GetPackagesFinished (KaluUpdater *kupdater, GVariantIter *iter)
+{
+    method_callback_t *mc;
+    for (mc = kupdater->priv->method_callbacks; ; ++mc)
+    {
+        if (g_strcmp0 (mc->name, "GetPackages") == 0)
         {
-            if (g_strcmp0 (mc->name, "GetPackages") == 0)
+            if (!mc->is_running)
             {
-                if (!mc->is_running)
-                {
-                    debug ("GetPackagesFinished: method not registered running\n");
-                    break;
-                }
+                debug ("GetPackagesFinished: method not registered running\n");
+                break;
+            }
 
-                KaluGetPackagesCallback cb = (KaluGetPackagesCallback) mc->callback;
-                gpointer data = mc->data;
+            KaluGetPackagesCallback cb = (KaluGetPackagesCallback) mc->callback;
+            gpointer data = mc->data;
 
-                mc->is_running = FALSE;
-                mc->callback = NULL;
-                mc->data = NULL;
+            mc->is_running = FALSE;
+            mc->callback = NULL;
+            mc->data = NULL;
 
-                kalu_package_t *k_pkg;
-                g_variant_get (parameters, "(a(ssssuuu))", &iter);
-                k_pkg = new0 (kalu_package_t, 1);
-                while (g_variant_iter_loop (iter, "(ssssuuu)",
-                            &k_pkg->name,
-                            &k_pkg->desc,
-                            &k_pkg->old_version,
-                            &k_pkg->new_version,
-                            &k_pkg->dl_size,
-                            &k_pkg->old_size,
-                            &k_pkg->new_size))
-                {
-                    pkgs = alpm_list_add (pkgs, k_pkg);
-                    k_pkg = new0 (kalu_package_t, 1);
-                }
-                g_variant_iter_free (iter);
-                free (k_pkg);
-
-                cb (kupdater, NULL, pkgs, data);
-
-                alpm_list_t *i;
-                for (i = pkgs; i; i = alpm_list_next (i))
-                {
-                    k_pkg = i->data;
-                    free (k_pkg->name);
-                    free (k_pkg->desc);
-                    free (k_pkg->old_version);
-                    free (k_pkg->new_version);
-                    free (k_pkg);
-                }
-                alpm_list_free (pkgs);
-                break;
-            }
-            else if (mc->name == NULL)
-            {
-                debug ("GetPackagesFinished: Internal method definition missing\n");
-            }
+            /* handed over as is, so strings can be borrowed from the
+             * GVariant instead of copied for every package */
+            cb (kupdater, NULL, iter, data);
+            break;
+        }
+        else if (mc->name == NULL)
+        {
+            debug ("GetPackagesFinished: Internal method definition missing\n");
+            break;
         }
     }
-    else if (g_strcmp0 (signal_name, "SyncDbs") == 0)
-    {
-        gint nb;
+}
 
-        g_variant_get (parameters, "(i)", &nb);
-        g_signal_emit (kupdater, signals[SIGNAL_SYNC_DBS], 0, nb);
-    }
-    else if (g_strcmp0 (signal_name, "SyncDbStart") == 0)
-    {
-        gchar *name;
+static void
+on_ImportDbs (KaluUpdater *kupdater, gint nb)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_IMPORT_DBS], 0, nb);
+}
 
-        g_variant_get (parameters, "(s)", &name);
-        g_signal_emit (kupdater, signals[SIGNAL_SYNC_DB_START], 0, name);
-        free (name);
-    }
-    else if (g_strcmp0 (signal_name, "SyncDbEnd") == 0)
-    {
-        gint result;
+static void
+on_SyncDbs (KaluUpdater *kupdater, gint nb)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_SYNC_DBS], 0, nb);
+}
 
-        g_variant_get (parameters, "(i)", &result);
-        g_signal_emit (kupdater, signals[SIGNAL_SYNC_DB_END], 0, result);
-    }
-    else if (g_strcmp0 (signal_name, "TotalDownload") == 0)
-    {
-        guint total;
+static void
+on_SyncDbStart (KaluUpdater *kupdater, const gchar *name)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_SYNC_DB_START], 0, name);
+}
 
-        g_variant_get (parameters, "(u)", &total);
-        g_signal_emit (kupdater, signals[SIGNAL_TOTAL_DOWNLOAD], 0, total);
-    }
-    else if (g_strcmp0 (signal_name, "Event") == 0)
-    {
-        gint event;
+static void
+on_SyncDbEnd (KaluUpdater *kupdater, gint result)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_SYNC_DB_END], 0, result);
+}
 
-        g_variant_get (parameters, "(i)", &event);
-        g_signal_emit (kupdater, signals[SIGNAL_EVENT], 0, (event_t) event);
-    }
-    else if (g_strcmp0 (signal_name, "EventInstalled") == 0)
-    {
-        gchar *pkg, *version, *dep;
-        alpm_list_t *optdeps = NULL;
-        GVariantIter *iter;
+static void
+on_TotalDownload (KaluUpdater *kupdater, guint size)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_TOTAL_DOWNLOAD], 0, size);
+}
 
-        g_variant_get (parameters, "(ssas)", &pkg, &version, &iter);
-        while (g_variant_iter_loop (iter, "s", &dep))
-        {
-            optdeps = alpm_list_add (optdeps, strdup (dep));
-        }
-        g_variant_iter_free (iter);
-        g_signal_emit (kupdater, signals[SIGNAL_EVENT_INSTALLED], 0,
-                pkg, version, optdeps);
-        free (pkg);
-        free (version);
-        FREELIST (optdeps);
-    }
-    else if (g_strcmp0 (signal_name, "EventReinstalled") == 0)
-    {
-        gchar *pkg, *version;
+static void
+on_Event (KaluUpdater *kupdater, gint type)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_EVENT], 0, (event_t) type);
+}
 
-        g_variant_get (parameters, "(ss)", &pkg, &version);
-        g_signal_emit (kupdater, signals[SIGNAL_EVENT_REINSTALLED], 0,
-                pkg, version);
-        free (pkg);
-        free (version);
-    }
-    else if (g_strcmp0 (signal_name, "EventRemoved") == 0)
-    {
-        gchar *pkg, *version;
+/* strings are owned by iter's GVariant, so only the list needs freeing */
+static alpm_list_t *
+strings_from_iter (GVariantIter *iter)
+{
+    alpm_list_t *optdeps = NULL;
+    const gchar *dep;
 
-        g_variant_get (parameters, "(ss)", &pkg, &version);
-        g_signal_emit (kupdater, signals[SIGNAL_EVENT_REMOVED], 0,
-                pkg, version);
-        free (pkg);
-        free (version);
-    }
-    else if (g_strcmp0 (signal_name, "EventUpgraded") == 0)
+    while (g_variant_iter_next (iter, "&s", &dep))
     {
-        gchar *pkg, *old_version, *new_version, *dep;
-        alpm_list_t *newoptdeps = NULL;
-        GVariantIter *iter;
+        optdeps = alpm_list_add (optdeps, (gchar *) dep);
+    }
+    return optdeps;
+}
+
+static void
+on_EventInstalled (KaluUpdater *kupdater, const gchar *pkg,
+        const gchar *version, GVariantIter *iter)
+{
+    alpm_list_t *optdeps = strings_from_iter (iter);
+
+    g_signal_emit (kupdater, signals[SIGNAL_EVENT_INSTALLED], 0,
+            pkg, version, optdeps);
+    alpm_list_free (optdeps);
+}
+
+static void
+on_EventReinstalled (KaluUpdater *kupdater, const gchar *pkg,
+        const gchar *version)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_EVENT_REINSTALLED], 0,
+            pkg, version);
+}
+
+static void
+on_EventRemoved (KaluUpdater *kupdater, const gchar *pkg, const gchar *version)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_EVENT_REMOVED], 0,
+            pkg, version);
+}
 
-        g_variant_get (parameters, "(sssas)",
+static void
+on_EventUpgraded (KaluUpdater *kupdater, const gchar *pkg,
+        const gchar *old_version, const gchar *new_version, GVariantIter *iter)
+{
+    alpm_list_t *newoptdeps = strings_from_iter (iter);
+
+    g_signal_emit (kupdater, signals[SIGNAL_EVENT_UPGRADED], 0, pkg,
+            old_version, new_version, newoptdeps);
+    alpm_list_free (newoptdeps);
+}
+
+static void
+on_EventDowngraded (KaluUpdater *kupdater, const gchar *pkg,
+        const gchar *old_version, const gchar *new_version, GVariantIter *iter)
+{
+    alpm_list_t *newoptdeps = strings_from_iter (iter);
+
+    g_signal_emit (kupdater, signals[SIGNAL_EVENT_DOWNGRADED], 0, pkg,
+            old_version, new_version, newoptdeps);
+    alpm_list_free (newoptdeps);
+}
+
+static void
+on_EventBatch (KaluUpdater *kupdater, GVariantIter *iter)
+{
+    gint type;
+    const gchar *pkg, *old_version, *new_version;
+    alpm_list_t *optdeps;
+    GVariantIter *iter_deps;
+
+    /* re-emit each event as if it had been sent on its own */
+    while (g_variant_iter_next (iter, "(i&s&s&sas)",
+                &type,
                 &pkg,
                 &old_version,
                 &new_version,
-                &iter);
-        while (g_variant_iter_loop (iter, "s", &dep))
-        {
-            newoptdeps = alpm_list_add (newoptdeps, strdup (dep));
-        }
-        g_variant_iter_free (iter);
-        g_signal_emit (kupdater, signals[SIGNAL_EVENT_UPGRADED], 0, pkg,
-                old_version, new_version, newoptdeps);
-        free (pkg);
-        free (old_version);
-        free (new_version);
-        FREELIST (newoptdeps);
-    }
-    else if (g_strcmp0 (signal_name, "EventDowngraded") == 0)
+                &iter_deps))
     {
-        gchar *pkg, *old_version, *new_version, *dep;
-        alpm_list_t *newoptdeps = NULL;
-        GVariantIter *iter;
+        optdeps = strings_from_iter (iter_deps);
+        g_variant_iter_free (iter_deps);
 
-        g_variant_get (parameters, "(sssas)",
-                &pkg,
-                &old_version,
-                &new_version,
-                &iter);
-        while (g_variant_iter_loop (iter, "s", &dep))
+        switch ((batch_event_t) type)
         {
-            newoptdeps = alpm_list_add (newoptdeps, strdup (dep));
+            case BATCH_INSTALLED:
+                g_signal_emit (kupdater, signals[SIGNAL_EVENT_INSTALLED], 0,
+                        pkg, new_version, optdeps);
+                break;
+            case BATCH_REINSTALLED:
+                g_signal_emit (kupdater, signals[SIGNAL_EVENT_REINSTALLED], 0,
+                        pkg, new_version);
+                break;
+            case BATCH_REMOVED:
+                g_signal_emit (kupdater, signals[SIGNAL_EVENT_REMOVED], 0,
+                        pkg, old_version);
+                break;
+            case BATCH_UPGRADED:
+                g_signal_emit (kupdater, signals[SIGNAL_EVENT_UPGRADED], 0,
+                        pkg, old_version, new_version, optdeps);
+                break;
+            case BATCH_DOWNGRADED:
+                g_signal_emit (kupdater, signals[SIGNAL_EVENT_DOWNGRADED], 0,
+                        pkg, old_version, new_version, optdeps);
+                break;
+            default:
+                debug ("EventBatch: unknown event type %d\n", type);
+                break;
         }
-        g_variant_iter_free (iter);
-        g_signal_emit (kupdater, signals[SIGNAL_EVENT_DOWNGRADED], 0, pkg,
-                old_version, new_version, newoptdeps);
-        free (pkg);
-        free (old_version);
-        free (new_version);
-        FREELIST (newoptdeps);
+        alpm_list_free (optdeps);
     }
-    else if (g_strcmp0 (signal_name, "EventRetrievingPkgs") == 0)
-    {
-        gchar *repo;
+}
 
-        g_variant_get (parameters, "(s)", &repo);
-        g_signal_emit (kupdater, signals[SIGNAL_EVENT_RETRIEVING_PKGS], 0,
-                repo);
-        free (repo);
-    }
-    else if (g_strcmp0 (signal_name, "EventScriptlet") == 0)
-    {
-        gchar *msg;
+static void
+on_EventScriptlet (KaluUpdater *kupdater, const gchar *msg)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_EVENT_SCRIPTLET], 0, msg);
+}
 
-        g_variant_get (parameters, "(s)", &msg);
-        g_signal_emit (kupdater, signals[SIGNAL_EVENT_SCRIPTLET], 0, msg);
-        free (msg);
-    }
-    else if (g_strcmp0 (signal_name, "EventDeltaGenerating") == 0)
-    {
-        gchar *delta, *dest;
+static void
+on_EventDeltaGenerating (KaluUpdater *kupdater, const gchar *delta,
+        const gchar *dest)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_EVENT_DELTA_GENERATING], 0,
+            delta, dest);
+}
 
-        g_variant_get (parameters, "(ss)", &delta, &dest);
-        g_signal_emit (kupdater, signals[SIGNAL_EVENT_DELTA_GENERATING], 0,
-                delta, dest);
-        free (delta);
-        free (dest);
-    }
-    else if (g_strcmp0 (signal_name, "EventOptdepRequired") == 0)
-    {
-        gchar *pkg, *optdep;
+static void
+on_EventOptdepRequired (KaluUpdater *kupdater, const gchar *pkg,
+        const gchar *optdep)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_EVENT_OPTDEP_REQUIRED], 0,
+            pkg, optdep);
+}
 
-        g_variant_get (parameters, "(ss)", &pkg, &optdep);
-        g_signal_emit (kupdater, signals[SIGNAL_EVENT_OPTDEP_REQUIRED], 0,
-                pkg, optdep);
-        free (pkg);
-        free (optdep);
-    }
-    else if (g_strcmp0 (signal_name, "Progress") == 0)
-    {
-        gint event, percent;
-        gchar *pkg;
-        guint total, current;
+static void
+on_Progress (KaluUpdater *kupdater, gint event, const gchar *pkg, gint percent,
+        guint total, guint current)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_PROGRESS], 0,
+            (event_t) event, pkg, percent, total, current);
+}
 
-        g_variant_get (parameters, "(isiuu)",
-                &event,
-                &pkg,
-                &percent,
-                &total,
-                &current);
-        g_signal_emit (kupdater, signals[SIGNAL_PROGRESS], 0,
-                (event_t) event, pkg, percent, total, current);
-        free (pkg);
-    }
-    else if (g_strcmp0 (signal_name, "Downloading") == 0)
-    {
-        gchar *name;
-        guint xfered, total;
+static void
+on_Downloading (KaluUpdater *kupdater, const gchar *filename,
+        guint transfered, guint total)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_DOWNLOADING], 0,
+            filename, transfered, total);
+}
 
-        g_variant_get (parameters, "(suu)", &name, &xfered, &total);
-        g_signal_emit (kupdater, signals[SIGNAL_DOWNLOADING], 0,
-                name, xfered, total);
-        free (name);
-    }
-    else if (g_strcmp0 (signal_name, "Log") == 0)
-    {
-        gint level;
-        gchar *msg;
+static void
+on_Log (KaluUpdater *kupdater, gint level, const gchar *msg)
+{
+    g_signal_emit (kupdater, signals[SIGNAL_LOG], 0, level, msg);
+}
 
-        g_variant_get (parameters, "(is)", &level, &msg);
-        g_signal_emit (kupdater, signals[SIGNAL_LOG], 0, level, msg);
-        free (msg);
-    }
-    else if (g_strcmp0 (signal_name, "AskInstallIgnorePkg") == 0)
-    {
-        gchar *pkg;
-        g_variant_get (parameters, "(s)", &pkg);
-        emit_signal_answer (SIGNAL_INSTALL_IGNOREPKG, pkg);
-        free (pkg);
-    }
-    else if (g_strcmp0 (signal_name, "AskReplacePkg") == 0)
+static void
+on_AskInstallIgnorePkg (KaluUpdater *kupdater, const gchar *pkg)
+{
+    emit_signal_answer (SIGNAL_INSTALL_IGNOREPKG, pkg);
+}
+
+static void
+on_AskReplacePkg (KaluUpdater *kupdater, const gchar *repo1, const gchar *pkg1,
+        const gchar *repo2, const gchar *pkg2)
+{
+    emit_signal_answer (SIGNAL_REPLACE_PKG, repo1, pkg1, repo2, pkg2);
+}
+
+static void
+on_AskConflictPkg (KaluUpdater *kupdater, const gchar *pkg1, const gchar *pkg2,
+        const gchar *reason)
+{
+    emit_signal_answer (SIGNAL_CONFLICT_PKG, pkg1, pkg2, reason);
+}
+
+static void
+on_AskRemovePkgs (KaluUpdater *kupdater, GVariantIter *iter)
+{
+    alpm_list_t *pkgs = strings_from_iter (iter);
+
+    emit_signal_answer (SIGNAL_REMOVE_PKGS, pkgs);
+    alpm_list_free (pkgs);
+}
+
+static void
+on_AskSelectProvider (KaluUpdater *kupdater, const gchar *pkg,
+        GVariantIter *iter)
+{
+    GVariantIter *iter2;
+    alpm_list_t *providers = NULL;
+    provider_t *provider;
+
+    while (g_variant_iter_next (iter, "as", &iter2))
     {
-        gchar *repo1, *pkg1, *repo2, *pkg2;
-        g_variant_get (parameters, "(ssss)", &repo1, &pkg1, &repo2, &pkg2);
-        emit_signal_answer (SIGNAL_REPLACE_PKG, repo1, pkg1, repo2, pkg2);
-        free (repo1);
-        free (pkg1);
-        free (repo2);
-        free (pkg2);
+        provider = new0 (provider_t, 1);
+        g_variant_iter_next (iter2, "s", &provider->repo);
+        g_variant_iter_next (iter2, "s", &provider->pkg);
+        g_variant_iter_next (iter2, "s", &provider->version);
+        g_variant_iter_free (iter2);
+        providers = alpm_list_add (providers, provider);
     }
-    else if (g_strcmp0 (signal_name, "AskConflictPkg") == 0)
+
+    emit_signal_answer (SIGNAL_SELECT_PROVIDER, pkg, providers);
+    alpm_list_t *i;
+    for (i = providers; i; i = alpm_list_next (i))
     {
-        gchar *pkg1, *pkg2, *reason;
-        g_variant_get (parameters, "(sss)", &pkg1, &pkg2, &reason);
-        emit_signal_answer (SIGNAL_CONFLICT_PKG, pkg1, pkg2, reason);
-        free (pkg1);
-        free (pkg2);
-        free (reason);
+        provider = i->data;
+        free (provider->repo);
+        free (provider->pkg);
+        free (provider->version);
+        free (provider);
     }
-    else if (g_strcmp0 (signal_name, "AskRemovePkgs") == 0)
-    {
-        GVariantIter *iter;
-        gchar *pkg;
-        alpm_list_t *pkgs = NULL;
+    alpm_list_free (providers);
+}
 
-        g_variant_get (parameters, "(as)", &iter);
-        while (g_variant_iter_loop (iter, "s", &pkg))
-        {
-            pkgs = alpm_list_add (pkgs, strdup (pkg));
-        }
-        g_variant_iter_free (iter);
+static void
+on_AskLocalNewer (KaluUpdater *kupdater, const gchar *pkg,
+        const gchar *pkg_version, const gchar *repo, const gchar *repo_version)
+{
+    emit_signal_answer (SIGNAL_LOCAL_NEWER, pkg, pkg_version, repo, repo_version);
+}
 
-        emit_signal_answer (SIGNAL_REMOVE_PKGS, pkgs);
-        free (pkg);
-        FREELIST (pkgs);
-    }
-    else if (g_strcmp0 (signal_name, "AskSelectProvider") == 0)
-    {
-        GVariantIter *iter1, *iter2;
-        gchar *pkg;
-        alpm_list_t *providers = NULL;
-        provider_t *provider;
+static void
+on_AskCorruptedPkg (KaluUpdater *kupdater, const gchar *file,
+        const gchar *err)
+{
+    /* not named error, as emit_signal_answer() has its own */
+    emit_signal_answer (SIGNAL_CORRUPTED_PKG, file, err);
+}
 
-        g_variant_get (parameters, "(saas)", &pkg, &iter1);
-        while (g_variant_iter_loop (iter1, "as", &iter2))
-        {
-            provider = new0 (provider_t, 1);
-            g_variant_iter_loop (iter2, "s", &provider->repo);
-            g_variant_iter_loop (iter2, "s", &provider->pkg);
-            g_variant_iter_loop (iter2, "s", &provider->version);
-            providers = alpm_list_add (providers, provider);
-        }
-        g_variant_iter_free (iter1);
+static void
+on_AskImportKey (KaluUpdater *kupdater, const gchar *key_fingerprint,
+        const gchar *key_uid, const gchar *key_created)
+{
+    emit_signal_answer (SIGNAL_IMPORT_KEY,
+            key_fingerprint, key_uid, key_created);
+}
+#undef emit_signal_answer
 
-        emit_signal_answer (SIGNAL_SELECT_PROVIDER, pkg, providers);
-        alpm_list_t *i;
-        for (i = providers; i; i = alpm_list_next (i))
-        {
-            provider = i->data;
-            free (provider->repo);
-            free (provider->pkg);
-            free (provider->version);
-            free (provider);
-        }
-        alpm_list_free (providers);
-    }
-    else if (g_strcmp0 (signal_name, "AskLocalNewer") == 0)
-    {
-        gchar *pkg, *pkg_version, *repo, *repo_version;
+static void
+kalu_updater_g_signal (GDBusProxy   *proxy,
+                       const gchar  *sender_name _UNUSED_,
+                       const gchar  *signal_name,
+                       GVariant     *parameters)
+{
+    const signal_dispatch_t *sd;
 
-        g_variant_get (parameters, "(ssss)",
-                &pkg,
-                &pkg_version,
-                &repo,
-                &repo_version);
-        emit_signal_answer (SIGNAL_LOCAL_NEWER, pkg, pkg_version, repo, repo_version);
-        free (pkg);
-        free (pkg_version);
-        free (repo);
-        free (repo_version);
-    }
-    else if (g_strcmp0 (signal_name, "AskCorruptedPkg") == 0)
+    sd = updater_dbus_get_signal (signal_name);
+    if (!sd)
     {
-        gchar *file, *err;
-
-        g_variant_get (parameters, "(ss)", &file, &err);
-        emit_signal_answer (SIGNAL_CORRUPTED_PKG, file, err);
-        free (file);
-        free (err);
+        g_warning ("Unknown signal received from kalu-updater: %s", signal_name);
+        return;
     }
-    else if (g_strcmp0 (signal_name, "AskImportKey") == 0)
+    if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE (sd->signature)))
     {
-        gchar *key_fingerprint, *key_uid, *key_created;
-
-        g_variant_get (parameters, "(sss)",
-                &key_fingerprint,
-                &key_uid,
-                &key_created);
-        emit_signal_answer (SIGNAL_IMPORT_KEY,
-                key_fingerprint, key_uid, key_created);
-        free (key_fingerprint);
-        free (key_uid);
-        free (key_created);
+        g_warning ("Invalid parameters for signal %s from kalu-updater: %s instead of %s",
+                signal_name,
+                g_variant_get_type_string (parameters),
+                sd->signature);
+        return;
     }
-    else
+    sd->unmarshal (KALU_UPDATER (proxy), parameters);
+}
+
+static void
+peer_signal_cb (GDBusConnection *conn _UNUSED_,
+                const gchar     *sender_name,
+                const gchar     *object_path _UNUSED_,
+                const gchar     *interface_name _UNUSED_,
+                const gchar     *signal_name,
+                GVariant        *parameters,
+                gpointer         data)
+{
+    kalu_updater_g_signal (G_DBUS_PROXY (data), sender_name, signal_name,
+            parameters);
+}
+
+static void
+peer_new_cb (GObject *source, GAsyncResult *res, KaluUpdater *kupdater)
+{
+    GError *error = NULL;
+    GDBusConnection *peer;
+
+    peer = g_dbus_connection_new_finish (res, &error);
+    if (!peer)
     {
-        g_warning ("Unknown signal received from kalu-updater: %s", signal_name);
+        /* kalu-dbus might have its end up already: close ours, and tell it to
+         * drop it so signals go back over the system bus */
+        g_io_stream_close (g_dbus_connection_get_stream (
+                    G_DBUS_CONNECTION (source)), NULL, NULL);
+        g_dbus_proxy_call (G_DBUS_PROXY (kupdater),
+                "ClosePeer",
+                NULL,
+                G_DBUS_CALL_FLAGS_NONE,
+                -1,
+                NULL,
+                NULL,
+                NULL);
+        /* MethodFinished for OpenPeer would have come through it */
+        on_MethodFailed (kupdater, "OpenPeer", error->message);
+        g_clear_error (&error);
+        g_object_unref (kupdater);
+        return;
     }
+
+    kupdater->priv->peer = peer;
+    kupdater->priv->peer_signal_id = g_dbus_connection_signal_subscribe (peer,
+            NULL,
+            INTERFACE_NAME,
+            NULL,
+            OBJECT_PATH,
+            NULL,
+            G_DBUS_SIGNAL_FLAGS_NONE,
+            peer_signal_cb,
+            kupdater,
+            NULL);
+    /* nothing was processed until we subscribed, so nothing got lost */
+    g_dbus_connection_start_message_processing (peer);
+    g_object_unref (kupdater);
 }
-#undef emit_signal_answer
 
 static void
 kalu_updater_class_init (KaluUpdaterClass *klass)
@@ -819,6 +846,18 @@ kalu_updater_class_init (KaluUpdaterClass *klass)
             G_TYPE_UINT,
             G_TYPE_UINT);
 
+    signals[SIGNAL_IMPORT_DBS] = g_signal_new (
+            "import-dbs",
+            KALU_TYPE_UPDATER,
+            G_SIGNAL_RUN_LAST,
+            G_STRUCT_OFFSET (KaluUpdaterClass, import_dbs),
+            NULL,
+            NULL,
+            g_cclosure_marshal_VOID__INT,
+            G_TYPE_NONE,
+            1,
+            G_TYPE_INT);
+
     signals[SIGNAL_SYNC_DBS] = g_signal_new (
             "sync-dbs",
             KALU_TYPE_UPDATER,
@@ -1236,6 +1275,116 @@ gboolean    kalu_updater_init_upd           (KaluUpdater        *kupdater,
 }
 
 
+/* InitPrefetch */
+gboolean    kalu_updater_init_prefetch      (KaluUpdater        *kupdater,
+                                             GCancellable       *cancellable,
+                                             KaluMethodCallback  callback,
+                                             gpointer            data,
+                                             GError            **error)
+{
+    check ("InitPrefetch");
+
+    g_dbus_proxy_call_sync (G_DBUS_PROXY (kupdater),
+            "InitPrefetch",
+            NULL,
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            cancellable,
+            error);
+
+    end ("InitPrefetch");
+}
+
+
+/* OpenPeer */
+gboolean    kalu_updater_open_peer          (KaluUpdater        *kupdater,
+                                             GCancellable       *cancellable,
+                                             KaluMethodCallback  callback,
+                                             gpointer            data,
+                                             GError            **error)
+{
+    GVariant *ret;
+    GUnixFDList *fd_list = NULL;
+    gint32 idx;
+    gint fd;
+    GSocket *sock;
+    GSocketConnection *stream;
+
+    check ("OpenPeer");
+
+    ret = g_dbus_proxy_call_with_unix_fd_list_sync (G_DBUS_PROXY (kupdater),
+            "OpenPeer",
+            NULL,
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            NULL,
+            &fd_list,
+            cancellable,
+            error);
+    if (!ret)
+    {
+        abort_method (kupdater, "OpenPeer");
+        return FALSE;
+    }
+    g_variant_get (ret, "(h)", &idx);
+    g_variant_unref (ret);
+
+    fd = g_unix_fd_list_get (fd_list, idx, error);
+    g_object_unref (fd_list);
+    if (fd == -1)
+    {
+        abort_method (kupdater, "OpenPeer");
+        return FALSE;
+    }
+    sock = g_socket_new_from_fd (fd, error);
+    if (!sock)
+    {
+        close (fd);
+        abort_method (kupdater, "OpenPeer");
+        return FALSE;
+    }
+    stream = g_socket_connection_factory_create_connection (sock);
+    g_object_unref (sock);
+
+    /* messages are only processed once we've subscribed to signals */
+    g_dbus_connection_new (G_IO_STREAM (stream),
+            NULL,
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+            | G_DBUS_CONNECTION_FLAGS_DELAY_MESSAGE_PROCESSING,
+            NULL,
+            cancellable,
+            (GAsyncReadyCallback) peer_new_cb,
+            g_object_ref (kupdater));
+    g_object_unref (stream);
+
+    end ("OpenPeer");
+}
+
+
+/* SetDebug -- takes effect right away, there's no callback */
+gboolean    kalu_updater_set_debug          (KaluUpdater        *kupdater,
+                                             guint               level,
+                                             GCancellable       *cancellable,
+                                             GError            **error)
+{
+    GVariant *ret;
+
+    ret = g_dbus_proxy_call_sync (G_DBUS_PROXY (kupdater),
+            "SetDebug",
+            g_variant_new ("(u)", level),
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            cancellable,
+            error);
+    if (!ret)
+    {
+        return FALSE;
+    }
+    g_variant_unref (ret);
+    return TRUE;
+}
+
+
 /* InitAlpm */
 
 gboolean    kalu_updater_init_alpm          (KaluUpdater         *kupdater,
@@ -1253,6 +1402,7 @@ gboolean    kalu_updater_init_alpm          (KaluUpdater         *kupdater,
                                              alpm_list_t         *ignoregroups,
                                              alpm_list_t         *noupgrades,
                                              alpm_list_t         *noextracts,
+                                             gint                 paralleldownloads,
                                              GCancellable        *cancellable,
                                              KaluMethodCallback   callback,
                                              gpointer             data,
@@ -1297,9 +1447,36 @@ gboolean    kalu_updater_init_alpm          (KaluUpdater         *kupdater,
         g_variant_builder_add (noextracts_builder, "s", i->data);
     }
 
+    /* ask for package events to be sent in batches. This isn't supported by
+     * older versions of kalu-dbus, in which case we'll simply get the events
+     * one by one, hence errors are ignored. */
+    if (check_method (kupdater, "EnableEventBatch", NULL, NULL, NULL))
+    {
+        GError *local_err = NULL;
+        GVariant *ret;
+
+        ret = g_dbus_proxy_call_sync (G_DBUS_PROXY (kupdater),
+                "EnableEventBatch",
+                NULL,
+                G_DBUS_CALL_FLAGS_NONE,
+                -1,
+                cancellable,
+                &local_err);
+        if (ret)
+        {
+            g_variant_unref (ret);
+        }
+        if (local_err)
+        {
+            debug ("EnableEventBatch failed: %s\n", local_err->message);
+            g_clear_error (&local_err);
+            abort_method (kupdater, "EnableEventBatch");
+        }
+    }
+
     g_dbus_proxy_call_sync (G_DBUS_PROXY (kupdater),
             "InitAlpm",
-            g_variant_new ("(ssssasisbbdasasasas)",
+            g_variant_new ("(ssssasisbbdasasasasi)",
                 rootdir,
                 dbpath,
                 logfile,
@@ -1313,7 +1490,8 @@ gboolean    kalu_updater_init_alpm          (KaluUpdater         *kupdater,
                 ignorepkgs_builder,
                 ignoregroups_builder,
                 noupgrades_builder,
-                noextracts_builder),
+                noextracts_builder,
+                paralleldownloads),
             G_DBUS_CALL_FLAGS_NONE,
             -1,
             cancellable,
@@ -1366,6 +1544,29 @@ gboolean    kalu_updater_add_db             (KaluUpdater         *kupdater,
 }
 
 
+/* ImportDbs */
+
+gboolean    kalu_updater_import_dbs         (KaluUpdater         *kupdater,
+                                             const gchar         *dbpath,
+                                             GCancellable        *cancellable,
+                                             KaluMethodCallback   callback,
+                                             gpointer             data,
+                                             GError             **error)
+{
+    check ("ImportDbs");
+
+    g_dbus_proxy_call_sync (G_DBUS_PROXY (kupdater),
+            "ImportDbs",
+            g_variant_new ("(s)", dbpath),
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            cancellable,
+            error);
+
+    end ("ImportDbs");
+}
+
+
 /* SyncDbs */
 
 gboolean    kalu_updater_sync_dbs           (KaluUpdater         *kupdater,
@@ -1432,6 +1633,29 @@ gboolean    kalu_updater_sysupgrade         (KaluUpdater         *kupdater,
 }
 
 
+/* Prefetch */
+
+gboolean    kalu_updater_prefetch           (KaluUpdater         *kupdater,
+                                             guint                maxrate,
+                                             GCancellable        *cancellable,
+                                             KaluMethodCallback   callback,
+                                             gpointer             data,
+                                             GError             **error)
+{
+    check ("Prefetch");
+
+    g_dbus_proxy_call_sync (G_DBUS_PROXY (kupdater),
+            "Prefetch",
+            g_variant_new ("(u)", maxrate),
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            cancellable,
+            error);
+
+    end ("Prefetch");
+}
+
+
 /* NoSysUpgrade */
 
 gboolean    kalu_updater_no_sysupgrade      (KaluUpdater         *kupdater,
@@ -1457,6 +1681,7 @@ gboolean    kalu_updater_no_sysupgrade      (KaluUpdater         *kupdater,
 /* FreeAlpm */
 
 gboolean    kalu_updater_free_alpm          (KaluUpdater         *kupdater,
+                                             guint                keep,
                                              GCancellable        *cancellable,
                                              KaluMethodCallback   callback,
                                              gpointer             data,
@@ -1466,7 +1691,7 @@ gboolean    kalu_updater_free_alpm          (KaluUpdater         *kupdater,
 
     g_dbus_proxy_call_sync (G_DBUS_PROXY (kupdater),
             "FreeAlpm",
-            NULL,
+            g_variant_new ("(u)", keep),
             G_DBUS_CALL_FLAGS_NONE,
             -1,
             cancellable,
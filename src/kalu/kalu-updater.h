@@ -51,8 +51,10 @@ typedef struct _KaluUpdaterPrivate KaluUpdaterPrivate;
 
 typedef void (*KaluMethodCallback)      (KaluUpdater *updater, const gchar *errmsg,
                                          gpointer data);
+/* pkgs iterates over (ssssuuu): name, desc, old & new version, dl, old & new
+ * size; it (and strings borrowed from it) are only valid during the call */
 typedef void (*KaluGetPackagesCallback) (KaluUpdater *updater, const gchar *errmsg,
-                                         alpm_list_t *pkgs, gpointer data);
+                                         GVariantIter *pkgs, gpointer data);
 
 typedef struct _method_callback_t {
     const gchar        *name;
@@ -76,6 +78,29 @@ gboolean    kalu_updater_init_upd           (KaluUpdater        *updater,
                                              GError            **error);
 
 
+/* InitPrefetch */
+gboolean    kalu_updater_init_prefetch      (KaluUpdater        *updater,
+                                             GCancellable       *cancellable,
+                                             KaluMethodCallback  callback,
+                                             gpointer            data,
+                                             GError            **error);
+
+
+/* OpenPeer */
+gboolean    kalu_updater_open_peer          (KaluUpdater        *updater,
+                                             GCancellable       *cancellable,
+                                             KaluMethodCallback  callback,
+                                             gpointer            data,
+                                             GError            **error);
+
+
+/* SetDebug */
+gboolean    kalu_updater_set_debug          (KaluUpdater        *updater,
+                                             guint               level,
+                                             GCancellable       *cancellable,
+                                             GError            **error);
+
+
 /* InitAlpm */
 gboolean    kalu_updater_init_alpm          (KaluUpdater         *kupdater,
                                              gchar               *rootdir,
@@ -92,6 +117,7 @@ gboolean    kalu_updater_init_alpm          (KaluUpdater         *kupdater,
                                              alpm_list_t         *ignoregroups,
                                              alpm_list_t         *noupgrades,
                                              alpm_list_t         *noextracts,
+                                             gint                 paralleldownloads,
                                              GCancellable        *cancellable,
                                              KaluMethodCallback   callback,
                                              gpointer             data,
@@ -109,6 +135,15 @@ gboolean    kalu_updater_add_db             (KaluUpdater         *kupdater,
                                              GError             **error);
 
 
+/* ImportDbs */
+gboolean    kalu_updater_import_dbs         (KaluUpdater         *kupdater,
+                                             const gchar         *dbpath,
+                                             GCancellable        *cancellable,
+                                             KaluMethodCallback   callback,
+                                             gpointer             data,
+                                             GError             **error);
+
+
 /* SyncDbs */
 gboolean    kalu_updater_sync_dbs           (KaluUpdater         *kupdater,
                                              GCancellable        *cancellable,
@@ -134,6 +169,16 @@ gboolean    kalu_updater_sysupgrade         (KaluUpdater         *kupdater,
                                              GError             **error);
 
 
+/* Prefetch */
+
+gboolean    kalu_updater_prefetch           (KaluUpdater         *kupdater,
+                                             guint                maxrate,
+                                             GCancellable        *cancellable,
+                                             KaluMethodCallback   callback,
+                                             gpointer             data,
+                                             GError             **error);
+
+
 /* NoSysUpgrade */
 
 gboolean    kalu_updater_no_sysupgrade      (KaluUpdater         *kupdater,
@@ -143,8 +188,10 @@ gboolean    kalu_updater_no_sysupgrade      (KaluUpdater         *kupdater,
                                              GError             **error);
 
 
-/* FreeAlpm */
+/* FreeAlpm: keep is how long (in seconds) kalu-dbus should keep alpm around
+ * for the next session, before exiting */
 gboolean    kalu_updater_free_alpm          (KaluUpdater         *kupdater,
+                                             guint                keep,
                                              GCancellable        *cancellable,
                                              KaluMethodCallback   callback,
                                              gpointer             data,
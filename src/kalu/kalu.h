@@ -35,6 +35,8 @@
 
 /* kalu */
 #include "shared.h"
+#include "executor.h"
+#include "log.h"
 
 #if defined(GIT_VERSION)
 #undef PACKAGE_VERSION
@@ -108,10 +110,16 @@ enum {
     IPv6
 };
 
+/* template compiled into literal runs & placeholders, see util.c */
+typedef struct _tpl_t tpl_t;
+
 typedef struct _templates_t {
     char *title;
     char *package;
     char *sep;
+    /* compiled title & package, see compile_templates() */
+    tpl_t *c_title;
+    tpl_t *c_package;
 } templates_t;
 
 typedef struct _config_t {
@@ -121,6 +129,8 @@ typedef struct _config_t {
     check_t          checks_auto;
     int              syncdbs_in_tooltip;
     int              interval;
+    int              interval_min; /* adaptive interval; 0 when disabled */
+    int              interval_max;
     int              timeout;
     int              has_skip;
     int              skip_begin_hour;
@@ -146,6 +156,13 @@ typedef struct _config_t {
     int              use_ip;
     gboolean         auto_notifs;
     gboolean         notif_buttons;
+    gboolean         mirror_probe;
+    char            *shared_cache; /* NULL when not used */
+    int              shared_cache_max_age;
+    char            *prom_file; /* NULL when not used */
+    int              updater_idle_timeout; /* seconds kalu-dbus stays around */
+    gboolean         prefetch;
+    int              prefetch_rate; /* KiB/s, 0 for no limit */
 
     templates_t     *tpl_upgrades;
     templates_t     *tpl_watched;
@@ -217,11 +234,23 @@ typedef struct _notif_t {
 /* global variable */
 extern config_t *config;
 
-void debug (const char *fmt, ...);
+/* files can define DEBUG_SUBSYS (before including kalu.h) to have their
+ * messages tagged & filtered under their own subsystem */
+#ifndef DEBUG_SUBSYS
+#define DEBUG_SUBSYS    SUBSYS_CORE
+#endif
+#define debug(...)      do {                                \
+    if (log_enabled (DEBUG_SUBSYS, 1))                      \
+        log_msg (DEBUG_SUBSYS, __VA_ARGS__);                \
+} while (0)
 
 void free_package (kalu_package_t *package);
 void free_watched_package (watched_package_t *w_pkg);
 
-void kalu_check_work (gboolean is_auto);
+void kalu_check_work (gboolean is_auto, cancel_t *cancel);
+
+#ifdef ENABLE_ALLOC_STATS
+gboolean dump_alloc_stats (gpointer data);
+#endif
 
 #endif /* _KALU_H */
@@ -0,0 +1,355 @@
+/**
+ * kalu - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * log.c
+ * Copyright (C) 2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+
+#include <config.h>
+
+/* C */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+
+/* glib */
+#include <glib-2.0/glib.h>
+
+/* kalu */
+#include "kalu.h"
+#include "log.h"
+
+/* messages are formatted by the caller into a slot of a ring buffer, and
+ * written out (timestamp formatting, I/O) from a background thread. Slots are
+ * claimed with an atomic counter, so logging never blocks on a lock; if the
+ * ring is full, the message is dropped (and the drop reported) without the
+ * counter moving, so the writer never waits on a slot no one will fill. */
+#define RING_SIZE       256
+#define MSG_SIZE        1024
+
+enum {
+    SLOT_FREE = 0,
+    SLOT_WRITING,
+    SLOT_READY
+};
+
+typedef struct _slot_t {
+    gint            state;
+    gint64          time;
+    log_subsys_t    subsys;
+    gchar           msg[MSG_SIZE];
+} slot_t;
+
+gint log_levels[NB_SUBSYS] = { 0 };
+
+static const gchar *subsys_names[NB_SUBSYS] = {
+    "core", "alpm", "aur", "news", "gui", "updater"
+};
+
+static slot_t       ring[RING_SIZE];
+static gint         head            = 0; /* next slot to claim */
+static guint        tail            = 0; /* next slot to write (writer only) */
+static gint         dropped         = 0;
+static gint         writer_waiting  = 0;
+static gint         quit            = 0;
+static GThread     *writer          = NULL;
+static GMutex       mutex;
+static GCond        cond;
+static FILE        *output          = NULL; /* NULL for stdout */
+static gboolean     use_syslog      = FALSE;
+
+static void
+write_line (gint64 time_usec, log_subsys_t subsys, const gchar *msg)
+{
+    FILE      *f = (output) ? output : stdout;
+    time_t     now;
+    struct tm  tm;
+    char       buf[10];
+
+    if (use_syslog)
+    {
+        if (subsys == SUBSYS_CORE)
+        {
+            syslog (LOG_DEBUG, "%s", msg);
+        }
+        else
+        {
+            syslog (LOG_DEBUG, "%s: %s", subsys_names[subsys], msg);
+        }
+        return;
+    }
+
+    now = (time_t) (time_usec / G_USEC_PER_SEC);
+    localtime_r (&now, &tm);
+    strftime (buf, 10, "%H:%M:%S", &tm);
+
+    flockfile (f);
+    if (subsys == SUBSYS_CORE)
+    {
+        fprintf (f, "[%s] %s\n", buf, msg);
+    }
+    else
+    {
+        fprintf (f, "[%s] %s: %s\n", buf, subsys_names[subsys], msg);
+    }
+    funlockfile (f);
+}
+
+static gpointer
+writer_thread (gpointer data _UNUSED_)
+{
+    for (;;)
+    {
+        slot_t *slot = &ring[tail % RING_SIZE];
+        gint    nb;
+
+        if (g_atomic_int_get (&slot->state) == SLOT_READY)
+        {
+            write_line (slot->time, slot->subsys, slot->msg);
+            g_atomic_int_set (&slot->state, SLOT_FREE);
+            ++tail;
+            continue;
+        }
+
+        /* nothing (ready) to write */
+        nb = g_atomic_int_get (&dropped);
+        if (nb > 0)
+        {
+            gchar buf[64];
+
+            g_atomic_int_add (&dropped, -nb);
+            snprintf (buf, 64, "(%d debug messages dropped)", nb);
+            write_line (g_get_real_time (), SUBSYS_CORE, buf);
+        }
+        if (!use_syslog)
+        {
+            fflush ((output) ? output : stdout);
+        }
+        if (g_atomic_int_get (&quit))
+        {
+            /* write out everything that's ready, not stopping at a slot still
+             * being written (by a thread that isn't done yet) */
+            guint end = (guint) g_atomic_int_get (&head);
+
+            for ( ; tail != end; ++tail)
+            {
+                slot = &ring[tail % RING_SIZE];
+                if (g_atomic_int_get (&slot->state) == SLOT_READY)
+                {
+                    write_line (slot->time, slot->subsys, slot->msg);
+                    g_atomic_int_set (&slot->state, SLOT_FREE);
+                }
+            }
+            if (!use_syslog)
+            {
+                fflush ((output) ? output : stdout);
+            }
+            break;
+        }
+
+        /* producers only bother signaling when we're waiting. We re-check the
+         * slot after setting writer_waiting, so we can't miss a message */
+        g_mutex_lock (&mutex);
+        g_atomic_int_set (&writer_waiting, 1);
+        if (g_atomic_int_get (&slot->state) != SLOT_READY
+                && !g_atomic_int_get (&quit))
+        {
+            g_cond_wait_until (&cond, &mutex,
+                    g_get_monotonic_time () + G_TIME_SPAN_SECOND);
+        }
+        g_atomic_int_set (&writer_waiting, 0);
+        g_mutex_unlock (&mutex);
+    }
+    return NULL;
+}
+
+static gpointer
+start_writer (gpointer data _UNUSED_)
+{
+    writer = g_thread_try_new ("log writer", writer_thread, NULL, NULL);
+    return NULL;
+}
+
+void
+log_vmsg (log_subsys_t subsys, const char *fmt, va_list args)
+{
+    static GOnce  once = G_ONCE_INIT;
+    slot_t       *slot;
+    size_t        len;
+
+    g_once (&once, start_writer, NULL);
+    if (G_UNLIKELY (writer == NULL))
+    {
+        /* no thread, so write synchronously */
+        gchar msg[MSG_SIZE];
+
+        g_vsnprintf (msg, MSG_SIZE, fmt, args);
+        write_line (g_get_real_time (), subsys, msg);
+        return;
+    }
+
+    /* only claim the slot if it's free, else the writer would be stuck waiting
+     * on it (and all those after it) */
+    for (;;)
+    {
+        gint h = g_atomic_int_get (&head);
+
+        slot = &ring[(guint) h % RING_SIZE];
+        if (g_atomic_int_get (&slot->state) != SLOT_FREE)
+        {
+            /* ring is full, the writer can't keep up */
+            g_atomic_int_inc (&dropped);
+            return;
+        }
+        if (g_atomic_int_compare_and_exchange (&head, h,
+                    (gint) ((guint) h + 1)))
+        {
+            break;
+        }
+    }
+    g_atomic_int_set (&slot->state, SLOT_WRITING);
+    slot->time = g_get_real_time ();
+    slot->subsys = subsys;
+    g_vsnprintf (slot->msg, MSG_SIZE, fmt, args);
+    len = strlen (slot->msg);
+    if (len > 0 && slot->msg[len - 1] == '\n')
+    {
+        slot->msg[len - 1] = '\0';
+    }
+    g_atomic_int_set (&slot->state, SLOT_READY);
+
+    if (g_atomic_int_get (&writer_waiting))
+    {
+        g_mutex_lock (&mutex);
+        g_cond_signal (&cond);
+        g_mutex_unlock (&mutex);
+    }
+}
+
+void
+log_msg (log_subsys_t subsys, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start (args, fmt);
+    log_vmsg (subsys, fmt, args);
+    va_end (args);
+}
+
+/* sets the level of all subsystems */
+void
+log_set_level (gint level)
+{
+    gint i;
+
+    for (i = 0; i < NB_SUBSYS; ++i)
+    {
+        log_levels[i] = level;
+    }
+}
+
+/* spec is a comma-separated list of subsys=level, e.g. "alpm=3,gui=0" */
+gboolean
+log_parse_levels (const gchar *spec, GError **error)
+{
+    gchar **items, **item;
+    gint    i;
+
+    items = g_strsplit (spec, ",", 0);
+    for (item = items; *item; ++item)
+    {
+        gchar *s;
+
+        s = strchr (*item, '=');
+        if (s)
+        {
+            *s++ = '\0';
+        }
+        for (i = 0; i < NB_SUBSYS; ++i)
+        {
+            if (streq (*item, subsys_names[i]))
+            {
+                break;
+            }
+        }
+        if (s == NULL || i == NB_SUBSYS)
+        {
+            g_set_error (error, KALU_ERROR, 1,
+                    _("Invalid debug level: %s"), *item);
+            g_strfreev (items);
+            return FALSE;
+        }
+        log_levels[i] = atoi (s);
+    }
+    g_strfreev (items);
+    return TRUE;
+}
+
+/* target is "syslog" (e.g. for the journal), "-" for stdout, else a file
+ * (appended to). Must be called before anything is logged */
+gboolean
+log_set_output (const gchar *target, GError **error)
+{
+    if (streq (target, "-"))
+    {
+        return TRUE;
+    }
+    if (streq (target, "syslog"))
+    {
+        openlog (PACKAGE_NAME, LOG_PID, LOG_USER);
+        use_syslog = TRUE;
+        return TRUE;
+    }
+
+    output = fopen (target, "a");
+    if (output == NULL)
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to open %s: %s"),
+                target, strerror (errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* writes out whatever is pending, and stops the writer */
+void
+log_free (void)
+{
+    if (writer != NULL)
+    {
+        g_atomic_int_set (&quit, 1);
+        g_mutex_lock (&mutex);
+        g_cond_signal (&cond);
+        g_mutex_unlock (&mutex);
+        g_thread_join (writer);
+        writer = NULL;
+    }
+    if (output != NULL)
+    {
+        fclose (output);
+        output = NULL;
+    }
+    if (use_syslog)
+    {
+        closelog ();
+        use_syslog = FALSE;
+    }
+}
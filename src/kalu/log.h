@@ -0,0 +1,66 @@
+/**
+ * kalu - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * log.h
+ * Copyright (C) 2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _KALU_LOG_H
+#define _KALU_LOG_H
+
+/* C */
+#include <stdarg.h>
+
+/* glib */
+#include <glib-2.0/glib.h>
+
+typedef enum {
+    SUBSYS_CORE = 0,
+    SUBSYS_ALPM,
+    SUBSYS_AUR,
+    SUBSYS_NEWS,
+    SUBSYS_GUI,
+    SUBSYS_UPDATER,
+    NB_SUBSYS
+} log_subsys_t;
+
+extern gint log_levels[NB_SUBSYS];
+
+/* so callers can skip formatting (& evaluating args) when disabled */
+#define log_enabled(subsys, level)  (log_levels[subsys] >= (level))
+
+void
+log_msg (log_subsys_t subsys, const char *fmt, ...) G_GNUC_PRINTF (2, 3);
+
+void
+log_vmsg (log_subsys_t subsys, const char *fmt, va_list args);
+
+void
+log_set_level (gint level);
+
+gboolean
+log_parse_levels (const gchar *spec, GError **error);
+
+gboolean
+log_set_output (const gchar *target, GError **error);
+
+void
+log_free (void);
+
+#endif /* _KALU_LOG_H */
@@ -25,7 +25,6 @@
 /* C */
 #include <locale.h>
 #include <string.h>
-#include <time.h> /* for debug() */
 
 /* alpm */
 #include <alpm.h>
@@ -34,17 +33,32 @@
 /* curl */
 #include <curl/curl.h>
 
+#ifdef ENABLE_ALLOC_STATS
+#include <signal.h>
+/* glib */
+#include <glib-unix.h>
+#endif
+
 /* kalu */
 #include "kalu.h"
 #ifndef DISABLE_GUI
 #include "gui.h"
 #include "util-gtk.h"
 #endif
+#ifndef DISABLE_UPDATER
+#include "prefetch.h"
+#endif
 #include "kalu-alpm.h"
 #include "conf.h"
 #include "util.h"
+#include "executor.h"
+#include "stats.h"
+#include "prom.h"
 #include "aur.h"
 #include "news.h"
+#ifdef DISABLE_GUI
+#include "daemon.h"
+#endif
 
 
 /* global variable */
@@ -59,11 +73,13 @@ static void free_config (void);
 static inline void
 do_notify_error (const gchar *summary, const gchar *text)
 {
-    fprintf (stderr, "%s\n", summary);
-    if (text)
-    {
-        fprintf (stderr, "%s\n", text);
-    }
+    daemon_report (summary, text, TRUE);
+}
+
+static inline void
+do_report (const gchar *summary, const gchar *text)
+{
+    daemon_report (summary, text, FALSE);
 }
 
 static void
@@ -104,6 +120,16 @@ do_notify_error (const gchar *summary, const gchar *text)
     }
 }
 
+static inline void
+do_report (const gchar *summary, const gchar *text)
+{
+    puts (summary);
+    if (text)
+    {
+        puts (text);
+    }
+}
+
 static void
 do_show_error (const gchar *message, const gchar *submessage, GtkWindow *parent)
 {
@@ -123,6 +149,10 @@ do_show_error (const gchar *message, const gchar *submessage, GtkWindow *parent)
 
 #endif /* DISABLE_GUI*/
 
+/* notifications (& what's kept in last_notifs) accounted separately */
+#undef ALLOC_TAG
+#define ALLOC_TAG       "notifs"
+
 static void
 notify_updates (
         alpm_list_t *packages,
@@ -132,24 +162,15 @@ notify_updates (
         )
 {
     alpm_list_t     *i;
-
-    int              nb          = 0;
-    int              net_size;
-    off_t            dsize       = 0;
-    off_t            isize       = 0;
-    off_t            nsize       = 0;
-
     gchar           *summary;
     gchar           *text;
-    unsigned int     alloc;
-    unsigned int     len;
     char             buf[255];
-    char            *s;
-    char            *b;
+    char             dl[32], net[32], ins[32];
+    const char      *values[NB_TPL_VARS] = { NULL };
     templates_t      template;
+    tpl_totals_t     totals;
     const char      *unit;
     double           size_h;
-    replacement_t   *replacements[8];
     gboolean         escaping = FALSE;
     GString         *string_pkgs = NULL;     /* list of AUR packages */
 
@@ -192,178 +213,57 @@ notify_updates (
         tt = config->tpl_news;
     }
     /* set the templates to use */
-    template.title = (tt && tt->title) ? tt->title : t->title;
-    template.package = (tt && tt->package) ? tt->package : t->package;
+    template.c_title = (tt && tt->title) ? tt->c_title : t->c_title;
+    template.c_package = (tt && tt->package) ? tt->c_package : t->c_package;
     template.sep = (tt && tt->sep) ? tt->sep : t->sep;
     /* watched-aur might have fallen back to aur, which itself needs to fallback */
     if (type & CHECK_WATCHED_AUR)
     {
         t = config->tpl_upgrades;
-        template.title = (template.title) ? template.title : t->title;
-        template.package = (template.package) ? template.package : t->package;
+        template.c_title = (template.c_title) ? template.c_title : t->c_title;
+        template.c_package = (template.c_package)
+            ? template.c_package : t->c_package;
         template.sep = (template.sep) ? template.sep : t->sep;
     }
 
-    alloc = 1024;
-    text = new (gchar, alloc + 1);
-    len = 0;
+    text = render_packages (template.c_package, template.sep, packages,
+            (type & CHECK_NEWS), escaping, &totals);
 
-    FOR_LIST (i, packages)
+    /* construct list of packages, for use in cmdline */
+    if (string_pkgs)
     {
-        ++nb;
-        if (type & CHECK_NEWS)
-        {
-            replacements[0] = new0 (replacement_t, 1);
-            replacements[0]->name = "NEWS";
-            replacements[0]->value = i->data;
-            replacements[0]->need_escaping = TRUE;
-            replacements[1] = NULL;
-
-            /* add separator? */
-            if (nb > 1)
-            {
-                s = text + len;
-                for (b = template.sep; *b; ++b, ++s, ++len)
-                {
-                    *s = *b;
-                }
-            }
-
-            parse_tpl (template.package, &text, &len, &alloc,
-                    replacements, escaping);
-
-            free (replacements[0]);
-
-            debug ("-> %s", (char *) i->data);
-        }
-        else
+        FOR_LIST (i, packages)
         {
             kalu_package_t *pkg = i->data;
 
-            net_size = (int) (pkg->new_size - pkg->old_size);
-            dsize += pkg->dl_size;
-            isize += pkg->new_size;
-            nsize += net_size;
-
-            replacements[0] = new0 (replacement_t, 1);
-            replacements[0]->name = "PKG";
-            replacements[0]->value = pkg->name;
-            replacements[0]->need_escaping = TRUE;
-            replacements[1] = new0 (replacement_t, 1);
-            replacements[1]->name = "OLD";
-            replacements[1]->value = pkg->old_version;
-            replacements[2] = new0 (replacement_t, 1);
-            replacements[2]->name = "NEW";
-            replacements[2]->value = pkg->new_version;
-            replacements[3] = new0 (replacement_t, 1);
-            replacements[3]->name = "DL";
-            size_h = humanize_size (pkg->dl_size, '\0', &unit);
-            snprint_size (buf, 255, size_h, unit);
-            replacements[3]->value = strdup (buf);
-            replacements[4] = new0 (replacement_t, 1);
-            replacements[4]->name = "INS";
-            size_h = humanize_size (pkg->new_size, '\0', &unit);
-            snprint_size (buf, 255, size_h, unit);
-            replacements[4]->value = strdup (buf);
-            replacements[5] = new0 (replacement_t, 1);
-            replacements[5]->name = "NET";
-            size_h = humanize_size (net_size, '\0', &unit);
-            snprint_size (buf, 255, size_h, unit);
-            replacements[5]->value = strdup (buf);
-            replacements[6] = new0 (replacement_t, 1);
-            replacements[6]->name = "DESC";
-            replacements[6]->value = pkg->desc;
-            replacements[6]->need_escaping = TRUE;
-            replacements[7] = NULL;
-
-            /* add separator? */
-            if (nb > 1)
-            {
-                s = text + len;
-                for (b = template.sep; *b; ++b, ++s, ++len)
-                {
-                    *s = *b;
-                }
-            }
-
-            parse_tpl (template.package, &text, &len, &alloc,
-                    replacements, escaping);
-
-            free (replacements[3]->value);
-            free (replacements[4]->value);
-            free (replacements[5]->value);
-            for (int j = 0; j < 7; ++j)
-                free (replacements[j]);
-
-            debug ("-> %s %s -> %s [dl=%d; ins=%d]",
-                    pkg->name,
-                    pkg->old_version,
-                    pkg->new_version,
-                    (int) pkg->dl_size,
-                    (int) pkg->new_size);
-
-            /* construct list of packages, for use in cmdline */
-            if (string_pkgs)
-            {
-                string_pkgs = g_string_append (string_pkgs, pkg->name);
-                string_pkgs = g_string_append_c (string_pkgs, ' ');
-            }
+            string_pkgs = g_string_append (string_pkgs, pkg->name);
+            string_pkgs = g_string_append_c (string_pkgs, ' ');
         }
     }
 
-    alloc = 255;
-    summary = new (gchar, alloc + 1);
-    len = 0;
-
-    replacements[0] = new0 (replacement_t, 1);
-    replacements[0]->name = "NB";
-    snprintf (buf, 255, "%d", nb);
-    replacements[0]->value = strdup (buf);
-    if (type & CHECK_NEWS)
-    {
-        replacements[1] = NULL;
-    }
-    else
-    {
-        replacements[1] = new0 (replacement_t, 1);
-        replacements[1]->name = "DL";
-        size_h = humanize_size (dsize, '\0', &unit);
-        snprint_size (buf, 255, size_h, unit);
-        replacements[1]->value = strdup (buf);
-        replacements[2] = new0 (replacement_t, 1);
-        replacements[2]->name = "NET";
-        size_h = humanize_size (nsize, '\0', &unit);
-        snprint_size (buf, 255, size_h, unit);
-        replacements[2]->value = strdup (buf);
-        replacements[3] = new0 (replacement_t, 1);
-        replacements[3]->name = "INS";
-        size_h = humanize_size (isize, '\0', &unit);
-        snprint_size (buf, 255, size_h, unit);
-        replacements[3]->value = strdup (buf);
-        replacements[4] = NULL;
-    }
-
-    parse_tpl (template.title, &summary, &len, &alloc,
-            replacements, escaping);
-
-    free (replacements[0]->value);
-    free (replacements[0]);
+    snprintf (buf, 255, "%d", totals.nb);
+    values[TPL_NB] = buf;
     if (!(type & CHECK_NEWS))
     {
-        free (replacements[1]->value);
-        free (replacements[2]->value);
-        free (replacements[3]->value);
-        free (replacements[1]);
-        free (replacements[2]);
-        free (replacements[3]);
+        size_h = humanize_size (totals.dsize, '\0', &unit);
+        snprint_size (dl, 32, size_h, unit);
+        values[TPL_DL] = dl;
+        size_h = humanize_size (totals.nsize, '\0', &unit);
+        snprint_size (net, 32, size_h, unit);
+        values[TPL_NET] = net;
+        size_h = humanize_size (totals.isize, '\0', &unit);
+        snprint_size (ins, 32, size_h, unit);
+        values[TPL_INS] = ins;
     }
 
+    summary = new (gchar, tpl_len (template.c_title, values, escaping) + 1);
+    *tpl_render (template.c_title, summary, values, escaping) = '\0';
+
 #ifndef DISABLE_GUI
     if (is_cli)
     {
 #endif
-        puts (summary);
-        puts (text);
+        do_report (summary, text);
         free (summary);
         free (text);
         return;
@@ -411,335 +311,585 @@ notify_updates (
 #endif /* DISABLE_GUI */
 }
 
-void
-kalu_check_work (gboolean is_auto)
-{
-    GError      *error = NULL;
+#undef ALLOC_TAG
+#define ALLOC_TAG       "core"
+
+/* stages of a check. Each one is run on the worker pool, they only fill
+ * their results in check_data_t; notifications are then all done from
+ * kalu_check_work, once every stage is done. */
+typedef enum {
+    STAGE_NEWS = 1,
+    STAGE_ALPM,         /* load, syncdbs, upgrades, watched & foreign pkgs */
+    STAGE_AUR,          /* queued by STAGE_ALPM, once foreign pkgs are known */
+    STAGE_AUR_NEW,      /* queued by STAGE_ALPM, for pkgs foreign after sync */
+    STAGE_WATCHED_AUR
+} stage_t;
+
+typedef struct _stage_result_t {
+    gboolean     has_run;
+    gboolean     has_updates;
     alpm_list_t *packages;
-    alpm_list_t *aur_pkgs;
-    gchar       *xml_news;
-    gboolean     got_something  = FALSE;
-    gint         nb_syncdbs     = -1;
-#ifndef DISABLE_GUI
-    gint         nb_upgrades    = -1;
-    gint         nb_watched     = -1;
-    gint         nb_aur         = -1;
-    gint         nb_watched_aur = -1;
-    gint         nb_news        = -1;
-#endif /* DISABLE_GUI */
-    unsigned int checks         = (is_auto)
-        ? config->checks_auto
-        : config->checks_manual;
-    gboolean     show_it        = (is_auto) ? config->auto_notifs : TRUE;
-
-#ifndef DISABLE_GUI
-    /* drop the list of last notifs, since we'll be making up a new one */
-    debug ("drop last_notifs");
-    FREE_NOTIFS_LIST (config->last_notifs);
-#endif
-
-    /* we will not free packages nor xml_news, because they'll be stored in
-     * notif_t (inside config->last_notifs) so we can re-show notifications.
-     * Everything gets free-d through the FREE_NOTIFS_LIST above */
+    GError      *error;
+} stage_result_t;
+
+typedef struct _check_data_t {
+    unsigned int    checks;
+    cancel_t       *cancel;
+    GMutex          mutex;
+    GCond           cond;
+    gint            pending; /* nb of stages queued or running */
+
+    /* failure to load alpm/sync dbs, aborting all alpm-based checks */
+    const gchar    *alpm_summary;
+    GError         *alpm_error;
+    gint            nb_syncdbs;
+
+    gchar          *xml_news;
+    alpm_list_t    *foreign;        /* foreign pkgs, before syncdbs */
+    alpm_list_t    *foreign_synced; /* foreign pkgs, after syncdbs */
+    alpm_list_t    *foreign_new;    /* in foreign_synced but not foreign */
+    gboolean        is_foreign_synced;
+    stage_result_t  news;
+    stage_result_t  upgrades;
+    stage_result_t  watched;
+    stage_result_t  aur;
+    stage_result_t  aur_new;
+    stage_result_t  watched_aur;
+} check_data_t;
+
+typedef struct _stage_job_t {
+    stage_t         stage;
+    check_data_t   *cd;
+} stage_job_t;
+
+static void run_stage (gpointer stage, check_data_t *cd);
+static void stage_done (check_data_t *cd, stage_result_t *res);
+
+static watched_package_t *
+find_watched_package (alpm_list_t *list, const char *name)
+{
+    alpm_list_t *i;
 
-    if (checks & CHECK_NEWS)
+    FOR_LIST (i, list)
     {
-        packages = NULL;
-        if (news_has_updates (&packages, &xml_news, &error))
-        {
-            got_something = TRUE;
-#ifndef DISABLE_GUI
-            nb_news = (gint) alpm_list_count (packages);
-#endif /* DISABLE_GUI */
-            notify_updates (packages, CHECK_NEWS, xml_news, show_it);
-            FREELIST (packages);
-        }
-        else if (error != NULL)
+        if (streq (((watched_package_t *) i->data)->name, name))
         {
-            do_notify_error (_("Unable to check the news"), error->message);
-            g_clear_error (&error);
+            return i->data;
         }
-#ifndef DISABLE_GUI
-        else
-        {
-            nb_news = 0;
-        }
-        if (nb_news >= 0)
+    }
+    return NULL;
+}
+
+/* the AUR was queried using the list of foreign packages from before
+ * syncdbs; drop packages that are now in a repo, and add the results for
+ * those that left the repos meanwhile */
+static void
+reconcile_aur (check_data_t *cd)
+{
+    alpm_list_t *i, *next;
+
+    if (!cd->is_foreign_synced)
+    {
+        return;
+    }
+
+    for (i = cd->aur.packages; i; i = next)
+    {
+        kalu_package_t *pkg = i->data;
+
+        next = i->next;
+        if (!find_watched_package (cd->foreign_synced, pkg->name))
         {
-            set_kalpm_nb (CHECK_NEWS, nb_news, FALSE);
+            debug ("%s no longer foreign, ignoring AUR update", pkg->name);
+            cd->aur.packages = alpm_list_remove_item (cd->aur.packages, i);
+            free (i);
+            free_package (pkg);
         }
-#endif /* DISABLE_GUI */
     }
 
-    /* ALPM is required even for AUR only, since we get the list of foreign
-     * packages from localdb (however we can skip sync-ing dbs then) */
-    if (checks & (CHECK_UPGRADES | CHECK_WATCHED | CHECK_AUR))
+    if (cd->aur_new.has_run)
     {
-        if (!kalu_alpm_load (config->pacmanconf, &error))
+        if (cd->aur_new.error != NULL && cd->aur.error == NULL)
         {
-            do_notify_error (
-                    _("Unable to check for updates -- loading alpm library failed"),
-                    error->message);
-            g_clear_error (&error);
-#ifndef DISABLE_GUI
-            if (!is_cli)
-            {
-                set_kalpm_busy (FALSE);
-            }
-#endif
-            return;
+            cd->aur.error = cd->aur_new.error;
+            cd->aur_new.error = NULL;
         }
+        g_clear_error (&cd->aur_new.error);
+        cd->aur.packages = alpm_list_join (cd->aur.packages,
+                cd->aur_new.packages);
+        cd->aur_new.packages = NULL;
+    }
 
-        /* syncdbs only if needed */
-        if (checks & (CHECK_UPGRADES | CHECK_WATCHED)
-                && !kalu_alpm_syncdbs (&nb_syncdbs, &error))
-        {
-            do_notify_error (
-                    _("Unable to check for updates -- could not synchronize databases"),
-                    error->message);
-            g_clear_error (&error);
-            kalu_alpm_free ();
-#ifndef DISABLE_GUI
-            if (!is_cli)
+    cd->aur.has_updates = (cd->aur.error == NULL && cd->aur.packages != NULL);
+}
+
+static void
+stage_job (stage_job_t *sj, cancel_t *cancel)
+{
+    if (cancel_is_cancelled (cancel))
+    {
+        debug ("check cancelled, skipping stage %d", sj->stage);
+        stage_done (sj->cd, NULL);
+    }
+    else
+    {
+        run_stage (GINT_TO_POINTER (sj->stage), sj->cd);
+    }
+    free (sj);
+}
+
+static void
+queue_stage (check_data_t *cd, stage_t stage)
+{
+    GError      *error = NULL;
+    stage_job_t *sj;
+
+    g_mutex_lock (&cd->mutex);
+    ++cd->pending;
+    g_mutex_unlock (&cd->mutex);
+
+    sj = new (stage_job_t, 1);
+    sj->stage = stage;
+    sj->cd = cd;
+    if (!executor_run (JOB_STAGE, (job_fn) stage_job, sj, cd->cancel, &error))
+    {
+        /* no pool, run it right here */
+        debug ("unable to queue stage %d: %s", stage, error->message);
+        g_clear_error (&error);
+        stage_job (sj, cd->cancel);
+    }
+}
+
+static void
+run_stage (gpointer stage, check_data_t *cd)
+{
+    stage_result_t *res = NULL;
+    gboolean        reconcile = FALSE;
+
+    switch ((stage_t) GPOINTER_TO_INT (stage))
+    {
+        case STAGE_NEWS:
+            res = &cd->news;
+            res->has_updates = news_has_updates (&res->packages, &cd->xml_news,
+                    cd->cancel, &res->error);
+            break;
+
+        case STAGE_ALPM:
+            /* ALPM is required even for AUR only, since we get the list of
+             * foreign packages from localdb (however we can skip sync-ing dbs
+             * then) */
+            if (!kalu_alpm_load (config->pacmanconf, &cd->alpm_error))
             {
-                set_kalpm_busy (FALSE);
+                cd->alpm_summary = _("Unable to check for updates -- loading alpm library failed");
+                break;
             }
-#endif
-            return;
-        }
-#ifndef DISABLE_GUI
-        if (nb_syncdbs >= 0)
-        {
-            set_kalpm_nb_syncdbs (nb_syncdbs);
-        }
-#endif
 
-        if (checks & CHECK_UPGRADES)
-        {
-            packages = NULL;
-            if (kalu_alpm_has_updates (&packages, &error))
+            /* foreign packages only depend on localdb & our copy of the
+             * sync dbs, and are copied out of alpm; so the AUR can be queried
+             * while we sync dbs & compute upgrades. Packages that moved
+             * between repos & the AUR meanwhile are reconciled after. */
+            if (cd->checks & CHECK_AUR)
             {
-                got_something = TRUE;
-#ifndef DISABLE_GUI
-                nb_upgrades = (gint) alpm_list_count (packages);
-#endif /* DISABLE_GUI */
-                notify_updates (packages, CHECK_UPGRADES, NULL, show_it);
+                if (kalu_alpm_has_foreign (&cd->foreign, config->aur_ignore,
+                            &cd->aur.error))
+                {
+                    reconcile = TRUE;
+                    queue_stage (cd, STAGE_AUR);
+                }
+                else
+                {
+                    cd->aur.has_run = TRUE;
+                    reconcile = (cd->aur.error == NULL);
+                }
             }
-#ifndef DISABLE_GUI
-            else if (error == NULL)
+
+            /* syncdbs only if needed */
+            if (cd->checks & (CHECK_UPGRADES | CHECK_WATCHED))
             {
-                nb_upgrades = 0;
-            }
-            else
-#else
-                else if (error != NULL)
-#endif /* DISABLE_GUI */
+                if (!kalu_alpm_syncdbs (&cd->nb_syncdbs, cd->cancel,
+                            &cd->alpm_error))
                 {
-                    got_something = TRUE;
-                    /* means the error is likely to come from a dependency issue/conflict */
-                    if (error->code == 2)
+                    cd->alpm_summary = _("Unable to check for updates -- could not synchronize databases");
+                    kalu_alpm_free ();
+                    break;
+                }
+
+                if (reconcile && cd->nb_syncdbs > 0)
+                {
+                    alpm_list_t *i;
+                    GError *error = NULL;
+
+                    kalu_alpm_has_foreign (&cd->foreign_synced,
+                            config->aur_ignore, &error);
+                    if (error != NULL)
                     {
-#ifndef DISABLE_GUI
-                        if (!is_cli)
-                        {
-                            /* we do the notification (instead of calling
-                             * notify_error) because we need to add the
-                             * "Update system" button/action. */
-                            NotifyNotification *notification;
-                            notif_t *notif;
-
-                            notif = new (notif_t, 1);
-                            notif->type = CHECK_UPGRADES;
-                            notif->summary = strdup (_("Unable to compile list of packages"));
-                            notif->text = strdup (error->message);
-                            notif->data = NULL;
-
-                            notification = new_notification (notif->summary,
-                                    notif->text);
-                            if (config->action != UPGRADE_NO_ACTION)
-                            {
-                                notify_notification_add_action (notification,
-                                        "do_updates",
-                                        _c("notif-button", "Update system..."),
-                                        (NotifyActionCallback) action_upgrade,
-                                        NULL,
-                                        NULL);
-                            }
-                            /* we use a callback on "closed" to unref it,
-                             * because when there's an action we need to keep
-                             * a ref, otherwise said action won't work */
-                            g_signal_connect (G_OBJECT (notification),
-                                    "closed",
-                                    G_CALLBACK (notification_closed_cb),
-                                    NULL);
-                            /* add the notif to the last of last notifications,
-                             * so we can re-show it later */
-                            debug ("adding new notif (%s) to last_notifs",
-                                    notif->summary);
-                            config->last_notifs = alpm_list_add (
-                                    config->last_notifs,
-                                    notif);
-                            /* show notif */
-                            notify_notification_show (notification, NULL);
-                            /* mark icon blue, upgrades are available, we just
-                             * don't know which/how many (due to the conflict) */
-                            nb_upgrades = UPGRADES_NB_CONFLICT;
-                        }
-                        else
+                        /* we'll just stick with the pre-sync list */
+                        debug ("unable to reconcile foreign packages: %s",
+                                error->message);
+                        g_clear_error (&error);
+                        FREE_WATCHED_PACKAGE_LIST (cd->foreign_synced);
+                    }
+                    else
+                    {
+                        cd->is_foreign_synced = TRUE;
+                    }
+                    FOR_LIST (i, cd->foreign_synced)
+                    {
+                        if (!find_watched_package (cd->foreign,
+                                    ((watched_package_t *) i->data)->name))
                         {
-#endif
-                            do_notify_error (
-                                    _("Unable to compile list of packages"),
-                                    error->message);
-#ifndef DISABLE_GUI
+                            cd->foreign_new = alpm_list_add (cd->foreign_new,
+                                    i->data);
                         }
-#endif
                     }
-                    else
+                    if (cd->foreign_new)
                     {
-                        do_notify_error (
-                                _("Unable to check for updates"),
-                                error->message);
+                        queue_stage (cd, STAGE_AUR_NEW);
                     }
-                    g_clear_error (&error);
-                }
-#ifndef DISABLE_GUI
-                if (nb_upgrades >= 0 || nb_upgrades == UPGRADES_NB_CONFLICT)
-                {
-                    set_kalpm_nb (CHECK_UPGRADES, nb_upgrades, FALSE);
                 }
-#endif
-        }
+            }
 
-        if (checks & CHECK_WATCHED && config->watched /* NULL if no watched pkgs */)
-        {
-            packages = NULL;
-            if (kalu_alpm_has_updates_watched (&packages,
-                        config->watched,
-                        &error))
+            if (cancel_is_cancelled (cd->cancel))
             {
-                got_something = TRUE;
-#ifndef DISABLE_GUI
-                nb_watched = (gint) alpm_list_count (packages);
-#endif
-                notify_updates (packages, CHECK_WATCHED, NULL, show_it);
+                kalu_alpm_free ();
+                break;
             }
-#ifndef DISABLE_GUI
-            else if (error == NULL)
+
+            if (cd->checks & CHECK_UPGRADES)
             {
-                nb_watched = 0;
+                cd->upgrades.has_run = TRUE;
+                cd->upgrades.has_updates = kalu_alpm_has_updates (
+                        &cd->upgrades.packages,
+                        &cd->upgrades.error);
             }
-            else
-#else
-                else if (error != NULL)
-#endif
-                {
-                    got_something = TRUE;
-                    do_notify_error (
-                            _("Unable to check for updates of watched packages"),
-                            error->message);
-                    g_clear_error (&error);
-                }
+
+            if (cd->checks & CHECK_WATCHED && config->watched /* NULL if no watched pkgs */)
+            {
+                cd->watched.has_run = TRUE;
+                cd->watched.has_updates = kalu_alpm_has_updates_watched (
+                        &cd->watched.packages,
+                        config->watched,
+                        &cd->watched.error);
+            }
+
+            kalu_alpm_free ();
+            break;
+
+        case STAGE_AUR:
+            res = &cd->aur;
+            res->has_updates = aur_has_updates (&res->packages, cd->foreign,
+                    FALSE, cd->cancel, &res->error);
+            break;
+
+        case STAGE_AUR_NEW:
+            res = &cd->aur_new;
+            res->has_updates = aur_has_updates (&res->packages,
+                    cd->foreign_new, FALSE, cd->cancel, &res->error);
+            break;
+
+        case STAGE_WATCHED_AUR:
+            res = &cd->watched_aur;
+            res->has_updates = aur_has_updates (&res->packages,
+                    config->watched_aur, TRUE, cd->cancel, &res->error);
+            break;
+    }
+
+    stage_done (cd, res);
+}
+
+static void
+stage_done (check_data_t *cd, stage_result_t *res)
+{
+    g_mutex_lock (&cd->mutex);
+    if (res != NULL)
+    {
+        res->has_run = TRUE;
+    }
+    if (--cd->pending == 0)
+    {
+        g_cond_signal (&cd->cond);
+    }
+    g_mutex_unlock (&cd->mutex);
+}
+
+/* returns the nb of packages, 0 if none, or -1 on error (after notifying it) */
+static gint
+notify_stage (stage_result_t *res, check_t type, gchar *xml_news,
+        gboolean show_it, const gchar *err_summary, gboolean *got_something)
+{
+    if (res->has_updates)
+    {
+        gint nb = (gint) alpm_list_count (res->packages);
+
+        *got_something = TRUE;
+        notify_updates (res->packages, type, xml_news, show_it);
+        return nb;
+    }
+    else if (res->error != NULL)
+    {
+        *got_something = TRUE;
+        do_notify_error (err_summary, res->error->message);
+        g_clear_error (&res->error);
+        return -1;
+    }
+    return 0;
+}
+
+/* the check was cancelled, drop whatever results we got */
+static void
+drop_results (check_data_t *cd)
+{
+    FREELIST (cd->news.packages);
+    free (cd->xml_news);
+    FREE_PACKAGE_LIST (cd->upgrades.packages);
+    FREE_PACKAGE_LIST (cd->watched.packages);
+    FREE_PACKAGE_LIST (cd->aur.packages);
+    FREE_PACKAGE_LIST (cd->aur_new.packages);
+    FREE_PACKAGE_LIST (cd->watched_aur.packages);
+    FREE_WATCHED_PACKAGE_LIST (cd->foreign);
+    /* items are shared with foreign_synced */
+    alpm_list_free (cd->foreign_new);
+    FREE_WATCHED_PACKAGE_LIST (cd->foreign_synced);
+
+    g_clear_error (&cd->alpm_error);
+    g_clear_error (&cd->news.error);
+    g_clear_error (&cd->upgrades.error);
+    g_clear_error (&cd->watched.error);
+    g_clear_error (&cd->aur.error);
+    g_clear_error (&cd->aur_new.error);
+    g_clear_error (&cd->watched_aur.error);
+}
+
+/* cancel (can be NULL) is checked by all stages, and aborts downloads in
+ * progress (incl. dbs), so a check can be interrupted when pausing/quitting */
+void
+kalu_check_work (gboolean is_auto, cancel_t *cancel)
+{
+    check_data_t cd;
+    gboolean     got_something  = FALSE;
+    gint         nb;
+    unsigned int checks         = (is_auto)
+        ? config->checks_auto
+        : config->checks_manual;
+    gboolean     show_it        = (is_auto) ? config->auto_notifs : TRUE;
+    gint64       start          = stats_now ();
+    gint64       start_notifs;
+
 #ifndef DISABLE_GUI
-                if (nb_watched >= 0)
-                {
-                    set_kalpm_nb (CHECK_WATCHED, nb_watched, FALSE);
-                }
+    /* drop the list of last notifs, since we'll be making up a new one */
+    debug ("drop last_notifs");
+    FREE_NOTIFS_LIST (config->last_notifs);
 #endif
+
+    stats_check_begin ();
+    prom_check_begin ();
+    zero (cd);
+    cd.checks = checks;
+    cd.cancel = cancel;
+    cd.nb_syncdbs = -1;
+    g_mutex_init (&cd.mutex);
+    g_cond_init (&cd.cond);
+
+    /* news, AUR & the whole alpm chain (which only use a single handle) are
+     * independent, so we run them concurrently */
+    if (checks & (CHECK_UPGRADES | CHECK_WATCHED | CHECK_AUR))
+    {
+        queue_stage (&cd, STAGE_ALPM);
+    }
+    if (checks & CHECK_NEWS)
+    {
+        queue_stage (&cd, STAGE_NEWS);
+    }
+    if (checks & CHECK_WATCHED_AUR && config->watched_aur /* NULL if not watched aur pkgs */)
+    {
+        queue_stage (&cd, STAGE_WATCHED_AUR);
+    }
+
+    /* wait for all stages, including STAGE_AUR which might only get queued
+     * from STAGE_ALPM */
+    g_mutex_lock (&cd.mutex);
+    while (cd.pending > 0)
+    {
+        g_cond_wait (&cd.cond, &cd.mutex);
+    }
+    g_mutex_unlock (&cd.mutex);
+    g_mutex_clear (&cd.mutex);
+    g_cond_clear (&cd.cond);
+
+    if (cancel_is_cancelled (cancel))
+    {
+        debug ("check cancelled");
+        drop_results (&cd);
+#ifndef DISABLE_GUI
+        if (!is_cli)
+        {
+            set_kalpm_busy (FALSE);
         }
+#endif
+        return;
+    }
 
-        if (checks & CHECK_AUR)
+    /* we will not free packages nor xml_news, because they'll be stored in
+     * notif_t (inside config->last_notifs) so we can re-show notifications.
+     * Everything gets free-d through the FREE_NOTIFS_LIST above */
+
+    start_notifs = stats_now ();
+
+    if (cd.news.has_run)
+    {
+        nb = notify_stage (&cd.news, CHECK_NEWS, cd.xml_news, show_it,
+                _("Unable to check the news"), &got_something);
+        FREELIST (cd.news.packages);
+        prom_set (CHECK_NEWS, nb);
+#ifndef DISABLE_GUI
+        if (nb >= 0)
         {
-            aur_pkgs = NULL;
-            if (kalu_alpm_has_foreign (&aur_pkgs, config->aur_ignore, &error))
-            {
-                packages = NULL;
-                if (aur_has_updates (&packages, aur_pkgs, FALSE, &error))
-                {
-                    got_something = TRUE;
+            set_kalpm_nb (CHECK_NEWS, nb, FALSE);
+        }
+#endif /* DISABLE_GUI */
+    }
+
+    /* adapt the interval for next auto-check, based on whether mirrors were
+     * updated or not */
+    update_interval ((cd.alpm_error == NULL) ? cd.nb_syncdbs : -1);
+
+    if (cd.alpm_error != NULL)
+    {
+        got_something = TRUE;
+        do_notify_error (cd.alpm_summary, cd.alpm_error->message);
+        g_clear_error (&cd.alpm_error);
+        prom_set_syncdbs (-1);
+    }
+    else if (cd.nb_syncdbs >= 0)
+    {
+        prom_set_syncdbs (cd.nb_syncdbs);
 #ifndef DISABLE_GUI
-                    nb_aur = (gint) alpm_list_count (packages);
+        set_kalpm_nb_syncdbs (cd.nb_syncdbs);
 #endif
-                    notify_updates (packages, CHECK_AUR, NULL, show_it);
-                    FREE_PACKAGE_LIST (packages);
-                }
+    }
+
+    if (cd.upgrades.has_run)
+    {
+        /* means the error is likely to come from a dependency issue/conflict */
+        if (cd.upgrades.error != NULL && cd.upgrades.error->code == 2)
+        {
+            got_something = TRUE;
+            nb = -1;
 #ifndef DISABLE_GUI
-                else if (error == NULL)
+            if (!is_cli)
+            {
+                /* we do the notification (instead of calling
+                 * notify_error) because we need to add the
+                 * "Update system" button/action. */
+                NotifyNotification *notification;
+                notif_t *notif;
+
+                notif = new (notif_t, 1);
+                notif->type = CHECK_UPGRADES;
+                notif->summary = strdup (_("Unable to compile list of packages"));
+                notif->text = strdup (cd.upgrades.error->message);
+                notif->data = NULL;
+
+                notification = new_notification (notif->summary,
+                        notif->text);
+                if (config->action != UPGRADE_NO_ACTION)
                 {
-                    nb_aur = 0;
+                    notify_notification_add_action (notification,
+                            "do_updates",
+                            _c("notif-button", "Update system..."),
+                            (NotifyActionCallback) action_upgrade,
+                            NULL,
+                            NULL);
                 }
-                else
-#else
-                    else if (error != NULL)
-#endif
-                    {
-                        got_something = TRUE;
-                        do_notify_error (
-                                _("Unable to check for AUR packages"),
-                                error->message);
-                        g_clear_error (&error);
-                    }
-                    alpm_list_free (aur_pkgs);
-            }
-#ifndef DISABLE_GUI
-            else if (error == NULL)
-            {
-                nb_aur = 0;
+                /* we use a callback on "closed" to unref it,
+                 * because when there's an action we need to keep
+                 * a ref, otherwise said action won't work */
+                g_signal_connect (G_OBJECT (notification),
+                        "closed",
+                        G_CALLBACK (notification_closed_cb),
+                        NULL);
+                /* add the notif to the last of last notifications,
+                 * so we can re-show it later */
+                debug ("adding new notif (%s) to last_notifs",
+                        notif->summary);
+                config->last_notifs = alpm_list_add (
+                        config->last_notifs,
+                        notif);
+                /* show notif */
+                notify_notification_show (notification, NULL);
+                /* mark icon blue, upgrades are available, we just
+                 * don't know which/how many (due to the conflict) */
+                nb = UPGRADES_NB_CONFLICT;
             }
             else
-#else
-                else if (error != NULL)
+            {
 #endif
-                {
-                    got_something = TRUE;
-                    do_notify_error (
-                            _("Unable to check for AUR packages"),
-                            error->message);
-                    g_clear_error (&error);
-                }
+                do_notify_error (
+                        _("Unable to compile list of packages"),
+                        cd.upgrades.error->message);
 #ifndef DISABLE_GUI
-                if (nb_aur >= 0)
-                {
-                    set_kalpm_nb (CHECK_AUR, nb_aur, FALSE);
-                }
+            }
 #endif
+            g_clear_error (&cd.upgrades.error);
         }
-
-        kalu_alpm_free ();
+        else
+        {
+            nb = notify_stage (&cd.upgrades, CHECK_UPGRADES, NULL, show_it,
+                    _("Unable to check for updates"), &got_something);
+        }
+        prom_set (CHECK_UPGRADES, nb);
+#ifndef DISABLE_GUI
+        if (nb >= 0 || nb == UPGRADES_NB_CONFLICT)
+        {
+            set_kalpm_nb (CHECK_UPGRADES, nb, FALSE);
+        }
+#endif
     }
 
-    if (checks & CHECK_WATCHED_AUR && config->watched_aur /* NULL if not watched aur pkgs */)
+    if (cd.watched.has_run)
     {
-        packages = NULL;
-        if (aur_has_updates (&packages, config->watched_aur, TRUE, &error))
-        {
-            got_something = TRUE;
+        nb = notify_stage (&cd.watched, CHECK_WATCHED, NULL, show_it,
+                _("Unable to check for updates of watched packages"),
+                &got_something);
+        prom_set (CHECK_WATCHED, nb);
 #ifndef DISABLE_GUI
-            nb_watched_aur = (gint) alpm_list_count (packages);
-#endif
-            notify_updates (packages, CHECK_WATCHED_AUR, NULL, show_it);
+        if (nb >= 0)
+        {
+            set_kalpm_nb (CHECK_WATCHED, nb, FALSE);
         }
+#endif
+    }
+
+    if (cd.aur.has_run)
+    {
+        reconcile_aur (&cd);
+        nb = notify_stage (&cd.aur, CHECK_AUR, NULL, show_it,
+                _("Unable to check for AUR packages"), &got_something);
+        FREE_PACKAGE_LIST (cd.aur.packages);
+        FREE_WATCHED_PACKAGE_LIST (cd.foreign);
+        /* items are shared with foreign_synced */
+        alpm_list_free (cd.foreign_new);
+        FREE_WATCHED_PACKAGE_LIST (cd.foreign_synced);
+        prom_set (CHECK_AUR, nb);
 #ifndef DISABLE_GUI
-        else if (error == NULL)
+        if (nb >= 0)
         {
-            nb_watched_aur = 0;
+            set_kalpm_nb (CHECK_AUR, nb, FALSE);
         }
-        else
-#else
-            else if (error != NULL)
 #endif
-            {
-                got_something = TRUE;
-                do_notify_error (
-                        _("Unable to check for updates of watched AUR packages"),
-                        error->message);
-                g_clear_error (&error);
-            }
+    }
+
+    if (cd.watched_aur.has_run)
+    {
+        nb = notify_stage (&cd.watched_aur, CHECK_WATCHED_AUR, NULL, show_it,
+                _("Unable to check for updates of watched AUR packages"),
+                &got_something);
+        prom_set (CHECK_WATCHED_AUR, nb);
 #ifndef DISABLE_GUI
-            if (nb_watched_aur >= 0)
-            {
-                set_kalpm_nb (CHECK_WATCHED_AUR, nb_watched_aur, FALSE);
-            }
+        if (nb >= 0)
+        {
+            set_kalpm_nb (CHECK_WATCHED_AUR, nb, FALSE);
+        }
 #endif
     }
 
@@ -747,8 +897,37 @@ kalu_check_work (gboolean is_auto)
     {
         do_notify_error (_("No upgrades available."), NULL);
     }
+    stats_add ("notifications", start_notifs);
+    stats_add ("check", start);
 
-#ifndef DISABLE_GUI
+    if (config->prom_file)
+    {
+        /* last error, so the same one isn't warned about on every check */
+        static gchar *prom_error = NULL;
+        GError *error = NULL;
+
+        if (!prom_write (config->prom_file, &error))
+        {
+            debug ("unable to write metrics: %s", error->message);
+            if (g_strcmp0 (prom_error, error->message) != 0)
+            {
+                g_warning ("Unable to write metrics to %s: %s",
+                        config->prom_file, error->message);
+                g_free (prom_error);
+                prom_error = g_strdup (error->message);
+            }
+            g_clear_error (&error);
+        }
+        else
+        {
+            g_free (prom_error);
+            prom_error = NULL;
+        }
+    }
+
+#ifdef DISABLE_GUI
+    (void) nb;
+#else
     if (is_cli)
     {
         return;
@@ -761,9 +940,141 @@ kalu_check_work (gboolean is_auto)
     }
     kalpm_state.last_check = g_date_time_new_now_local ();
     set_kalpm_busy (FALSE);
+#ifndef DISABLE_UPDATER
+    /* download the packages in the background, once the user is idle. We're
+     * in the check's thread, prefetch lives in the main one */
+    if (config->prefetch)
+    {
+        g_main_context_invoke (NULL, prefetch_schedule, NULL);
+    }
+#endif
 #endif
 }
 
+/* refreshes the shared cache (usually as root), see kalu_alpm_cache_sync */
+static void
+do_sync_cache (void)
+{
+    GError      *error = NULL;
+    const gchar *cachedir;
+    gint         nb_syncdbs;
+
+    cachedir = (config->shared_cache) ? config->shared_cache : SHARED_CACHE_DIR;
+    if (!kalu_alpm_cache_sync (config->pacmanconf, cachedir, &nb_syncdbs,
+                &error))
+    {
+        do_notify_error (_("Unable to synchronize the shared cache"),
+                error->message);
+        g_clear_error (&error);
+        return;
+    }
+    debug ("shared cache %s: %d databases synchronized", cachedir, nb_syncdbs);
+}
+
+/* batch mode: file lists one pacman.conf per line, optionally followed by
+ * the root to use. DBs are synced only once for all, then we report the
+ * upgrades available on each root */
+static void
+batch_check (const gchar *file)
+{
+    GError       *error = NULL;
+    gchar        *contents;
+    gchar       **lines, **l;
+    alpm_list_t  *roots = NULL;
+    alpm_list_t  *i;
+    gint          nb_syncdbs;
+
+    if (!g_file_get_contents (file, &contents, NULL, &error))
+    {
+        do_notify_error (_("Unable to read batch file"), error->message);
+        g_clear_error (&error);
+        return;
+    }
+    lines = g_strsplit (contents, "\n", 0);
+    g_free (contents);
+    for (l = lines; *l; ++l)
+    {
+        batch_root_t *root;
+        gchar       **fields;
+
+        g_strstrip (*l);
+        if (**l == '\0' || **l == '#')
+        {
+            continue;
+        }
+        fields = g_strsplit_set (*l, " \t", 2);
+        root = new0 (batch_root_t, 1);
+        root->conffile = strdup (fields[0]);
+        if (fields[1] && *g_strstrip (fields[1]) != '\0')
+        {
+            root->rootdir = strdup (fields[1]);
+        }
+        g_strfreev (fields);
+        roots = alpm_list_add (roots, root);
+    }
+    g_strfreev (lines);
+
+    if (!kalu_alpm_batch_sync (roots, &nb_syncdbs, &error))
+    {
+        do_notify_error (
+                _("Unable to check for updates -- could not synchronize databases"),
+                error->message);
+        g_clear_error (&error);
+    }
+    else
+    {
+        debug ("batch: %d databases synced", nb_syncdbs);
+        FOR_LIST (i, roots)
+        {
+            batch_root_t *root = i->data;
+            alpm_list_t  *packages = NULL;
+            gchar        *title;
+
+            title = g_strdup_printf (_("Root %s (%s):"),
+                    root->pac_conf->rootdir, root->conffile);
+            do_report (title, NULL);
+            g_free (title);
+
+            if (!kalu_alpm_batch_load (root, &error))
+            {
+                do_notify_error (
+                        _("Unable to check for updates -- loading alpm library failed"),
+                        error->message);
+                g_clear_error (&error);
+                continue;
+            }
+
+            if (kalu_alpm_has_updates (&packages, &error))
+            {
+                notify_updates (packages, CHECK_UPGRADES, NULL, FALSE);
+                FREE_PACKAGE_LIST (packages);
+            }
+            else if (error != NULL)
+            {
+                do_notify_error (_("Unable to check for updates"),
+                        error->message);
+                g_clear_error (&error);
+            }
+            else
+            {
+                do_report (_("No upgrades available."), NULL);
+            }
+            kalu_alpm_free ();
+        }
+    }
+
+    kalu_alpm_batch_free (roots);
+    FOR_LIST (i, roots)
+    {
+        batch_root_t *root = i->data;
+
+        free (root->conffile);
+        free (root->rootdir);
+        free (root);
+    }
+    alpm_list_free (roots);
+}
+
 static void
 free_config (void)
 {
@@ -773,23 +1084,31 @@ free_config (void)
     }
 
     free (config->pacmanconf);
+    free (config->shared_cache);
+    free (config->prom_file);
 
     /* tpl */
     free (config->tpl_upgrades->title);
     free (config->tpl_upgrades->package);
     free (config->tpl_upgrades->sep);
+    tpl_free (config->tpl_upgrades->c_title);
+    tpl_free (config->tpl_upgrades->c_package);
     free (config->tpl_upgrades);
 
     /* tpl watched */
     free (config->tpl_watched->title);
     free (config->tpl_watched->package);
     free (config->tpl_watched->sep);
+    tpl_free (config->tpl_watched->c_title);
+    tpl_free (config->tpl_watched->c_package);
     free (config->tpl_watched);
 
     /* tpl aur */
     free (config->tpl_aur->title);
     free (config->tpl_aur->package);
     free (config->tpl_aur->sep);
+    tpl_free (config->tpl_aur->c_title);
+    tpl_free (config->tpl_aur->c_package);
     free (config->tpl_aur);
 
     /* watched */
@@ -830,31 +1149,6 @@ free_watched_package (watched_package_t *w_pkg)
     free (w_pkg);
 }
 
-void
-debug (const char *fmt, ...)
-{
-    va_list    args;
-    time_t     now;
-    struct tm *ptr;
-    char       buf[10];
-
-    if (!config->is_debug)
-    {
-        return;
-    }
-
-    now = time (NULL);
-    ptr = localtime (&now);
-    strftime (buf, 10, "%H:%M:%S", ptr);
-    fprintf (stdout, "[%s] ", buf);
-
-    va_start (args, fmt);
-    vfprintf (stdout, fmt, args);
-    va_end (args);
-
-    fprintf (stdout, "\n");
-}
-
 #ifndef DISABLE_GUI
 extern GtkStatusIcon *icon;
 extern GPtrArray     *open_windows;
@@ -931,6 +1225,20 @@ get_gray_pixbuf (GdkPixbuf *pixbuf)
 }
 #endif
 
+#ifdef ENABLE_ALLOC_STATS
+/* sent SIGUSR1 (from the GUI or daemon) */
+gboolean
+dump_alloc_stats (gpointer data _UNUSED_)
+{
+    char *s = alloc_stats_report ();
+
+    fputs (s, stdout);
+    fflush (stdout);
+    free (s);
+    return TRUE;
+}
+#endif
+
 static gboolean
 opt_debug (const gchar  *option _UNUSED_,
            const gchar  *value  _UNUSED_,
@@ -973,6 +1281,15 @@ main (int argc, char *argv[])
     gboolean         show_version       = FALSE;
     gboolean         run_manual_checks  = FALSE;
     gboolean         run_auto_checks    = FALSE;
+    gchar           *batch              = NULL;
+    gboolean         sync_cache         = FALSE;
+    gboolean         show_stats         = FALSE;
+    gchar           *debug_levels       = NULL;
+    gchar           *debug_output       = NULL;
+#ifdef DISABLE_GUI
+    gboolean         run_daemon         = FALSE;
+    gchar           *output             = NULL;
+#endif
     GOptionEntry     options[] = {
         { "auto-checks",    'a', 0, G_OPTION_ARG_NONE, &run_auto_checks,
             N_("Run automatic checks"), NULL },
@@ -980,8 +1297,25 @@ main (int argc, char *argv[])
             N_("Run manual checks"), NULL },
         { "debug",          'd', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
             opt_debug, N_("Enable debug mode"), NULL },
+        { "debug-levels",   0,   0, G_OPTION_ARG_STRING, &debug_levels,
+            N_("Set debug level per subsystem, e.g. alpm=3,gui=0"),
+            N_("SPEC") },
+        { "debug-output",   0,   0, G_OPTION_ARG_FILENAME, &debug_output,
+            N_("Write debug messages to FILE, or syslog"), N_("FILE") },
         { "version",        'V', 0, G_OPTION_ARG_NONE, &show_version,
             N_("Show version information"), NULL },
+        { "batch",          'b', 0, G_OPTION_ARG_FILENAME, &batch,
+            N_("Check for upgrades on all roots listed in FILE"), N_("FILE") },
+        { "sync-cache",     0,   0, G_OPTION_ARG_NONE, &sync_cache,
+            N_("Synchronize the shared cache of databases"), NULL },
+        { "stats",          0,   0, G_OPTION_ARG_NONE, &show_stats,
+            N_("Show timings of the checks' stages on exit"), NULL },
+#ifdef DISABLE_GUI
+        { "daemon",         0,   0, G_OPTION_ARG_NONE, &run_daemon,
+            N_("Keep running, doing automatic checks periodically"), NULL },
+        { "output",         'o', 0, G_OPTION_ARG_FILENAME, &output,
+            N_("Send reports to FILE (log file or local socket)"), N_("FILE") },
+#endif
         { NULL }
     };
 
@@ -1012,13 +1346,28 @@ main (int argc, char *argv[])
             g_option_context_free (context);
             return 0;
         }
+        log_set_level (config->is_debug);
+        if (debug_levels && !log_parse_levels (debug_levels, &error))
+        {
+            fprintf (stderr, "%s\n", error->message);
+            g_option_context_free (context);
+            return 1;
+        }
+        if (debug_output && !log_set_output (debug_output, &error))
+        {
+            fprintf (stderr, "%s\n", error->message);
+            g_option_context_free (context);
+            return 1;
+        }
+        g_free (debug_levels);
+        g_free (debug_output);
         if (config->is_debug)
         {
             debug ("kalu v" PACKAGE_VERSION " -- debug mode enabled (level %d)",
                     config->is_debug);
         }
 #ifndef DISABLE_GUI
-        if (run_manual_checks || run_auto_checks)
+        if (run_manual_checks || run_auto_checks || batch || sync_cache)
         {
             is_cli = TRUE;
         }
@@ -1037,6 +1386,9 @@ main (int argc, char *argv[])
         | CHECK_WATCHED_AUR | CHECK_NEWS;
     config->auto_notifs = TRUE;
     config->notif_buttons = TRUE;
+    config->mirror_probe = TRUE;
+    config->shared_cache_max_age = 7200; /* 2 hours */
+    config->updater_idle_timeout = 120;
 #ifndef DISABLE_UPDATER
     config->action = UPGRADE_ACTION_KALU;
     config->confirm_post = TRUE;
@@ -1081,6 +1433,7 @@ main (int argc, char *argv[])
             fputs (_("GTK+ initialization failed\n"), stderr);
             puts (_("To run kalu on CLI only mode, use --auto-checks or --manual-checks"));
             free_config ();
+            log_free ();
             return 1;
         }
     }
@@ -1123,6 +1476,8 @@ main (int argc, char *argv[])
         g_clear_error (&error);
     }
 
+    compile_templates ();
+
     if (curl_global_init (CURL_GLOBAL_ALL) == 0)
     {
         config->is_curl_init = TRUE;
@@ -1135,12 +1490,53 @@ main (int argc, char *argv[])
                 NULL);
     }
 
-#ifndef DISABLE_GUI
+#ifdef DISABLE_GUI
+    if (output)
+    {
+        if (!daemon_set_output (output, &error))
+        {
+            do_show_error (_("Unable to set output"), error->message, NULL);
+            g_clear_error (&error);
+            g_free (output);
+            goto eop;
+        }
+        g_free (output);
+    }
+
+    if (sync_cache)
+    {
+        do_sync_cache ();
+    }
+    else if (batch)
+    {
+        batch_check (batch);
+        g_free (batch);
+    }
+    else if (run_daemon)
+    {
+        daemon_run ();
+    }
+    else
+    {
+        kalu_check_work (run_auto_checks, NULL);
+    }
+eop:
+    daemon_set_output (NULL, NULL);
+#else
+    if (sync_cache)
+    {
+        do_sync_cache ();
+        goto eop;
+    }
+    if (batch)
+    {
+        batch_check (batch);
+        g_free (batch);
+        goto eop;
+    }
     if (run_manual_checks || run_auto_checks)
     {
-#endif
-        kalu_check_work (run_auto_checks);
-#ifndef DISABLE_GUI
+        kalu_check_work (run_auto_checks, NULL);
         goto eop;
     }
 
@@ -1215,20 +1611,40 @@ main (int argc, char *argv[])
 
     gtk_status_icon_set_visible (icon, TRUE);
 
+    /* keep our copy of dbs between checks, so a mirror probe can avoid
+     * syncing them when not needed */
+    kalu_alpm_set_keep_cache (TRUE);
+
     /* takes care of setting timeout_skip (if needed) and also triggers the
      * auto-checks (unless within skip period) */
 #if 1
     skip_next_timeout ();
 #endif
 
+#ifdef ENABLE_ALLOC_STATS
+    g_unix_signal_add (SIGUSR1, dump_alloc_stats, NULL);
+#endif
     notify_init ("kalu");
     gtk_main ();
 eop:
     if (!is_cli)
     {
         notify_uninit ();
+        kalu_alpm_set_keep_cache (FALSE);
     }
 #endif /* DISABLE_GUI */
+    executor_free ();
+    if (show_stats)
+    {
+        gchar *s = stats_report ();
+
+        puts ((s) ? s : _("No timings recorded"));
+        g_free (s);
+#ifdef ENABLE_ALLOC_STATS
+        dump_alloc_stats (NULL);
+#endif
+    }
+    stats_free ();
     if (config->is_curl_init)
     {
         curl_global_cleanup ();
@@ -1240,5 +1656,6 @@ eop:
         g_ptr_array_free (open_windows, TRUE);
     }
 #endif
+    log_free ();
     return 0;
 }
@@ -22,6 +22,10 @@
 
 #include <config.h>
 
+/* tag debug() messages & allocations */
+#define DEBUG_SUBSYS    SUBSYS_NEWS
+#define ALLOC_TAG       "news"
+
 /* C */
 #include <string.h>
 
@@ -38,6 +42,7 @@
 #include "news.h"
 #include "curl.h"
 #include "util.h"
+#include "stats.h"
 #ifndef DISABLE_GUI
 #include "util-gtk.h"
 #include "gui.h" /* show_notif() */
@@ -220,12 +225,16 @@ parse_xml (gchar *xml, gboolean for_updates, gpointer data_out, GError **error)
 gboolean
 news_has_updates (alpm_list_t **titles,
                   gchar       **xml_news,
+                  cancel_t     *cancel,
                   GError      **error)
 {
     GError               *local_err = NULL;
     parse_updates_data_t  data;
+    gint64                start;
 
-    *xml_news = curl_download (NEWS_RSS_URL, &local_err);
+    start = stats_now ();
+    *xml_news = curl_download (NEWS_RSS_URL, cancel, &local_err);
+    stats_add ("news: download", start);
     if (local_err != NULL)
     {
         g_propagate_error (error, local_err);
@@ -233,12 +242,14 @@ news_has_updates (alpm_list_t **titles,
     }
 
     zero (data);
+    start = stats_now ();
     if (!parse_xml (*xml_news, TRUE, (gpointer) &data, &local_err))
     {
         free (*xml_news);
         g_propagate_error (error, local_err);
         return FALSE;
     }
+    stats_add ("news: parse", start);
 
     if (data.titles == NULL)
     {
@@ -1258,7 +1269,7 @@ news_show (gchar *xml_news, gboolean only_updates, GError **error)
     /* if no XML was provided, download it */
     if (xml_news == NULL)
     {
-        xml_news = curl_download (NEWS_RSS_URL, &local_err);
+        xml_news = curl_download (NEWS_RSS_URL, NULL, &local_err);
         if (local_err != NULL)
         {
             g_propagate_error (error, local_err);
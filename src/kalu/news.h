@@ -29,9 +29,13 @@
 /* alpm list */
 #include <alpm_list.h>
 
+/* kalu */
+#include "executor.h"
+
 gboolean
 news_has_updates (alpm_list_t **titles,
                   gchar       **xml_news,
+                  cancel_t     *cancel,
                   GError      **error);
 
 gboolean
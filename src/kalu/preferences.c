@@ -22,6 +22,10 @@
 
 #include <config.h>
 
+/* tag debug() messages & allocations */
+#define DEBUG_SUBSYS    SUBSYS_GUI
+#define ALLOC_TAG       "gui"
+
 /* C */
 #include <string.h>
 
@@ -734,6 +738,8 @@ btn_manage_watched_cb (GtkButton *button _UNUSED_, gboolean is_aur)
     {                           \
         free (tpl->sep);        \
     }                           \
+    tpl_free (tpl->c_title);    \
+    tpl_free (tpl->c_package);  \
     free (tpl);                 \
 } while (0)
 #define do_click(name, confname, is_paused)    do {                         \
@@ -820,6 +826,16 @@ btn_save_cb (GtkButton *button _UNUSED_, gpointer data _UNUSED_)
         add_to_conf ("UseIP = 6\n");
     }
 
+    /* re-use the adaptive interval bounds (cannot be set via GUI) */
+    if (new_config.interval_min > 0)
+    {
+        add_to_conf ("IntervalMin = %d\n", new_config.interval_min / 60);
+    }
+    if (new_config.interval_max > 0)
+    {
+        add_to_conf ("IntervalMax = %d\n", new_config.interval_max / 60);
+    }
+
     /* disabling showing notifs for auto-checks (no GUI) */
     if (!new_config.auto_notifs)
     {
@@ -832,6 +848,45 @@ btn_save_cb (GtkButton *button _UNUSED_, gpointer data _UNUSED_)
         add_to_conf ("NotifButtons = 0\n");
     }
 
+    /* disabling mirror probe (no GUI) */
+    if (!new_config.mirror_probe)
+    {
+        add_to_conf ("MirrorProbe = 0\n");
+    }
+
+    /* shared cache (no GUI) */
+    if (new_config.shared_cache)
+    {
+        add_to_conf ("SharedCache = %s\n", new_config.shared_cache);
+    }
+    if (new_config.shared_cache_max_age != 7200)
+    {
+        add_to_conf ("SharedCacheMaxAge = %d\n",
+                new_config.shared_cache_max_age / 60);
+    }
+
+    /* metrics file (no GUI) */
+    if (new_config.prom_file)
+    {
+        add_to_conf ("PrometheusFile = %s\n", new_config.prom_file);
+    }
+
+    /* how long kalu-dbus is kept around (no GUI) */
+    if (new_config.updater_idle_timeout != 120)
+    {
+        add_to_conf ("UpdaterIdleTimeout = %d\n", new_config.updater_idle_timeout);
+    }
+
+    /* background download of packages (no GUI) */
+    if (new_config.prefetch)
+    {
+        add_to_conf ("Prefetch = 1\n");
+    }
+    if (new_config.prefetch_rate > 0)
+    {
+        add_to_conf ("PrefetchRate = %d\n", new_config.prefetch_rate);
+    }
+
     /* General */
     s = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (filechooser));
     if (NULL == s)
@@ -1284,6 +1339,7 @@ btn_save_cb (GtkButton *button _UNUSED_, gpointer data _UNUSED_)
     FREELIST (config->aur_ignore);
     /* copy new ones over */
     memcpy (config, &new_config, sizeof (config_t));
+    compile_templates ();
 
     /* reset timeout for next auto-checks */
     reset_timeout ();
@@ -0,0 +1,532 @@
+/**
+ * kalu - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * prefetch.c
+ * Copyright (C) 2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+
+#include <config.h>
+
+#define DEBUG_SUBSYS    SUBSYS_UPDATER
+
+/* gio */
+#include <gio/gio.h>
+
+/* alpm */
+#include <alpm.h>
+#include <alpm_list.h>
+
+/* kalu */
+#include "kalu.h"
+#include "prefetch.h"
+#include "conf.h"
+#include "kalu-updater.h"
+#include "kalu-alpm.h" /* kalu_alpm_get_cached_dbpath() */
+
+/* once a check found upgrades, packages can be downloaded into pacman's cache
+ * in the background (option Prefetch), so a sysupgrade can go straight to the
+ * install part. This goes through kalu-dbus, under the same PolicyKit action as
+ * the updater, only we won't have the user authenticate (see InitPrefetch).
+ * kalu-dbus then works on its own copy of the sync dbs, so it's fine to import
+ * & sync them without upgrading.
+ * It only starts once the user is idle, as reported by the session's idle
+ * monitor (GNOME's, else the screensaver being active); without one, it starts
+ * right after the check. */
+
+/* user is idle after that long without input (GNOME) */
+#define PREFETCH_IDLE_TIME      300
+/* how often to check again while the user isn't idle */
+#define PREFETCH_IDLE_RETRY     60
+
+typedef struct _prefetch_t {
+    KaluUpdater     *kupdater;
+    pacman_config_t *pac_conf;
+    alpm_list_t     *db;        /* database being registered */
+    gboolean         is_init;   /* we have a session, FreeAlpm is needed */
+    guint            watch_id;
+    prefetch_done_fn done_fn;   /* someone (i.e. the updater) is waiting */
+    gpointer         done_data;
+} prefetch_t;
+
+extern kalpm_state_t kalpm_state;
+
+static prefetch_t *prefetch = NULL;
+static guint idle_source = 0;
+
+static void
+prefetch_free (void)
+{
+    prefetch_done_fn done_fn = prefetch->done_fn;
+    gpointer done_data = prefetch->done_data;
+
+    if (prefetch->watch_id > 0)
+    {
+        g_bus_unwatch_name (prefetch->watch_id);
+    }
+    if (prefetch->kupdater)
+    {
+        g_object_unref (prefetch->kupdater);
+    }
+    free_pacman_config (prefetch->pac_conf);
+    free (prefetch);
+    prefetch = NULL;
+
+    if (done_fn)
+    {
+        done_fn (done_data);
+    }
+}
+
+static void
+name_vanished_cb (GDBusConnection *conn _UNUSED_, const gchar *name _UNUSED_,
+        gpointer data _UNUSED_)
+{
+    prefetch_free ();
+}
+
+static void
+free_alpm_cb (KaluUpdater *kupdater _UNUSED_, const gchar *errmsg,
+        gpointer data _UNUSED_)
+{
+    if (errmsg)
+    {
+        debug ("prefetch: FreeAlpm failed: %s", errmsg);
+    }
+    /* kalu-dbus stays around for the next session */
+    if (!errmsg && config->updater_idle_timeout > 0)
+    {
+        prefetch_free ();
+        return;
+    }
+    /* else it's exiting, and before anyone else (i.e. the updater) can use it,
+     * we need to wait for it to be gone */
+    prefetch->watch_id = g_bus_watch_name (G_BUS_TYPE_SYSTEM,
+            "org.jjk.kalu",
+            G_BUS_NAME_WATCHER_FLAGS_NONE,
+            NULL,
+            name_vanished_cb,
+            NULL,
+            NULL);
+}
+
+static void
+prefetch_end (const gchar *errmsg)
+{
+    GError *error = NULL;
+
+    if (errmsg)
+    {
+        debug ("prefetch failed: %s", errmsg);
+    }
+    else
+    {
+        debug ("prefetch done");
+    }
+
+    if (prefetch->is_init)
+    {
+        prefetch->is_init = FALSE;
+        if (kalu_updater_free_alpm (prefetch->kupdater,
+                    (guint) config->updater_idle_timeout,
+                    NULL,
+                    (KaluMethodCallback) free_alpm_cb,
+                    NULL,
+                    &error))
+        {
+            return;
+        }
+        debug ("prefetch: FreeAlpm failed: %s", error->message);
+        g_clear_error (&error);
+    }
+    prefetch_free ();
+}
+
+static void
+prefetch_failed (GError *error)
+{
+    prefetch_end (error->message);
+    g_error_free (error);
+}
+
+static void
+prefetch_cb (KaluUpdater *kupdater _UNUSED_, const gchar *errmsg,
+        gpointer data _UNUSED_)
+{
+    prefetch_end (errmsg);
+}
+
+static void
+sync_dbs_cb (KaluUpdater *kupdater, const gchar *errmsg, gpointer data _UNUSED_)
+{
+    GError *error = NULL;
+
+    if (errmsg)
+    {
+        prefetch_end (errmsg);
+        return;
+    }
+
+    debug ("prefetch: downloading packages");
+    if (!kalu_updater_prefetch (kupdater,
+                (guint) config->prefetch_rate,
+                NULL,
+                (KaluMethodCallback) prefetch_cb,
+                NULL,
+                &error))
+    {
+        prefetch_failed (error);
+    }
+}
+
+static void
+import_dbs_cb (KaluUpdater *kupdater, const gchar *errmsg,
+        gpointer data _UNUSED_)
+{
+    GError *error = NULL;
+
+    /* not fatal, dbs will simply be synced */
+    if (errmsg)
+    {
+        debug ("prefetch: ImportDbs failed: %s", errmsg);
+    }
+
+    if (!kalu_updater_sync_dbs (kupdater,
+                NULL,
+                (KaluMethodCallback) sync_dbs_cb,
+                NULL,
+                &error))
+    {
+        prefetch_failed (error);
+    }
+}
+
+static void
+add_db_cb (KaluUpdater *kupdater, const gchar *errmsg, gpointer data _UNUSED_)
+{
+    GError *error = NULL;
+
+    if (errmsg)
+    {
+        prefetch_end (errmsg);
+        return;
+    }
+
+    prefetch->db = (prefetch->db)
+        ? alpm_list_next (prefetch->db)
+        : prefetch->pac_conf->databases;
+
+    if (prefetch->db)
+    {
+        database_t *db_conf = prefetch->db->data;
+
+        if (!kalu_updater_add_db (kupdater,
+                    db_conf->name,
+                    db_conf->siglevel,
+                    db_conf->servers,
+                    NULL,
+                    (KaluMethodCallback) add_db_cb,
+                    NULL,
+                    &error))
+        {
+            prefetch_failed (error);
+        }
+    }
+    else
+    {
+        const gchar *dbpath = kalu_alpm_get_cached_dbpath ();
+
+        if (!dbpath)
+        {
+            import_dbs_cb (kupdater, NULL, NULL);
+        }
+        else if (!kalu_updater_import_dbs (kupdater,
+                    dbpath,
+                    NULL,
+                    (KaluMethodCallback) import_dbs_cb,
+                    NULL,
+                    &error))
+        {
+            debug ("prefetch: ImportDbs failed: %s", error->message);
+            g_clear_error (&error);
+            import_dbs_cb (kupdater, NULL, NULL);
+        }
+    }
+}
+
+static void
+open_peer_cb (KaluUpdater *kupdater, const gchar *errmsg,
+        gpointer data _UNUSED_)
+{
+    GError *error = NULL;
+    pacman_config_t *pac_conf = prefetch->pac_conf;
+
+    /* not fatal, signals will simply keep coming over the system bus */
+    if (errmsg)
+    {
+        debug ("prefetch: OpenPeer failed: %s", errmsg);
+    }
+
+    if (!kalu_updater_init_alpm (kupdater,
+                pac_conf->rootdir,
+                pac_conf->dbpath,
+                pac_conf->logfile,
+                pac_conf->gpgdir,
+                pac_conf->cachedirs,
+                pac_conf->siglevel,
+                pac_conf->arch,
+                pac_conf->checkspace,
+                pac_conf->usesyslog,
+                pac_conf->usedelta,
+                pac_conf->ignorepkgs,
+                pac_conf->ignoregroups,
+                pac_conf->noupgrades,
+                pac_conf->noextracts,
+                pac_conf->paralleldownloads,
+                NULL,
+                (KaluMethodCallback) add_db_cb,
+                NULL,
+                &error))
+    {
+        prefetch_failed (error);
+    }
+}
+
+static void
+init_cb (KaluUpdater *kupdater, const gchar *errmsg, gpointer data _UNUSED_)
+{
+    GError *error = NULL;
+
+    if (errmsg)
+    {
+        /* no session, so no FreeAlpm */
+        prefetch_end (errmsg);
+        return;
+    }
+    prefetch->is_init = TRUE;
+
+    if (log_enabled (SUBSYS_UPDATER, 1)
+            && !kalu_updater_set_debug (kupdater,
+                (guint) log_levels[SUBSYS_UPDATER], NULL, &error))
+    {
+        debug ("prefetch: SetDebug failed: %s", error->message);
+        g_clear_error (&error);
+    }
+
+    if (!kalu_updater_open_peer (kupdater,
+                NULL,
+                (KaluMethodCallback) open_peer_cb,
+                NULL,
+                &error))
+    {
+        debug ("prefetch: OpenPeer failed: %s", error->message);
+        g_clear_error (&error);
+        open_peer_cb (kupdater, NULL, NULL);
+    }
+}
+
+static void
+new_cb (GObject *source _UNUSED_, GAsyncResult *res, gpointer data _UNUSED_)
+{
+    GError *error = NULL;
+
+    prefetch->kupdater = kalu_updater_new_finish (res, &error);
+    if (!prefetch->kupdater)
+    {
+        prefetch_failed (error);
+        return;
+    }
+
+    if (!kalu_updater_init_prefetch (prefetch->kupdater,
+                NULL,
+                (KaluMethodCallback) init_cb,
+                NULL,
+                &error))
+    {
+        prefetch_failed (error);
+    }
+}
+
+static gboolean
+is_network_ok (void)
+{
+    GNetworkMonitor *monitor = g_network_monitor_get_default ();
+
+    if (!g_network_monitor_get_network_available (monitor))
+    {
+        return FALSE;
+    }
+#if GLIB_CHECK_VERSION (2, 46, 0)
+    return !g_network_monitor_get_network_metered (monitor);
+#else
+    /* no way to know whether it's metered, assume it isn't */
+    return TRUE;
+#endif
+}
+
+/* returns 1 if the user is idle, 0 if not, -1 if we can't tell */
+static gint
+is_user_idle (void)
+{
+    GDBusConnection *conn;
+    GVariant *v;
+    gint ret = -1;
+
+    conn = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+    if (!conn)
+    {
+        return -1;
+    }
+
+    v = g_dbus_connection_call_sync (conn,
+            "org.gnome.Mutter.IdleMonitor",
+            "/org/gnome/Mutter/IdleMonitor/Core",
+            "org.gnome.Mutter.IdleMonitor",
+            "GetIdletime",
+            NULL,
+            G_VARIANT_TYPE ("(t)"),
+            G_DBUS_CALL_FLAGS_NO_AUTO_START,
+            1000,
+            NULL,
+            NULL);
+    if (v)
+    {
+        guint64 ms;
+
+        g_variant_get (v, "(t)", &ms);
+        ret = (ms >= PREFETCH_IDLE_TIME * 1000) ? 1 : 0;
+        g_variant_unref (v);
+    }
+    else
+    {
+        v = g_dbus_connection_call_sync (conn,
+                "org.freedesktop.ScreenSaver",
+                "/org/freedesktop/ScreenSaver",
+                "org.freedesktop.ScreenSaver",
+                "GetActive",
+                NULL,
+                G_VARIANT_TYPE ("(b)"),
+                G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                1000,
+                NULL,
+                NULL);
+        if (v)
+        {
+            gboolean active;
+
+            g_variant_get (v, "(b)", &active);
+            ret = (active) ? 1 : 0;
+            g_variant_unref (v);
+        }
+    }
+
+    g_object_unref (conn);
+    return ret;
+}
+
+static void
+prefetch_run (void)
+{
+    GError *error = NULL;
+    pacman_config_t *pac_conf = NULL;
+
+    if (!is_network_ok ())
+    {
+        debug ("prefetch: network unavailable or metered");
+        return;
+    }
+
+    if (!parse_pacman_conf (config->pacmanconf, NULL, 0, 0, &pac_conf, &error))
+    {
+        debug ("prefetch: unable to parse %s: %s", config->pacmanconf,
+                error->message);
+        g_clear_error (&error);
+        free_pacman_config (pac_conf);
+        return;
+    }
+    if (!pac_conf->databases)
+    {
+        free_pacman_config (pac_conf);
+        return;
+    }
+
+    debug ("starting prefetch");
+    prefetch = new0 (prefetch_t, 1);
+    prefetch->pac_conf = pac_conf;
+    kalu_updater_new (NULL, (GAsyncReadyCallback) new_cb, NULL);
+}
+
+static gboolean
+idle_cb (gpointer data _UNUSED_)
+{
+    gint idle;
+
+    if (!config->prefetch || prefetch || kalpm_state.nb_upgrades <= 0)
+    {
+        idle_source = 0;
+        return FALSE;
+    }
+    if (kalpm_state.is_busy)
+    {
+        return TRUE;
+    }
+
+    idle = is_user_idle ();
+    if (idle == 0)
+    {
+        return TRUE;
+    }
+    if (idle < 0)
+    {
+        debug ("prefetch: no idle monitor, not waiting");
+    }
+
+    idle_source = 0;
+    prefetch_run ();
+    return FALSE;
+}
+
+/* to be used as a GSourceFunc on the main context (checks run from a worker
+ * thread, so use e.g. g_main_context_invoke) after a check: starts a prefetch
+ * (if enabled and there are upgrades available) once the user is idle and
+ * nothing else is going on */
+gboolean
+prefetch_schedule (gpointer data _UNUSED_)
+{
+    if (idle_source > 0)
+    {
+        g_source_remove (idle_source);
+    }
+    idle_source = g_timeout_add_seconds_full (G_PRIORITY_LOW,
+            PREFETCH_IDLE_RETRY, idle_cb, NULL, NULL);
+    return FALSE;
+}
+
+/* if a prefetch is running, done_fn will be called (with data) once it's over
+ * and returns TRUE; else returns FALSE */
+gboolean
+prefetch_wait (prefetch_done_fn done_fn, gpointer data)
+{
+    if (!prefetch)
+    {
+        return FALSE;
+    }
+    prefetch->done_fn = done_fn;
+    prefetch->done_data = data;
+    return TRUE;
+}
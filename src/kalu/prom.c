@@ -0,0 +1,234 @@
+/**
+ * kalu - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * prom.c
+ * Copyright (C) 2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+
+#include <config.h>
+
+/* C */
+#include <string.h>
+#include <time.h>
+
+/* glib */
+#include <glib-2.0/glib.h>
+
+/* kalu */
+#include "kalu.h"
+#include "prom.h"
+#include "stats.h"
+#include "curl.h"
+
+/* results of the last check, written out in the text format of Prometheus
+ * (as read by node_exporter's textfile collector) by prom_write() */
+
+enum {
+    PROM_UPGRADES = 0,
+    PROM_WATCHED,
+    PROM_AUR,
+    PROM_WATCHED_AUR,
+    PROM_NEWS,
+    PROM_SYNCDBS,
+    NB_PROM
+};
+
+static const gchar *names[NB_PROM] = {
+    "upgrades", "watched", "aur", "watched_aur", "news", "syncdbs"
+};
+
+#define NOT_RUN     -1
+#define FAILED      -2
+#define CONFLICT    -3  /* upgrades available, but unknown how many */
+
+static gint     nbs[NB_PROM] = { NOT_RUN, NOT_RUN, NOT_RUN, NOT_RUN, NOT_RUN,
+                                 NOT_RUN };
+static guint    errors[NB_PROM];
+static guint    nb_checks = 0;
+static gint64   last_check = 0;
+
+static gint
+get_index (check_t type)
+{
+    switch (type)
+    {
+        case CHECK_UPGRADES:
+            return PROM_UPGRADES;
+        case CHECK_WATCHED:
+            return PROM_WATCHED;
+        case CHECK_AUR:
+            return PROM_AUR;
+        case CHECK_WATCHED_AUR:
+            return PROM_WATCHED_AUR;
+        case CHECK_NEWS:
+        default:
+            return PROM_NEWS;
+    }
+}
+
+/* starts a new check, i.e. nothing has run yet */
+void
+prom_check_begin (void)
+{
+    gint i;
+
+    for (i = 0; i < NB_PROM; ++i)
+    {
+        nbs[i] = NOT_RUN;
+    }
+    ++nb_checks;
+    last_check = g_get_real_time ();
+}
+
+/* sets the nb of packages found by the check, or error if nb < 0 (other than
+ * UPGRADES_NB_CONFLICT, which isn't one) */
+void
+prom_set (check_t type, gint nb)
+{
+    gint i = get_index (type);
+
+#ifndef DISABLE_GUI
+    if (type == CHECK_UPGRADES && nb == UPGRADES_NB_CONFLICT)
+    {
+        nbs[i] = CONFLICT;
+        return;
+    }
+#endif
+    if (nb < 0)
+    {
+        nbs[i] = FAILED;
+        ++errors[i];
+    }
+    else
+    {
+        nbs[i] = nb;
+    }
+}
+
+/* nb of dbs synced, or error if nb < 0 */
+void
+prom_set_syncdbs (gint nb)
+{
+    if (nb < 0)
+    {
+        nbs[PROM_SYNCDBS] = FAILED;
+        ++errors[PROM_SYNCDBS];
+    }
+    else
+    {
+        nbs[PROM_SYNCDBS] = nb;
+    }
+}
+
+static void
+add_stage (const gchar *name, gint64 usec, GString *str)
+{
+    gchar *s;
+
+    /* label values need \ and " escaped */
+    s = g_strescape (name, NULL);
+    g_string_append_printf (str, "kalu_stage_duration_seconds{stage=\"%s\"} %.6f\n",
+            s, (gdouble) usec / G_USEC_PER_SEC);
+    g_free (s);
+}
+
+/* writes the metrics into file, atomically (i.e. via a temp file renamed) so
+ * the collector never reads a partial file */
+gboolean
+prom_write (const gchar *file, GError **error)
+{
+    GString    *str;
+    gboolean    ret;
+    gint        i;
+
+    str = g_string_sized_new (1024);
+
+    g_string_append (str,
+            "# HELP kalu_updates Packages found by the last check.\n"
+            "# TYPE kalu_updates gauge\n");
+    for (i = 0; i < PROM_SYNCDBS; ++i)
+    {
+        if (nbs[i] >= 0)
+        {
+            g_string_append_printf (str, "kalu_updates{check=\"%s\"} %d\n",
+                    names[i], nbs[i]);
+        }
+    }
+
+    g_string_append (str,
+            "# HELP kalu_syncdbs Databases synchronized by the last check.\n"
+            "# TYPE kalu_syncdbs gauge\n");
+    if (nbs[PROM_SYNCDBS] >= 0)
+    {
+        g_string_append_printf (str, "kalu_syncdbs %d\n", nbs[PROM_SYNCDBS]);
+    }
+
+    g_string_append (str,
+            "# HELP kalu_check_failed Whether each part of the last check failed.\n"
+            "# TYPE kalu_check_failed gauge\n");
+    for (i = 0; i < NB_PROM; ++i)
+    {
+        if (nbs[i] != NOT_RUN)
+        {
+            g_string_append_printf (str, "kalu_check_failed{check=\"%s\"} %d\n",
+                    names[i], (nbs[i] == FAILED) ? 1 : 0);
+        }
+    }
+
+    g_string_append (str,
+            "# HELP kalu_upgrades_conflict Whether the last check found upgrades, but couldn't list them due to a conflict.\n"
+            "# TYPE kalu_upgrades_conflict gauge\n");
+    if (nbs[PROM_UPGRADES] != NOT_RUN)
+    {
+        g_string_append_printf (str, "kalu_upgrades_conflict %d\n",
+                (nbs[PROM_UPGRADES] == CONFLICT) ? 1 : 0);
+    }
+
+    g_string_append (str,
+            "# HELP kalu_check_errors_total Errors per part of the checks.\n"
+            "# TYPE kalu_check_errors_total counter\n");
+    for (i = 0; i < NB_PROM; ++i)
+    {
+        g_string_append_printf (str, "kalu_check_errors_total{check=\"%s\"} %u\n",
+                names[i], errors[i]);
+    }
+
+    g_string_append_printf (str,
+            "# HELP kalu_checks_total Checks done.\n"
+            "# TYPE kalu_checks_total counter\n"
+            "kalu_checks_total %u\n"
+            "# HELP kalu_last_check_timestamp_seconds When the last check started.\n"
+            "# TYPE kalu_last_check_timestamp_seconds gauge\n"
+            "kalu_last_check_timestamp_seconds %" G_GINT64_FORMAT "\n"
+            "# HELP kalu_downloaded_bytes_total Bytes downloaded.\n"
+            "# TYPE kalu_downloaded_bytes_total counter\n"
+            "kalu_downloaded_bytes_total %" G_GUINT64_FORMAT "\n",
+            nb_checks,
+            last_check / G_USEC_PER_SEC,
+            curl_get_downloaded ());
+
+    g_string_append (str,
+            "# HELP kalu_stage_duration_seconds Time spent in each stage of the last check.\n"
+            "# TYPE kalu_stage_duration_seconds gauge\n");
+    stats_foreach_last ((stats_fn) add_stage, str);
+
+    ret = g_file_set_contents (file, str->str, (gssize) str->len, error);
+    g_string_free (str, TRUE);
+    return ret;
+}
@@ -31,8 +31,169 @@
 #include "config.h"
 #include "shared.h"
 
+#ifdef ENABLE_ALLOC_STATS
+/* C */
+#include <stdint.h>
+#include <pthread.h>
+
+/* blocks allocated via _alloc/_realloc are remembered (pointer, size & tag) so
+ * that when freed -- free() being wrapped at link time, see Makefile.am -- we
+ * know what to account for. Blocks freed from outside kalu's own code (e.g. by
+ * a library) remain accounted as live. */
+#define NB_BUCKETS      4096
+#define MAX_TAGS        16
+
+typedef struct _block_t {
+    void            *ptr;
+    size_t           size;
+    int              tag;
+    struct _block_t *next;
+} block_t;
+
+typedef struct _tag_stats_t {
+    const char          *name;
+    unsigned long        nb_allocs;
+    unsigned long long   bytes_allocs;
+    unsigned long        nb_live;
+    size_t               bytes_live;
+    size_t               bytes_peak;
+} tag_stats_t;
+
+static pthread_mutex_t   stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static block_t          *buckets[NB_BUCKETS];
+static tag_stats_t       tags[MAX_TAGS];
+static int               nb_tags = 0;
+
+void __real_free (void *ptr);
+void __wrap_free (void *ptr);
+
+#define hash_ptr(ptr)   ((((uintptr_t) (ptr)) >> 4) % NB_BUCKETS)
+
+/* must be called with stats_mutex locked */
+static int
+get_tag (const char *name)
+{
+    int i;
+
+    for (i = 0; i < nb_tags; ++i)
+    {
+        if (tags[i].name == name || streq (tags[i].name, name))
+        {
+            return i;
+        }
+    }
+    if (nb_tags == MAX_TAGS)
+    {
+        /* shouldn't happen, but then it gets lumped in with the last one */
+        return MAX_TAGS - 1;
+    }
+    tags[nb_tags].name = name;
+    return nb_tags++;
+}
+
+/* must be called with stats_mutex locked */
+static void
+untrack (void *ptr)
+{
+    block_t **b;
+
+    for (b = &buckets[hash_ptr (ptr)]; *b; b = &(*b)->next)
+    {
+        if ((*b)->ptr == ptr)
+        {
+            block_t *block = *b;
+
+            --tags[block->tag].nb_live;
+            tags[block->tag].bytes_live -= block->size;
+            *b = block->next;
+            __real_free (block);
+            return;
+        }
+    }
+}
+
+static void
+track (void *ptr, size_t size, const char *tag)
+{
+    block_t     *block;
+    tag_stats_t *ts;
+
+    block = malloc (sizeof (*block));
+    if (!block)
+    {
+        exit (255);
+    }
+    block->ptr = ptr;
+    block->size = size;
+
+    pthread_mutex_lock (&stats_mutex);
+    /* in case the address was freed without us knowing */
+    untrack (ptr);
+    block->tag = get_tag ((tag) ? tag : "core");
+    block->next = buckets[hash_ptr (ptr)];
+    buckets[hash_ptr (ptr)] = block;
+
+    ts = &tags[block->tag];
+    ++ts->nb_allocs;
+    ts->bytes_allocs += size;
+    ++ts->nb_live;
+    ts->bytes_live += size;
+    if (ts->bytes_live > ts->bytes_peak)
+    {
+        ts->bytes_peak = ts->bytes_live;
+    }
+    pthread_mutex_unlock (&stats_mutex);
+}
+
+void
+__wrap_free (void *ptr)
+{
+    if (ptr)
+    {
+        pthread_mutex_lock (&stats_mutex);
+        untrack (ptr);
+        pthread_mutex_unlock (&stats_mutex);
+    }
+    __real_free (ptr);
+}
+
+/* returns a newly allocated string with, for each tag, the number & size of
+ * all allocations, of the live ones, and the peak of live bytes */
+char *
+alloc_stats_report (void)
+{
+    char   *s;
+    size_t  alloc;
+    size_t  len;
+    int     i;
+
+    pthread_mutex_lock (&stats_mutex);
+    alloc = (size_t) (nb_tags + 1) * 128;
+    s = malloc (alloc);
+    if (!s)
+    {
+        exit (255);
+    }
+    len = (size_t) snprintf (s, alloc, "%-8s %10s %14s %8s %12s %12s\n",
+            "tag", "allocs", "bytes", "live", "live bytes", "peak bytes");
+    for (i = 0; i < nb_tags; ++i)
+    {
+        len += (size_t) snprintf (s + len, alloc - len,
+                "%-8s %10lu %14llu %8lu %12zu %12zu\n",
+                tags[i].name,
+                tags[i].nb_allocs,
+                tags[i].bytes_allocs,
+                tags[i].nb_live,
+                tags[i].bytes_live,
+                tags[i].bytes_peak);
+    }
+    pthread_mutex_unlock (&stats_mutex);
+    return s;
+}
+#endif /* ENABLE_ALLOC_STATS */
+
 void *
-_alloc (size_t len, int zero)
+_alloc (size_t len, int zero, const char *tag _UNUSED_)
 {
     void *ptr;
 
@@ -45,17 +206,33 @@ _alloc (size_t len, int zero)
     {
         memzero (ptr, len);
     }
+#ifdef ENABLE_ALLOC_STATS
+    track (ptr, len, tag);
+#endif
     return ptr;
 }
 
 void *
-_realloc (void *ptr, size_t len)
+_realloc (void *ptr, size_t len, const char *tag _UNUSED_)
 {
+#ifdef ENABLE_ALLOC_STATS
+    /* before realloc, else the address could be reused (and tracked) by
+     * another thread before we untrack it */
+    if (ptr)
+    {
+        pthread_mutex_lock (&stats_mutex);
+        untrack (ptr);
+        pthread_mutex_unlock (&stats_mutex);
+    }
+#endif
     ptr = realloc (ptr, len);
     if (!ptr)
     {
         exit (255);
     }
+#ifdef ENABLE_ALLOC_STATS
+    track (ptr, len, tag);
+#endif
     return ptr;
 }
 
@@ -74,18 +74,32 @@ pgettext_aux (const char *domain,
 #define memzero(x, l)           (memset (x, 0, l))
 #define zero(x)                 (memzero (&(x), sizeof (x)))
 
+#ifdef ENABLE_ALLOC_STATS
+/* files can define ALLOC_TAG (before including shared.h) to have their
+ * allocations accounted under it */
+#ifndef ALLOC_TAG
+#define ALLOC_TAG               "core"
+#endif
+#define _ALLOC_TAG              ALLOC_TAG
+#else
+#define _ALLOC_TAG              NULL
+#endif
+
 #define new(type, len)          \
-    (type *) _alloc (sizeof (type) * (size_t) (len), 0)
+    (type *) _alloc (sizeof (type) * (size_t) (len), 0, _ALLOC_TAG)
 #define new0(type, len)         \
-    (type *) _alloc (sizeof (type) * (size_t) (len), 1)
+    (type *) _alloc (sizeof (type) * (size_t) (len), 1, _ALLOC_TAG)
 #define renew(type, len, ptr)   \
-    (type *) _realloc (ptr, sizeof (type) * (size_t) (len))
+    (type *) _realloc (ptr, sizeof (type) * (size_t) (len), _ALLOC_TAG)
 
 #define FOR_LIST(i, val)        \
     for (i = (alpm_list_t *) (val); i; i = i->next)
 
-void *_alloc (size_t len, int zero);
-void *_realloc (void *ptr, size_t len);
+void *_alloc (size_t len, int zero, const char *tag);
+void *_realloc (void *ptr, size_t len, const char *tag);
+#ifdef ENABLE_ALLOC_STATS
+char *alloc_stats_report (void);
+#endif
 void set_user_agent (void);
 
 #endif /* _SHARED_H */
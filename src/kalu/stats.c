@@ -0,0 +1,236 @@
+/**
+ * kalu - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * stats.c
+ * Copyright (C) 2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+
+#include <config.h>
+
+/* C */
+#include <string.h>
+#include <stdlib.h> /* qsort */
+
+/* glib */
+#include <glib-2.0/glib.h>
+
+/* kalu */
+#include "kalu.h"
+#include "stats.h"
+
+/* timings of the last STATS_RING_SIZE checks. Each check is a list of spans,
+ * a same name can be used multiple times (e.g. one per AUR request) */
+typedef struct _span_t {
+    gchar   *name;
+    gint64   usec;
+} span_t;
+
+static alpm_list_t *ring[STATS_RING_SIZE];
+static gint         cur = -1;
+static GMutex       mutex;
+
+static void
+free_span (span_t *span)
+{
+    g_free (span->name);
+    free (span);
+}
+
+/* starts recording a new check, dropping the oldest one if needed */
+void
+stats_check_begin (void)
+{
+    g_mutex_lock (&mutex);
+    cur = (cur + 1) % STATS_RING_SIZE;
+    alpm_list_free_inner (ring[cur], (alpm_list_fn_free) free_span);
+    alpm_list_free (ring[cur]);
+    ring[cur] = NULL;
+    g_mutex_unlock (&mutex);
+}
+
+/* adds a span name, which started at start (from stats_now()) & ends now.
+ * Can be called from any thread. */
+void
+stats_add (const gchar *name, gint64 start)
+{
+    span_t *span;
+
+    span = new (span_t, 1);
+    span->name = g_strdup (name);
+    span->usec = stats_now () - start;
+
+    g_mutex_lock (&mutex);
+    if (cur < 0)
+    {
+        g_mutex_unlock (&mutex);
+        free_span (span);
+        return;
+    }
+    ring[cur] = alpm_list_add (ring[cur], span);
+    g_mutex_unlock (&mutex);
+}
+
+/* calls fn for each span name of the current/last check, in order of first
+ * use, with the total time spent under that name */
+void
+stats_foreach_last (stats_fn fn, gpointer data)
+{
+    GArray      *names;
+    GHashTable  *totals;
+    alpm_list_t *i;
+    guint        n;
+
+    names = g_array_new (FALSE, FALSE, sizeof (gchar *));
+    totals = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+
+    g_mutex_lock (&mutex);
+    FOR_LIST (i, (cur >= 0) ? ring[cur] : NULL)
+    {
+        span_t *span = i->data;
+        gint64 *total;
+
+        total = g_hash_table_lookup (totals, span->name);
+        if (total == NULL)
+        {
+            total = g_new0 (gint64, 1);
+            g_hash_table_insert (totals, span->name, total);
+            g_array_append_val (names, span->name);
+        }
+        *total += span->usec;
+    }
+    for (n = 0; n < names->len; ++n)
+    {
+        gchar *name = g_array_index (names, gchar *, n);
+
+        fn (name, *(gint64 *) g_hash_table_lookup (totals, name), data);
+    }
+    g_mutex_unlock (&mutex);
+
+    g_hash_table_destroy (totals);
+    g_array_free (names, TRUE);
+}
+
+static int
+cmp_usec (const void *p1, const void *p2)
+{
+    gint64 u1 = *(const gint64 *) p1;
+    gint64 u2 = *(const gint64 *) p2;
+
+    return (u1 > u2) - (u1 < u2);
+}
+
+/* returns (newly allocated) one line per span name, in order of first use,
+ * with min/avg/p95 over all recorded checks; or NULL if nothing recorded */
+gchar *
+stats_report (void)
+{
+    GString     *report;
+    GArray      *names;
+    GHashTable  *samples;
+    alpm_list_t *i;
+    guint        n, nb_checks = 0;
+    gint         c;
+
+    names = g_array_new (FALSE, FALSE, sizeof (gchar *));
+    samples = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+            (GDestroyNotify) g_array_unref);
+
+    g_mutex_lock (&mutex);
+    /* from oldest to most recent */
+    for (c = 1; c <= STATS_RING_SIZE && cur >= 0; ++c)
+    {
+        alpm_list_t *list = ring[(cur + c) % STATS_RING_SIZE];
+
+        if (list == NULL)
+        {
+            continue;
+        }
+        ++nb_checks;
+        FOR_LIST (i, list)
+        {
+            span_t *span = i->data;
+            GArray *arr;
+
+            arr = g_hash_table_lookup (samples, span->name);
+            if (arr == NULL)
+            {
+                arr = g_array_new (FALSE, FALSE, sizeof (gint64));
+                g_hash_table_insert (samples, span->name, arr);
+                g_array_append_val (names, span->name);
+            }
+            g_array_append_val (arr, span->usec);
+        }
+    }
+
+    if (names->len == 0)
+    {
+        g_mutex_unlock (&mutex);
+        g_hash_table_unref (samples);
+        g_array_free (names, TRUE);
+        return NULL;
+    }
+
+    report = g_string_new (NULL);
+    g_string_append_printf (report, _("Timings over the last %d checks:"),
+            nb_checks);
+    for (n = 0; n < names->len; ++n)
+    {
+        const gchar *name = g_array_index (names, gchar *, n);
+        GArray      *arr = g_hash_table_lookup (samples, name);
+        gint64      *usecs = (gint64 *) arr->data;
+        gint64       total = 0;
+        guint        k, p95;
+
+        qsort (usecs, arr->len, sizeof (gint64), cmp_usec);
+        for (k = 0; k < arr->len; ++k)
+        {
+            total += usecs[k];
+        }
+        /* nearest-rank */
+        p95 = (arr->len * 95 + 99) / 100 - 1;
+
+        g_string_append_printf (report,
+                "\n%-20s %3u  min %.3fs  avg %.3fs  p95 %.3fs",
+                name, arr->len,
+                (double) usecs[0] / G_USEC_PER_SEC,
+                (double) total / arr->len / G_USEC_PER_SEC,
+                (double) usecs[p95] / G_USEC_PER_SEC);
+    }
+    g_mutex_unlock (&mutex);
+
+    g_hash_table_unref (samples);
+    g_array_free (names, TRUE);
+    return g_string_free (report, FALSE);
+}
+
+void
+stats_free (void)
+{
+    gint c;
+
+    g_mutex_lock (&mutex);
+    for (c = 0; c < STATS_RING_SIZE; ++c)
+    {
+        alpm_list_free_inner (ring[c], (alpm_list_fn_free) free_span);
+        alpm_list_free (ring[c]);
+        ring[c] = NULL;
+    }
+    cur = -1;
+    g_mutex_unlock (&mutex);
+}
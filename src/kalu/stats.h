@@ -0,0 +1,52 @@
+/**
+ * kalu - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * stats.h
+ * Copyright (C) 2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _KALU_STATS_H
+#define _KALU_STATS_H
+
+/* glib */
+#include <glib-2.0/glib.h>
+
+/* nb of checks we keep timings of */
+#define STATS_RING_SIZE         10
+
+#define stats_now()             g_get_monotonic_time ()
+
+void
+stats_check_begin (void);
+
+void
+stats_add (const gchar *name, gint64 start);
+
+gchar *
+stats_report (void);
+
+typedef void (*stats_fn) (const gchar *name, gint64 usec, gpointer data);
+
+void
+stats_foreach_last (stats_fn fn, gpointer data);
+
+void
+stats_free (void);
+
+#endif /* _KALU_STATS_H */
@@ -22,6 +22,10 @@
 
 #include <config.h>
 
+/* tag debug() messages & allocations */
+#define DEBUG_SUBSYS    SUBSYS_UPDATER
+#define ALLOC_TAG       "gui"
+
 /* C */
 #include <string.h> /* strdup */
 
@@ -40,6 +44,8 @@
 #include "kalu-updater.h"
 #include "conf.h"
 #include "gui.h" /* show_notif() */
+#include "kalu-alpm.h" /* kalu_alpm_get_cached_dbpath() */
+#include "prefetch.h"
 
 #include "../kalu-dbus/kupdater.h"
 
@@ -162,6 +168,8 @@ typedef struct _updater_t {
     guint total_inst;
     guint total_dl;
 
+    gint nb_imported; /* from ImportDbs, -1 if not (yet) known */
+
     KaluUpdater *kupdater;
 
     alpm_list_t *cmdline_post;
@@ -434,7 +442,10 @@ on_log (KaluUpdater *kupdater _UNUSED_, loglevel_t level, const gchar *msg)
     }
     else if (level & LOG_DEBUG)
     {
-        debug ("ALPM: %s", msg);
+        if (log_enabled (SUBSYS_ALPM, 1))
+        {
+            log_msg (SUBSYS_ALPM, "%s", msg);
+        }
     }
     else if (level & LOG_FUNCTION)
     {
@@ -1268,6 +1279,7 @@ on_download (KaluUpdater *kupdater _UNUSED_, const gchar *filename,
                     *s = '\0';
 
                     /* locate pkg in tree */
+                    free (pkg_iter->iter);
                     pkg_iter->iter = get_iter_for_pkg (pkg, TRUE);
                     if (pkg_iter->iter == NULL)
                     {
@@ -1333,6 +1345,12 @@ on_download (KaluUpdater *kupdater _UNUSED_, const gchar *filename,
     }
 }
 
+static void
+on_import_dbs (KaluUpdater *kupdater _UNUSED_, gint nb)
+{
+    updater->nb_imported = nb;
+}
+
 static void
 on_sync_dbs (KaluUpdater *kupdater _UNUSED_, gint nb)
 {
@@ -1416,7 +1434,9 @@ btn_close_cb (GtkButton *button _UNUSED_, gpointer data _UNUSED_)
             kalu_updater_no_sysupgrade (updater->kupdater, NULL, NULL, NULL, NULL);
             updater->step = STEP_NONE;
         }
-        kalu_updater_free_alpm (updater->kupdater, NULL, NULL, NULL, NULL);
+        kalu_updater_free_alpm (updater->kupdater,
+                (guint) config->updater_idle_timeout,
+                NULL, NULL, NULL, NULL);
     }
     gtk_widget_destroy (updater->window);
 }
@@ -1596,18 +1616,21 @@ btn_sysupgrade_cb (GtkButton *button _UNUSED_, gpointer data _UNUSED_)
 
 static void
 updater_get_packages_cb (KaluUpdater *kupdater _UNUSED_, const gchar *errmsg,
-                         alpm_list_t *pkgs, gpointer data _UNUSED_)
+                         GVariantIter *pkgs, gpointer data _UNUSED_)
 {
-    alpm_list_t     *i;
-    kalu_package_t  *k_pkg;
+    GtkTreeModel    *model = GTK_TREE_MODEL (updater->store);
     GtkTreeIter      iter;
+    const gchar     *name, *desc, *old_version, *new_version;
+    guint            pkg_dl_size, old_size, new_size;
+    gint             sort_id;
+    GtkSortType      sort_order;
 
     if (errmsg != NULL)
     {
         _show_error (_("Failed to get packages list"), "%s", errmsg);
         return;
     }
-    else if (pkgs == NULL)
+    else if (g_variant_iter_n_children (pkgs) == 0)
     {
         _show_error (_("No packages to upgrade"),
                 _("Your system is already up-to-date."));
@@ -1619,34 +1642,55 @@ updater_get_packages_cb (KaluUpdater *kupdater _UNUSED_, const gchar *errmsg,
     gint net_size = 0;
     updater->total_dl = 0; /* will be set through on_total_download */
     updater->total_inst = 0;
-    FOR_LIST (i, pkgs)
-    {
-        k_pkg = i->data;
-        gtk_list_store_append (updater->store, &iter);
-        gtk_list_store_set (updater->store, &iter,
-                UCOL_PACKAGE,           k_pkg->name,
-                UCOL_DESC,              k_pkg->desc,
-                UCOL_OLD,               k_pkg->old_version,
-                UCOL_NEW,               k_pkg->new_version,
-                UCOL_DL_SIZE,           k_pkg->dl_size,
-                UCOL_OLD_SIZE,          k_pkg->old_size,
-                UCOL_NEW_SIZE,          k_pkg->new_size,
-                UCOL_NET_SIZE,          k_pkg->new_size - k_pkg->old_size,
+
+    /* rows are added in bulk: detached from the view & unsorted, so there's
+     * no redraw nor sorted insert for each one, only a sort at the end */
+    g_object_ref (model);
+    gtk_tree_view_set_model (GTK_TREE_VIEW (updater->list), NULL);
+    gtk_tree_sortable_get_sort_column_id (GTK_TREE_SORTABLE (model),
+            &sort_id, &sort_order);
+    gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (model),
+            GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID,
+            GTK_SORT_ASCENDING);
+
+    while (g_variant_iter_next (pkgs, "(&s&s&s&suuu)",
+                &name,
+                &desc,
+                &old_version,
+                &new_version,
+                &pkg_dl_size,
+                &old_size,
+                &new_size))
+    {
+        gtk_list_store_insert_with_values (updater->store, &iter, -1,
+                UCOL_PACKAGE,           name,
+                UCOL_DESC,              desc,
+                UCOL_OLD,               old_version,
+                UCOL_NEW,               new_version,
+                UCOL_DL_SIZE,           pkg_dl_size,
+                UCOL_OLD_SIZE,          old_size,
+                UCOL_NEW_SIZE,          new_size,
+                UCOL_NET_SIZE,          new_size - old_size,
                 UCOL_DL_IS_ACTIVE,      FALSE,
                 UCOL_INST_IS_ACTIVE,    FALSE,
-                UCOL_DL_IS_DONE,        k_pkg->dl_size == 0,
+                UCOL_DL_IS_DONE,        pkg_dl_size == 0,
                 UCOL_INST_IS_DONE,      FALSE,
                 UCOL_PCTG,              0.0,
                 -1);
-        dl_size += k_pkg->dl_size;
-        inst_size += k_pkg->new_size;
-        net_size += (gint) (k_pkg->new_size - k_pkg->old_size);
+        dl_size += pkg_dl_size;
+        inst_size += new_size;
+        net_size += (gint) (new_size - old_size);
         /* total_inst will be used to make up the total install pbar, where
          * each pkg represent its installed size. except we use the old_size
          * for pkgs that have none, i.e. that are being removed */
-        updater->total_inst += (k_pkg->new_size > 0) ? k_pkg->new_size : k_pkg->old_size;
+        updater->total_inst += (new_size > 0) ? new_size : old_size;
     }
 
+    gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (model),
+            sort_id, sort_order);
+    gtk_tree_view_set_model (GTK_TREE_VIEW (updater->list), model);
+    g_object_unref (model);
+
     gchar buffer[255];
     double size;
     const char *unit;
@@ -1735,6 +1779,56 @@ updater_sync_dbs_cb (KaluUpdater *kupdater, const gchar *errmsg, gpointer data _
     }
 }
 
+static void
+start_sync_dbs (KaluUpdater *kupdater)
+{
+    GError *error = NULL;
+
+    updater->step_data = new0 (sync_dbs_t, 1);
+    updater->step = STEP_SYNC_DBS;
+    if (!kalu_updater_sync_dbs (kupdater,
+                NULL,
+                (KaluMethodCallback) updater_sync_dbs_cb,
+                NULL,
+                &error))
+    {
+        _show_error (_("Failed to synchronize databases"), "%s",
+                error->message);
+        g_clear_error (&error);
+        free (updater->step_data);
+        updater->step_data = NULL;
+        updater->step = STEP_NONE;
+    }
+}
+
+static void
+updater_import_dbs_cb (KaluUpdater *kupdater, const gchar *errmsg,
+        gpointer data _UNUSED_)
+{
+    /* not fatal, dbs will simply be synced as usual */
+    if (errmsg != NULL)
+    {
+        add_log (LOGTYPE_UNIMPORTANT, _(" failed\n"));
+        debug ("ImportDbs failed: %s", errmsg);
+    }
+    else if (updater->nb_imported > 0)
+    {
+        add_log (LOGTYPE_UNIMPORTANT,
+                _n(" %d imported\n", " %d imported\n",
+                    (long unsigned int) updater->nb_imported),
+                updater->nb_imported);
+    }
+    else if (updater->nb_imported == 0)
+    {
+        add_log (LOGTYPE_UNIMPORTANT, _(" none newer\n"));
+    }
+    else
+    {
+        add_log (LOGTYPE_UNIMPORTANT, _(" ok\n"));
+    }
+    start_sync_dbs (kupdater);
+}
+
 static void
 updater_add_db_cb (KaluUpdater *kupdater, const gchar *errmsg, add_db_t *add_db)
 {
@@ -1788,26 +1882,33 @@ updater_add_db_cb (KaluUpdater *kupdater, const gchar *errmsg, add_db_t *add_db)
     }
     else
     {
+        const gchar *dbpath = kalu_alpm_get_cached_dbpath ();
+
         free_pacman_config (add_db->pac_conf);
         free (add_db);
         gtk_progress_bar_set_fraction (
                 GTK_PROGRESS_BAR (updater->pbar_main), 1);
-        /* we're good, so let's sync dbs */
-        updater->step_data = new0 (sync_dbs_t, 1);
-        updater->step = STEP_SYNC_DBS;
-        if (!kalu_updater_sync_dbs (kupdater,
-                    NULL,
-                    (KaluMethodCallback) updater_sync_dbs_cb,
-                    NULL,
-                    &error))
+
+        /* we're good. If the checker has its copy of dbs around, have them
+         * imported first, to avoid downloading them all over again */
+        if (dbpath)
         {
-            _show_error (_("Failed to synchronize databases"), "%s",
-                    error->message);
+            updater->nb_imported = -1;
+            add_log (LOGTYPE_UNIMPORTANT, _("Importing databases... "));
+            if (kalu_updater_import_dbs (kupdater,
+                        dbpath,
+                        NULL,
+                        (KaluMethodCallback) updater_import_dbs_cb,
+                        NULL,
+                        &error))
+            {
+                return;
+            }
+            add_log (LOGTYPE_UNIMPORTANT, _(" failed\n"));
+            debug ("ImportDbs failed: %s", error->message);
             g_clear_error (&error);
-            free (updater->step_data);
-            updater->step_data = NULL;
-            updater->step = STEP_NONE;
         }
+        start_sync_dbs (kupdater);
     }
 }
 
@@ -1837,21 +1938,16 @@ updater_init_alpm_cb (KaluUpdater *kupdater, const gchar *errmsg,
 }
 
 static void
-updater_method_cb (KaluUpdater *kupdater, const gchar *errmsg,
+updater_open_peer_cb (KaluUpdater *kupdater, const gchar *errmsg,
         pacman_config_t *pac_conf)
 {
     GError *error = NULL;
 
+    /* not fatal, signals will simply keep coming over the system bus */
     if (errmsg != NULL)
     {
-        add_log (LOGTYPE_UNIMPORTANT, _(" failed\n"));
-        _show_error (_("Failed to initialize"), "%s", errmsg);
-        free_pacman_config (pac_conf);
-        return;
+        debug ("OpenPeer failed: %s", errmsg);
     }
-    add_log (LOGTYPE_UNIMPORTANT, _(" ok\n"));
-    gtk_progress_bar_set_fraction (
-            GTK_PROGRESS_BAR (updater->pbar_main), 0.23);
 
     add_log (LOGTYPE_UNIMPORTANT, _("Initializing ALPM library..."));
     gtk_label_set_text (GTK_LABEL (updater->lbl_main),
@@ -1871,6 +1967,7 @@ updater_method_cb (KaluUpdater *kupdater, const gchar *errmsg,
                 pac_conf->ignoregroups,
                 pac_conf->noupgrades,
                 pac_conf->noextracts,
+                pac_conf->paralleldownloads,
                 NULL,
                 (KaluMethodCallback) updater_init_alpm_cb,
                 (gpointer) pac_conf,
@@ -1884,6 +1981,43 @@ updater_method_cb (KaluUpdater *kupdater, const gchar *errmsg,
     }
 }
 
+static void
+updater_method_cb (KaluUpdater *kupdater, const gchar *errmsg,
+        pacman_config_t *pac_conf)
+{
+    GError *error = NULL;
+
+    if (errmsg != NULL)
+    {
+        add_log (LOGTYPE_UNIMPORTANT, _(" failed\n"));
+        _show_error (_("Failed to initialize"), "%s", errmsg);
+        free_pacman_config (pac_conf);
+        return;
+    }
+    add_log (LOGTYPE_UNIMPORTANT, _(" ok\n"));
+    gtk_progress_bar_set_fraction (
+            GTK_PROGRESS_BAR (updater->pbar_main), 0.23);
+
+    /* kalu-dbus only sends Debug signals if asked to */
+    if (log_enabled (SUBSYS_UPDATER, 1)
+            && !kalu_updater_set_debug (kupdater,
+                (guint) log_levels[SUBSYS_UPDATER], NULL, &error))
+    {
+        debug ("SetDebug failed: %s", error->message);
+        g_clear_error (&error);
+    }
+
+    if (!kalu_updater_open_peer (kupdater, NULL,
+                (KaluMethodCallback) updater_open_peer_cb,
+                (gpointer) pac_conf,
+                &error))
+    {
+        debug ("OpenPeer failed: %s", error->message);
+        g_clear_error (&error);
+        updater_open_peer_cb (kupdater, NULL, pac_conf);
+    }
+}
+
 static void
 updater_new_cb (GObject *source _UNUSED_, GAsyncResult *res,
         pacman_config_t *pac_conf)
@@ -1914,6 +2048,10 @@ updater_new_cb (GObject *source _UNUSED_, GAsyncResult *res,
             "downloading",
             G_CALLBACK (on_download),
             NULL);
+    g_signal_connect (kalu_updater,
+            "import-dbs",
+            G_CALLBACK (on_import_dbs),
+            NULL);
     g_signal_connect (kalu_updater,
             "sync-dbs",
             G_CALLBACK (on_sync_dbs),
@@ -2020,6 +2158,15 @@ updater_new_cb (GObject *source _UNUSED_, GAsyncResult *res,
     }
 }
 
+static void
+updater_create (pacman_config_t *pac_conf)
+{
+    add_log (LOGTYPE_UNIMPORTANT, _("Creating kalu_updater..."));
+    kalu_updater_new (NULL,
+            (GAsyncReadyCallback) updater_new_cb,
+            (gpointer) pac_conf);
+}
+
 static void
 format_size (guint size, gchar *buf, gboolean is_signed)
 {
@@ -2506,9 +2653,15 @@ updater_run (const gchar *conffile, alpm_list_t *cmdline_post)
         return;
     }
 
+    /* kalu-dbus only serves one client at a time, so if packages are being
+     * downloaded in the background, wait for that to be done first */
+    if (prefetch_wait ((prefetch_done_fn) updater_create, pac_conf))
+    {
+        add_log (LOGTYPE_NORMAL,
+                _("Waiting for the download of packages in the background to complete...\n"));
+        return;
+    }
+
     /* create kalu_updater */
-    add_log (LOGTYPE_UNIMPORTANT, _("Creating kalu_updater..."));
-    kalu_updater_new (NULL,
-            (GAsyncReadyCallback) updater_new_cb,
-            (gpointer) pac_conf);
+    updater_create (pac_conf);
 }
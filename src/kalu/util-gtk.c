@@ -22,6 +22,10 @@
 
 #include <config.h>
 
+/* tag debug() messages & allocations */
+#define DEBUG_SUBSYS    SUBSYS_GUI
+#define ALLOC_TAG       "gui"
+
 /* C */
 #include <stdlib.h>
 #include <string.h>
@@ -410,106 +410,349 @@ snprint_size (char *buf, int buflen, double size, const char *unit)
     snprintf (buf, (size_t) buflen, fmt, size, unit);
 }
 
-void
-parse_tpl (
-        char             *tpl,
-        char            **text,
-        unsigned int     *len,
-        unsigned int     *alloc,
-        replacement_t   **_replacements,
-        gboolean          escaping
-        )
+/* a template is compiled into a list of ops, each being either a literal run
+ * (pointing into src) or a placeholder, so rendering doesn't have to look for
+ * placeholders & compare names again, and the length of the result can be
+ * known beforehand. */
+typedef struct _tpl_op_t {
+    const char  *s;     /* literal run, or the placeholder itself ("$NAME") */
+    size_t       len;
+    int          var;   /* tpl_var_t, or -1 for a literal */
+} tpl_op_t;
+
+struct _tpl_t {
+    char        *src;
+    tpl_op_t    *ops;
+    int          nb_ops;
+    size_t       literal_len;
+};
+
+static const struct {
+    const char  *name;
+    gboolean     need_escaping;
+} tpl_vars[NB_TPL_VARS] = {
+    { "PKG",    TRUE },
+    { "OLD",    FALSE },
+    { "NEW",    FALSE },
+    { "DL",     FALSE },
+    { "INS",    FALSE },
+    { "NET",    FALSE },
+    { "DESC",   TRUE },
+    { "NEWS",   TRUE },
+    { "NB",     FALSE },
+};
+
+tpl_t *
+tpl_compile (const char *template)
 {
-    replacement_t *r, **replacements;
-    char *t;
-    char *s;
-    char *b;
-    size_t l;
-    char found;
+    tpl_t   *tpl;
+    tpl_op_t *op;
+    char    *t;
+    char    *lit;
+    int      nb;
+
+    if (!template)
+    {
+        return NULL;
+    }
 
-    for (t = tpl, s = *text + *len; *t; ++t)
+    tpl = new0 (tpl_t, 1);
+    tpl->src = strdup (template);
+    /* at most a literal & a placeholder per '$', and a final literal */
+    for (nb = 1, t = tpl->src; *t; ++t)
     {
-        found = 0;
+        if (*t == '$')
+        {
+            nb += 2;
+        }
+    }
+    tpl->ops = new (tpl_op_t, nb);
 
-        /* placeholder? */
+    for (t = lit = tpl->src; *t; )
+    {
         if (*t == '$')
         {
-            replacements = _replacements;
-            for (r = *replacements; r; ++replacements, r = *replacements)
+            size_t l, best_len = 0;
+            int    i, best = -1;
+
+            /* longest match, so e.g. $NEWS isn't taken for $NEW */
+            for (i = 0; i < NB_TPL_VARS; ++i)
+            {
+                l = strlen (tpl_vars[i].name);
+                if (l > best_len && strncmp (t + 1, tpl_vars[i].name, l) == 0)
+                {
+                    best = i;
+                    best_len = l;
+                }
+            }
+            if (best >= 0)
             {
-                if (r->name == NULL || r->value == NULL)
+                if (t > lit)
                 {
-                    continue;
+                    op = &tpl->ops[tpl->nb_ops++];
+                    op->s = lit;
+                    op->len = (size_t) (t - lit);
+                    op->var = -1;
+                    tpl->literal_len += op->len;
                 }
+                op = &tpl->ops[tpl->nb_ops++];
+                op->s = t;
+                op->len = best_len + 1;
+                op->var = best;
+                t += op->len;
+                lit = t;
+                continue;
+            }
+        }
+        ++t;
+    }
+    if (t > lit)
+    {
+        op = &tpl->ops[tpl->nb_ops++];
+        op->s = lit;
+        op->len = (size_t) (t - lit);
+        op->var = -1;
+        tpl->literal_len += op->len;
+    }
+
+    return tpl;
+}
+
+void
+tpl_free (tpl_t *tpl)
+{
+    if (!tpl)
+    {
+        return;
+    }
+    free (tpl->src);
+    free (tpl->ops);
+    free (tpl);
+}
+
+static inline const char *
+escape_char (char c)
+{
+    switch (c)
+    {
+        case '&':
+            return "&amp;";
+        case '\'':
+            return "&apos;";
+        case '"':
+            return "&quot;";
+        case '<':
+            return "&lt;";
+        case '>':
+            return "&gt;";
+        default:
+            return NULL;
+    }
+}
+
+/* returns the length of tpl once rendered with values (indexed by tpl_var_t,
+ * NULL for placeholders left as-is) */
+size_t
+tpl_len (tpl_t *tpl, const char **values, gboolean escaping)
+{
+    size_t  len;
+    int     i;
+
+    if (!tpl)
+    {
+        return 0;
+    }
 
-                l = strlen (r->name);
-                if (strncmp (t + 1, r->name, l) == 0)
+    len = tpl->literal_len;
+    for (i = 0; i < tpl->nb_ops; ++i)
+    {
+        tpl_op_t   *op = &tpl->ops[i];
+        const char *v;
+
+        if (op->var < 0)
+        {
+            continue;
+        }
+        v = values[op->var];
+        if (!v)
+        {
+            len += op->len;
+        }
+        else if (escaping && tpl_vars[op->var].need_escaping)
+        {
+            for ( ; *v; ++v)
+            {
+                const char *e = escape_char (*v);
+                len += (e) ? strlen (e) : 1;
+            }
+        }
+        else
+        {
+            len += strlen (v);
+        }
+    }
+    return len;
+}
+
+/* renders tpl into s, which must have room for (at least) tpl_len() bytes.
+ * Returns the end of what was written (not NUL-terminated) */
+char *
+tpl_render (tpl_t *tpl, char *s, const char **values, gboolean escaping)
+{
+    int i;
+
+    if (!tpl)
+    {
+        return s;
+    }
+
+    for (i = 0; i < tpl->nb_ops; ++i)
+    {
+        tpl_op_t   *op = &tpl->ops[i];
+        const char *v;
+
+        v = (op->var < 0) ? NULL : values[op->var];
+        if (!v)
+        {
+            memcpy (s, op->s, op->len);
+            s += op->len;
+        }
+        else if (escaping && tpl_vars[op->var].need_escaping)
+        {
+            for ( ; *v; ++v)
+            {
+                const char *e = escape_char (*v);
+                if (e)
                 {
-                    for (b = r->value; *b; ++b)
+                    while (*e)
                     {
-                        const gchar *esc[] =
-                        {
-                            "&",  "&amp;",
-                            "'",  "&apos;",
-                            "\"", "&quot;",
-                            "<",  "&lt;",
-                            ">",  "&gt;",
-                            NULL
-                        };
-                        gchar *_s;
-                        unsigned int _l, i;
-
-                        _s = b;
-                        _l = 1;
-                        if (escaping && r->need_escaping)
-                        {
-                            const gchar **e;
-
-                            for (e = esc; *e; e += 2)
-                            {
-                                if (*_s == *e[0])
-                                {
-                                    _s = (gchar *) e[1];
-                                    _l = (unsigned int) strlen (_s);
-                                    break;
-                                }
-                            }
-                        }
-
-                        /* enough memory? */
-                        if (*len + _l >= *alloc)
-                        {
-                            *alloc += 1024;
-                            *text = renew (gchar, *alloc + 1, *text);
-                            s = *text + *len;
-                        }
-
-                        for (i = 0; i < _l; ++i, ++*len)
-                            *s++ = *_s++;
+                        *s++ = *e++;
                     }
-                    t += l;
-                    found = 1;
-                    break;
+                }
+                else
+                {
+                    *s++ = *v;
                 }
             }
         }
-        /* not a placeholder, or nothing known/supported, i.e. just a '$' */
-        if (found == 0)
+        else
+        {
+            size_t l = strlen (v);
+            memcpy (s, v, l);
+            s += l;
+        }
+    }
+    return s;
+}
+
+#define compile_tpl(t)  do {                    \
+    tpl_free (t->c_title);                      \
+    tpl_free (t->c_package);                    \
+    t->c_title = tpl_compile (t->title);        \
+    t->c_package = tpl_compile (t->package);    \
+} while (0)
+/* (re)compiles all templates from config, to be called once loaded */
+void
+compile_templates (void)
+{
+    compile_tpl (config->tpl_upgrades);
+    compile_tpl (config->tpl_watched);
+    compile_tpl (config->tpl_aur);
+    compile_tpl (config->tpl_watched_aur);
+    compile_tpl (config->tpl_news);
+}
+#undef compile_tpl
+
+typedef struct _pkg_values_t {
+    const char  *values[NB_TPL_VARS];
+    char         dl[32];
+    char         ins[32];
+    char         net[32];
+} pkg_values_t;
+
+/* renders the list of packages (kalu_package_t, or news titles if is_news)
+ * using tpl, with sep in between, into one newly allocated string. totals
+ * are filled in, for use in the title */
+char *
+render_packages (tpl_t *tpl, const char *sep, alpm_list_t *packages,
+                 gboolean is_news, gboolean escaping, tpl_totals_t *totals)
+{
+    alpm_list_t  *i;
+    pkg_values_t *pv, *p;
+    const char   *unit;
+    double        size_h;
+    size_t        sep_len = (sep) ? strlen (sep) : 0;
+    size_t        alloc = 0;
+    char         *text;
+    char         *s;
+    int           nb;
+
+    memzero (totals, sizeof (*totals));
+    nb = (int) alpm_list_count (packages);
+    pv = new0 (pkg_values_t, (nb > 0) ? nb : 1);
+
+    /* set values & get the length of it all */
+    for (i = packages, p = pv; i; i = i->next, ++p)
+    {
+        if (is_news)
         {
-            /* copy character */
-            *s++ = *t;
-            ++*len;
+            p->values[TPL_NEWS] = i->data;
+            debug ("-> %s", (char *) i->data);
         }
-        /* out of memory? */
-        if (*len >= *alloc)
+        else
         {
-            *alloc += 1024;
-            *text = renew (gchar, *alloc + 1, *text);
-            s = *text + *len;
+            kalu_package_t *pkg = i->data;
+            int net_size;
+
+            net_size = (int) (pkg->new_size - pkg->old_size);
+            totals->dsize += pkg->dl_size;
+            totals->isize += pkg->new_size;
+            totals->nsize += net_size;
+
+            p->values[TPL_PKG] = pkg->name;
+            p->values[TPL_OLD] = pkg->old_version;
+            p->values[TPL_NEW] = pkg->new_version;
+            size_h = humanize_size (pkg->dl_size, '\0', &unit);
+            snprint_size (p->dl, 32, size_h, unit);
+            p->values[TPL_DL] = p->dl;
+            size_h = humanize_size (pkg->new_size, '\0', &unit);
+            snprint_size (p->ins, 32, size_h, unit);
+            p->values[TPL_INS] = p->ins;
+            size_h = humanize_size (net_size, '\0', &unit);
+            snprint_size (p->net, 32, size_h, unit);
+            p->values[TPL_NET] = p->net;
+            p->values[TPL_DESC] = pkg->desc;
+
+            debug ("-> %s %s -> %s [dl=%d; ins=%d]",
+                    pkg->name,
+                    pkg->old_version,
+                    pkg->new_version,
+                    (int) pkg->dl_size,
+                    (int) pkg->new_size);
         }
+        alloc += tpl_len (tpl, p->values, escaping);
+        ++totals->nb;
+    }
+    if (nb > 1)
+    {
+        alloc += sep_len * (size_t) (nb - 1);
     }
 
+    /* render */
+    text = new (char, alloc + 1);
+    for (s = text, p = pv; p < pv + nb; ++p)
+    {
+        if (p > pv && sep_len > 0)
+        {
+            memcpy (s, sep, sep_len);
+            s += sep_len;
+        }
+        s = tpl_render (tpl, s, p->values, escaping);
+    }
     *s = '\0';
+
+    free (pv);
+    return text;
 }
 
 int
@@ -523,3 +766,158 @@ watched_package_cmp (watched_package_t *w_pkg1, watched_package_t *w_pkg2)
     }
     return ret;
 }
+
+/**
+ * Returns whether we're currently within the skip period (if any)
+ */
+gboolean
+is_within_skip (void)
+{
+    if (!config->has_skip)
+    {
+        return FALSE;
+    }
+
+    GDateTime *now, *begin, *end;
+    gint year, month, day;
+    gboolean within_skip = FALSE;
+
+    now = g_date_time_new_now_local ();
+    /* create GDateTime for begin & end of skip period */
+    /* Note: begin & end are both for the current day, which means we can
+     * have begin > end, with e.g. 18:00-09:00 */
+    g_date_time_get_ymd (now, &year, &month, &day);
+    begin = g_date_time_new_local (year, month, day,
+            config->skip_begin_hour, config->skip_begin_minute, 0);
+    end = g_date_time_new_local (year, month, day,
+            config->skip_end_hour, config->skip_end_minute, 0);
+
+    /* determine if we're within skip period */
+    /* is begin > end ? e.g. 18:00 -> 09:00 */
+    if (g_date_time_compare (begin, end) == 1)
+    {
+        /* we're within if before end OR after begin */
+        within_skip = (g_date_time_compare (now, end) == -1
+                || g_date_time_compare (now, begin) == 1);
+    }
+    /* e.g. 09:00 -> 18:00 */
+    else
+    {
+        /* we're within if after begin AND before end */
+        within_skip = (g_date_time_compare (now, begin) == 1
+                && g_date_time_compare (now, end) == -1);
+    }
+
+    g_date_time_unref (now);
+    g_date_time_unref (begin);
+    g_date_time_unref (end);
+
+    return within_skip;
+}
+
+/**
+ * Returns the number of seconds until the next hour:minute, i.e. today or, if
+ * already past, tomorrow
+ */
+guint
+get_seconds_until (gint hour, gint minute)
+{
+    GDateTime *now, *next;
+    GTimeSpan timespan;
+    gint year, month, day, h;
+
+    now = g_date_time_new_now_local ();
+    g_date_time_get_ymd (now, &year, &month, &day);
+    /* if the timeout is for a time before now, it gets bumped to tomorrow */
+    h = g_date_time_get_hour (now);
+    if (h > hour || (h == hour && g_date_time_get_minute (now) > minute))
+    {
+        ++day;
+    }
+    next = g_date_time_new_local (year, month, day, hour, minute, 0);
+
+    timespan = g_date_time_difference (next, now);
+
+    g_date_time_unref (now);
+    g_date_time_unref (next);
+
+    return (guint) (timespan / G_TIME_SPAN_SECOND);
+}
+
+/* current interval between auto-checks, when adaptive (in seconds) */
+static gint cur_interval = 0;
+
+static void
+get_interval_bounds (gint *min, gint *max)
+{
+    *min = (config->interval_min > 0) ? config->interval_min : config->interval;
+    *max = (config->interval_max > 0) ? config->interval_max : config->interval;
+    if (*max < *min)
+    {
+        *max = *min;
+    }
+}
+
+/**
+ * Adapt the interval after a check: when a mirror update was observed
+ * (nb_syncdbs > 0) we go back to IntervalMin, since more could follow; while
+ * nothing changes the interval gets stretched, up to IntervalMax.
+ * nb_syncdbs < 0 means dbs weren't synced (or failed to), so no change.
+ */
+void
+update_interval (gint nb_syncdbs)
+{
+    gint min, max;
+
+    if (config->interval_min <= 0 && config->interval_max <= 0)
+    {
+        return;
+    }
+    get_interval_bounds (&min, &max);
+
+    if (cur_interval <= 0)
+    {
+        cur_interval = config->interval;
+    }
+
+    if (nb_syncdbs > 0)
+    {
+        cur_interval = min;
+    }
+    else if (nb_syncdbs == 0)
+    {
+        cur_interval += cur_interval / 2;
+    }
+
+    cur_interval = CLAMP (cur_interval, min, max);
+    debug ("adaptive interval: %d seconds (%d dbs synced)",
+            cur_interval, nb_syncdbs);
+}
+
+/**
+ * Returns the seconds until next auto-check. When adaptive, a jitter of up
+ * to 10% is added, so many clients don't all hit the mirrors at once; the
+ * result still stays within IntervalMin and IntervalMax.
+ */
+guint
+get_interval (void)
+{
+    gint interval;
+    gint jitter;
+    gint min, max;
+
+    if (config->interval_min <= 0 && config->interval_max <= 0)
+    {
+        return (guint) config->interval;
+    }
+
+    interval = (cur_interval > 0) ? cur_interval : config->interval;
+    jitter = interval / 10;
+    if (jitter > 0)
+    {
+        interval += g_random_int_range (-jitter, jitter + 1);
+    }
+    get_interval_bounds (&min, &max);
+    interval = CLAMP (interval, min, max);
+    return (guint) MAX (interval, 60);
+}
@@ -33,11 +33,27 @@
 #include "kalu.h"
 #include "kalu-alpm.h"
 
-typedef struct _replacement_t {
-    const char *name;
-    char *value;
-    gboolean need_escaping;
-} replacement_t;
+/* placeholders usable in templates, see notify_updates() */
+typedef enum {
+    TPL_PKG = 0,
+    TPL_OLD,
+    TPL_NEW,
+    TPL_DL,
+    TPL_INS,
+    TPL_NET,
+    TPL_DESC,
+    TPL_NEWS,
+    TPL_NB,
+    NB_TPL_VARS
+} tpl_var_t;
+
+/* totals over the packages rendered by render_packages() */
+typedef struct _tpl_totals_t {
+    int     nb;
+    off_t   dsize;
+    off_t   isize;
+    off_t   nsize;
+} tpl_totals_t;
 
 gboolean
 ensure_path (char *path);
@@ -66,11 +82,38 @@ rmrf (const char *path);
 void
 snprint_size (char *buf, int buflen, double size, const char *unit);
 
+tpl_t *
+tpl_compile (const char *template);
+
 void
-parse_tpl (char *tpl, char **text, unsigned int *len, unsigned int *alloc,
-           replacement_t **replacements, gboolean escaping);
+tpl_free (tpl_t *tpl);
+
+size_t
+tpl_len (tpl_t *tpl, const char **values, gboolean escaping);
+
+char *
+tpl_render (tpl_t *tpl, char *s, const char **values, gboolean escaping);
+
+void
+compile_templates (void);
+
+char *
+render_packages (tpl_t *tpl, const char *sep, alpm_list_t *packages,
+                 gboolean is_news, gboolean escaping, tpl_totals_t *totals);
 
 int
 watched_package_cmp (watched_package_t *w_pkg1, watched_package_t *w_pkg2);
 
+gboolean
+is_within_skip (void);
+
+guint
+get_seconds_until (gint hour, gint minute);
+
+void
+update_interval (gint nb_syncdbs);
+
+guint
+get_interval (void);
+
 #endif /* _KALU_UTIL_H */